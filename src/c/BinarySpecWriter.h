@@ -0,0 +1,118 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * The BinarySpecWriter writes spectra as fixed-layout records that can
+ * be read by mapping the file into memory.  All values are in the
+ * byte order of the machine that wrote them.
+ *
+ * The file starts with a 16-byte header:
+ *   char[8] "BLIBSPEC", int32 version, int32 header size (16)
+ * followed by one record per spectrum, each a multiple of 8 bytes:
+ *   int32  record size in bytes, including this field
+ *   int32  library spectrum id
+ *   int32  charge
+ *   int32  number of peaks, n
+ *   int32  length of the modified sequence, len
+ *   int32  unused, 0
+ *   double precursor m/z
+ *   double m/z[n]
+ *   float  intensity[n]
+ *   char   modified sequence[len], not null-terminated
+ *   zero padding to the next multiple of 8
+ * Parts written without a header can be appended to a file that has
+ * one.
+ */
+
+#include "SpecWriter.h"
+
+namespace BiblioSpec {
+
+class BinarySpecWriter : public SpecWriter {
+ public:
+    BinarySpecWriter(const ops::variables_map& options_table) :
+    SpecWriter(options_table)
+    {
+        Verbosity::comment(V_DETAIL, "Creating BinarySpecWriter.");
+    };
+
+    virtual void formatSpectrum(const RefSpectrum& spec, bool, string& out){
+        string modSeq = spec.getMods();
+        const vector<PEAK_T>& peaks = spec.getRawPeaks(); 
+        int numPeaks = (int)peaks.size();
+        int seqLength = (int)modSeq.size();
+
+        size_t size = RECORD_HEADER_SIZE + numPeaks * sizeof(double) +
+            numPeaks * sizeof(float) + seqLength;
+        size_t padding = (8 - size % 8) % 8;
+        size += padding;
+
+        appendRaw(out, (int)size);
+        appendRaw(out, spec.getLibSpecID());
+        appendRaw(out, spec.getCharge());
+        appendRaw(out, numPeaks);
+        appendRaw(out, seqLength);
+        appendRaw(out, (int)0);
+        appendRaw(out, spec.getMz());
+        for(int i = 0; i < numPeaks; i++){
+            appendRaw(out, peaks[i].mz);
+        }
+        for(int i = 0; i < numPeaks; i++){
+            appendRaw(out, peaks[i].intensity);
+        }
+        out += modSeq;
+        out.append(padding, '\0');
+    };
+
+ protected:
+    static const int VERSION = 1;
+    static const int FILE_HEADER_SIZE = 16;
+    static const size_t RECORD_HEADER_SIZE = 6 * sizeof(int) + sizeof(double);
+
+    virtual bool isBinary(){ return true; };
+
+    virtual void formatHeader(string& out){
+        out.append("BLIBSPEC", 8);
+        appendRaw(out, (int)VERSION);
+        appendRaw(out, (int)FILE_HEADER_SIZE);
+    };
+};
+
+} // namespace BiblioSpec
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -42,6 +42,7 @@
 
 #include "BlibBuilder.h"
 #include "AllBuildParsers.h"
+#include "MappedLibrary.h"
 
 using namespace std;
 using namespace BiblioSpec;
@@ -75,9 +76,13 @@ int main(int argc, char* argv[])
             
             char* result_file = inFiles.at(i);
             
+            progress.increment();
+            if( builder.inputCommitted(i) ){
+                continue;
+            }
             Verbosity::comment(V_STATUS, "Reading results from %s.", 
                                result_file);
-            progress.increment();
+            builder.beginInput(i);
             
             if(has_extension(result_file, ".pep.xml") || 
                has_extension(result_file, ".pep.XML") ||
@@ -139,22 +144,27 @@ int main(int argc, char* argv[])
                 errorMsg += result_file;
                 throw errorMsg;
             }
+            builder.endInput();
         } catch(BlibException& e){
             cerr << "ERROR: " << e.what() << endl;
             if( ! e.hasFilename() ){
                 cerr << "ERROR: reading file " << inFiles.at(i) << endl;
             }
             success = false;
+            builder.abortInput();
         } catch(std::exception& e){
             cerr << "ERROR: " << e.what() 
                  << " in file '" << inFiles.at(i) << "'." << endl;
             success = false;
+            builder.abortInput();
         } catch(string s){ // in case a throwParseError is not caught
             cerr << "ERROR: " << s << endl;
             success = false;
+            builder.abortInput();
         } catch(...){
             cerr << "ERROR: reading file '" << inFiles.at(i) << "'" << endl;
             success = false;
+            builder.abortInput();
         }
     }
     
@@ -170,6 +180,9 @@ int main(int argc, char* argv[])
     }
 
     builder.commit();
+    if( builder.writeMappedIndex() ){
+        MappedLibrary::write(builder.getLibName());
+    }
     
     Verbosity::close_logfile();
     return !success;
@@ -38,13 +38,22 @@
  */
 
 #include "BlibBuilder.h"
+#include "zlib.h"
 
 using namespace std;
 
 namespace BiblioSpec {
 
+// Rough size of one accepted PSM in a search result file, used to
+// guess how many spectra an append will add.  Errs on the small side
+// so that the estimate is high.
+static const int BYTES_PER_PSM_ESTIMATE = 500;
+
 BlibBuilder::BlibBuilder():
-level_compress(3)
+level_compress(3), peak_codec(ZLIB_PEAK_CODEC), max_append_ratio(0.1), resume(false),
+write_mapped_index(false),
+cur_manifest_id(-1), cur_first_spec_id(-1),
+info_file(-1), info_size(0), info_mod_time(0)
 {
     scoreThresholds[SQT] = 0.01;    // 1% FDR
     scoreThresholds[PEPXML] = 0.95; // peptide prophet probability  
@@ -67,6 +76,8 @@ void BlibBuilder::usage()
         "Usage: BlibBuild [options] <*.sqt|*.pep.xml|*.pepXML|*.blib|*.idpXML|*.dat|*.ssl|*.mzid|*.perc.xml|*final_fragment.csv>+ <library_name>\n"
         "   -o                Overwrite existing library. Default append.\n"
         "   -s                Result file names from stdin. e.g. ls *sqt | BlibBuild -s new.blib.\n"
+        "   -R                Resume. Skip input files already added to the library by an earlier run.\n"
+        "   -x                Also write a memory-mapped index of the library (<library>.idx) for BlibSearch.\n"
         "   -q  <max score>   Maximum FDR for accepting results from Percolator (.sqt or .perc.xml) files. Default 0.01.\n"
         "   -p  <min score>   Minimum probability for accepting results from PeptideProphet (.pep.xml) files. Default 0.95.\n"
         "   -e  <max score>   Maximum expectation value for accepting results from Mascot (.dat) files. Default 0.05\n"
@@ -78,8 +89,12 @@ void BlibBuilder::usage()
         "   -L                Write status and warning messages to log file.\n"
         "   -m <size>         SQLite memory cache size in Megs. Default 250M.\n"
         "   -l <level>        ZLib compression level (0-?). Default 3.\n"
+        "   -C <codec>        Peak storage codec: zlib, delta (1e-5 m/z, 0.14% intensity\n"
+        "                     precision) or delta-lossless. Default zlib.\n"
         "   -i <library_id>   LSID library ID. Default uses file name.\n"
-        "   -a <authority>    LSID authority. Default proteome.gs.washington.edu.\n";
+        "   -a <authority>    LSID authority. Default proteome.gs.washington.edu.\n"
+        "   -K <ratio>        When appending, keep indexes if the estimated number of new spectra\n"
+        "                     is below this fraction of the library, else rebuild them. Default 0.1.\n";
     
     cerr << usage << endl;
     exit(1);
@@ -209,37 +224,325 @@ int BlibBuilder::transferLibrary(int iLib,
     Verbosity::status("Transferring spectra from %s.", 
                       base_name(input_files.at(iLib)).c_str());
 
-    // first add all the spectrum source files from incomming library
-    transferSpectrumFiles(schemaTmp);
-
     ProgressIndicator* progress = 
         parentProgress->newNestedIndicator(getSpectrumCount(schemaTmp));
-  
-    sprintf(zSql, "SELECT id FROM %s.RefSpectra", schemaTmp);
-  
+
+    // copy all spectra, peaks, mods and source files in bulk.
+    // Even if you are transfering from a non-redundant library
+    // you only get credit for one spectrum in a redundant library
+    int numberProcessed = transferAllSpectra(schemaTmp, 
+                                             tmpHasAdditionalColumns);
+    progress->add(numberProcessed);
+    
+    endTransaction();
+    delete progress;
+    return numberProcessed;
+}
+
+/**
+ * Decide whether to leave the library indexes in place while
+ * appending.  Updating the indexes row by row is cheaper than
+ * rebuilding them over the whole library when only a few spectra are
+ * being added.
+ * \returns True if the estimated number of new spectra is less than
+ * max_append_ratio times the number already in the library.
+ */
+bool BlibBuilder::keepIndexesOnAppend()
+{
+    int libSpectra = getSpectrumCount();
+    double newSpectra = estimateNewSpectra();
+
+    if( newSpectra < 0 ){
+        return false;
+    }
+    Verbosity::debug("Estimate %.0f new spectra for library with %d.",
+                     newSpectra, libSpectra);
+
+    return (libSpectra > 0 && newSpectra < max_append_ratio * libSpectra);
+}
+
+/**
+ * Estimate how many spectra will be added from the input files.
+ * Libraries report their spectrum count, other result files are
+ * estimated by size.  Missing or unreadable inputs are left for the
+ * build to report.
+ * \returns The estimate or -1 if an input library could not be
+ * counted.
+ */
+double BlibBuilder::estimateNewSpectra()
+{
+    double total = 0;
+    for(int i = 0; i < (int)input_files.size(); i++){
+        const char* file_name = input_files.at(i);
+        struct stat fileStats;
+        if( stat(file_name, &fileStats) != 0 ){
+            continue;
+        }
+        if( !has_extension(file_name, ".blib") ){
+            total += (double)fileStats.st_size / BYTES_PER_PSM_ESTIMATE;
+            continue;
+        }
+
+        int numSpec = countInputSpectra(file_name);
+        if( numSpec < 0 ){
+            Verbosity::debug("Could not count spectra in %s.", file_name);
+            return -1;
+        }
+        total += numSpec;
+    }
+    return total;
+}
+
+/**
+ * Count the spectra in an input library without stopping the build if
+ * it cannot be read.
+ * \returns The count or -1 if it is not available.
+ */
+int BlibBuilder::countInputSpectra(const char* fileName)
+{
+    smart_stmt attachStmt;
+    if( sqlite3_prepare(getDb(), "ATTACH DATABASE ? AS estimate", -1,
+                        &attachStmt, 0) != SQLITE_OK ){
+        return -1;
+    }
+    sqlite3_bind_text(attachStmt, 1, fileName, -1, SQLITE_STATIC);
+    if( sqlite3_step(attachStmt) != SQLITE_DONE ){
+        return -1;
+    }
+
+    int numSpec = -1;
+    const char* queries[] = { "SELECT numSpecs FROM estimate.LibInfo",
+                              "SELECT count(*) FROM estimate.RefSpectra" };
+    for(int i = 0; i < 2 && numSpec < 0; i++){
+        smart_stmt pStmt;
+        if( sqlite3_prepare(getDb(), queries[i], -1, &pStmt, 0) == SQLITE_OK &&
+            sqlite3_step(pStmt) == SQLITE_ROW ){
+            numSpec = sqlite3_column_int(pStmt, 0); // LibInfo may hold -1
+        }
+    }
+
+    sql_stmt("DETACH DATABASE estimate", true);
+    return numSpec;
+}
+
+/**
+ * Open the library as BlibMaker does and make sure it has a table for
+ * recording which input files have been added.  When resuming, first
+ * remove spectra from any input that was interrupted.
+ */
+void BlibBuilder::init()
+{
+    BlibMaker::init();
+
+    if( !tableExists("main", "BuildManifest") ){
+        createTable("BuildManifest");
+    } else if( resume ){
+        removeUncommittedInputs();
+    }
+}
+
+/**
+ * Get the size and modification time of the given input file.  They
+ * are kept until a different input is looked at.
+ */
+void BlibBuilder::statInputFile(int iFile)
+{
+    if( info_file == iFile ){
+        return;
+    }
+
+    const char* fileName = input_files.at(iFile);
+    struct stat fileStats;
+    if( stat(fileName, &fileStats) != 0 ){
+        throw BlibException(true, "Cannot open input file '%s'.", fileName);
+    }
+    info_file = iFile;
+    info_size = fileStats.st_size;
+    info_mod_time = fileStats.st_mtime;
+    info_hash.clear();
+}
+
+/**
+ * Get a checksum of the contents of the given input file.  The file is
+ * only read the first time it is asked for.
+ */
+const string& BlibBuilder::getInputFileHash(int iFile)
+{
+    statInputFile(iFile);
+    if( !info_hash.empty() ){
+        return info_hash;
+    }
+
+    const char* fileName = input_files.at(iFile);
+    FILE* file = fopen(fileName, "rb");
+    if( file == NULL ){
+        throw BlibException(true, "Cannot open input file '%s'.", fileName);
+    }
+    uLong crc = crc32(0L, Z_NULL, 0);
+    vector<Bytef> buffer(1 << 20);
+    size_t bytesRead = 0;
+    while( (bytesRead = fread(&buffer[0], 1, buffer.size(), file)) > 0 ){
+        crc = crc32(crc, &buffer[0], (uInt)bytesRead);
+    }
+    fclose(file);
+
+    char crcStr[16];
+    sprintf(crcStr, "%08lx", (unsigned long)crc);
+    info_hash = crcStr;
+    return info_hash;
+}
+
+/**
+ * Check the BuildManifest for the given input file.  Only used when
+ * resuming a build.  The contents are only checked when the path, size
+ * and modification time already match a committed entry.
+ * \returns True if the same file (same path, size, modification time
+ * and contents) was completely added to the library by an earlier run.
+ */
+bool BlibBuilder::inputCommitted(int iFile)
+{
+    if( !resume ){
+        return false;
+    }
+
+    const char* fileName = input_files.at(iFile);
+    statInputFile(iFile);
+    string fullPath = getAbsoluteFilePath(fileName);
+
+    strcpy(zSql, "SELECT contentHash, numSpectra FROM BuildManifest "
+           "WHERE fileName = ? AND fileSize = ? AND modTime = ? "
+           "AND committed = 1");
     smart_stmt pStmt;
     int rc = sqlite3_prepare(getDb(), zSql, -1, &pStmt, 0);
-  
-    check_rc(rc, zSql);
-  
+    check_rc(rc, zSql, "Failed looking up input file in build manifest.");
+    sqlite3_bind_text(pStmt, 1, fullPath.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(pStmt, 2, info_size);
+    sqlite3_bind_int64(pStmt, 3, info_mod_time);
+
+    while( sqlite3_step(pStmt) == SQLITE_ROW ){
+        const char* hash = (const char*)sqlite3_column_text(pStmt, 0);
+        if( hash != NULL && getInputFileHash(iFile) == hash ){
+            Verbosity::status("Skipping %s, %d spectra already added.",
+                              base_name(fileName).c_str(),
+                              sqlite3_column_int(pStmt, 1));
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Record in the BuildManifest that spectra from the given input file
+ * are about to be added.  The entry is committed immediately so that
+ * an interrupted build can find and remove a partial input.
+ */
+void BlibBuilder::beginInput(int iFile)
+{
+    const char* fileName = input_files.at(iFile);
+    const string& hash = getInputFileHash(iFile);
+    string fullPath = getAbsoluteFilePath(fileName);
+
+    cur_first_spec_id = getMaxId("main", "RefSpectra") + 1;
+
+    beginTransaction();
+    strcpy(zSql, "INSERT INTO BuildManifest(fileName, fileSize, modTime, "
+           "contentHash, firstSpectrumID, numSpectra, committed) "
+           "VALUES(?, ?, ?, ?, ?, 0, 0)");
+    smart_stmt pStmt;
+    int rc = sqlite3_prepare(getDb(), zSql, -1, &pStmt, 0);
+    check_rc(rc, zSql, "Failed adding input file to build manifest.");
+    sqlite3_bind_text(pStmt, 1, fullPath.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(pStmt, 2, info_size);
+    sqlite3_bind_int64(pStmt, 3, info_mod_time);
+    sqlite3_bind_text(pStmt, 4, hash.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(pStmt, 5, cur_first_spec_id);
     rc = sqlite3_step(pStmt);
-  
-    while(rc==SQLITE_ROW) {
-        progress->increment();
-        
-        int spectraId = sqlite3_column_int(pStmt, 0);
-        
-        // Even if you are transfering from a non-redundant library
-        // you only get credit for one spectrum in a redundant library
-        transferSpectrum(schemaTmp, spectraId, 1, tmpHasAdditionalColumns);
-        
-        rc = sqlite3_step(pStmt);
+    if( rc != SQLITE_DONE ){
+        fail_sql(rc, zSql, NULL, "Failed adding input file to build manifest.");
     }
-    
+    cur_manifest_id = (int)sqlite3_last_insert_rowid(getDb());
+    endTransaction();
+}
+
+/**
+ * Mark the current input file as completely added to the library.
+ */
+void BlibBuilder::endInput()
+{
+    if( cur_manifest_id == -1 ){
+        return;
+    }
+
+    beginTransaction();
+    sprintf(zSql, "UPDATE BuildManifest SET committed = 1, numSpectra = "
+            "(SELECT count(*) FROM RefSpectra WHERE id >= %d) "
+            "WHERE id = %d", cur_first_spec_id, cur_manifest_id);
+    sql_stmt(zSql);
+    endTransaction();
+
+    cur_manifest_id = -1;
+}
+
+/**
+ * The current input file could not be read.  Roll back anything not
+ * yet committed and remove any spectra that were added from it so
+ * that the input can be added again by a later run.
+ */
+void BlibBuilder::abortInput()
+{
+    if( cur_manifest_id == -1 ){
+        return;
+    }
+
+    undoActiveTransaction();
+    beginTransaction();
+    removeSpectraFrom(cur_first_spec_id);
+    sprintf(zSql, "DELETE FROM BuildManifest WHERE id = %d", cur_manifest_id);
+    sql_stmt(zSql);
+    endTransaction();
+
+    cur_manifest_id = -1;
+}
+
+/**
+ * Delete all spectra, with their peaks and modifications, with an id
+ * at least as large as the one given.
+ */
+void BlibBuilder::removeSpectraFrom(int firstSpectrumId)
+{
+    sprintf(zSql, "DELETE FROM RefSpectraPeaks WHERE RefSpectraID >= %d",
+            firstSpectrumId);
+    sql_stmt(zSql);
+    sprintf(zSql, "DELETE FROM Modifications WHERE RefSpectraID >= %d",
+            firstSpectrumId);
+    sql_stmt(zSql);
+    sprintf(zSql, "DELETE FROM RefSpectra WHERE id >= %d", firstSpectrumId);
+    sql_stmt(zSql);
+}
+
+/**
+ * Remove spectra from inputs that a previous run began but did not
+ * finish.  Inputs are added in order, so everything from the first
+ * uncommitted input onward is removed.
+ */
+void BlibBuilder::removeUncommittedInputs()
+{
+    strcpy(zSql, "SELECT min(firstSpectrumID) FROM BuildManifest "
+           "WHERE committed = 0");
+    smart_stmt pStmt;
+    int rc = sqlite3_prepare(getDb(), zSql, -1, &pStmt, 0);
+    check_step(rc, pStmt, zSql, "Failed reading build manifest.");
+    if( sqlite3_column_type(pStmt, 0) == SQLITE_NULL ){
+        return; // all inputs finished
+    }
+    int firstSpectrumId = sqlite3_column_int(pStmt, 0);
+
+    Verbosity::status("Removing spectra from unfinished inputs of a "
+                      "previous build.");
+    beginTransaction();
+    removeSpectraFrom(firstSpectrumId);
+    sql_stmt("DELETE FROM BuildManifest WHERE committed = 0");
     endTransaction();
-    int numberProcessed =  progress->processed();
-    delete progress;
-    return numberProcessed;
 }
 
 void BlibBuilder::commit()
@@ -248,8 +551,9 @@ void BlibBuilder::commit()
   
     for (int i = 0; i < (int)input_files.size(); i++) {
         if(has_extension(input_files.at(i), ".blib")) {
+            // libraries skipped when resuming were never attached
             sprintf(zSql, "DETACH DATABASE tmp%d", i);
-            sql_stmt(zSql);
+            sql_stmt(zSql, true);
         }
     }
 }
@@ -263,6 +567,10 @@ int BlibBuilder::parseNextSwitch(int i, int argc, char* argv[])
         setOverwrite(true);
     else if(switchName == 's')
         setStdinput(true);
+    else if(switchName == 'R')
+        resume = true;
+    else if(switchName == 'x')
+        write_mapped_index = true;
     else if (switchName == 'c' && ++i < argc) {
         double probability_cutoff = atof(argv[i]);
         scoreThresholds[PEPXML] = probability_cutoff;
@@ -286,6 +594,12 @@ int BlibBuilder::parseNextSwitch(int i, int argc, char* argv[])
         scoreThresholds[MSE] = atof(argv[i]);
     } else if (switchName == 'l' && ++i < argc) {
         level_compress = atoi(argv[i]);
+    } else if (switchName == 'C' && ++i < argc) {
+        if( !stringToPeakCodec(argv[i], peak_codec) ){
+            Verbosity::error("Unknown peak codec '%s'.", argv[i]);
+        }
+    } else if (switchName == 'K' && ++i < argc) {
+        max_append_ratio = atof(argv[i]);
     } else if (switchName == 'v' && ++i < argc) {
         V_LEVEL v_level = Verbosity::string_to_level(argv[i]);
         Verbosity::set_verbosity(v_level);
@@ -313,13 +627,14 @@ bool has_extension(const char* name, const char* ext)
 }
 
 /**
- * Call super classe's insertPeaks with our level of compression
+ * Call super classe's insertPeaks with our level of compression and codec
  */
 void BlibBuilder::insertPeaks(int spectraID, 
                               int peaksCount, 
                               double* pM, 
                               float* pI) {
-    BlibMaker::insertPeaks(spectraID, level_compress, peaksCount, pM, pI);
+    BlibMaker::insertPeaks(spectraID, level_compress, peaksCount, pM, pI,
+                           peak_codec);
 
 }
 
@@ -89,8 +89,14 @@ class BlibBuilder : public BlibMaker
   vector<char*> getInputFiles();
   virtual int parseCommandArgs(int argc, char* argv[]);
   virtual void attachAll();
+  virtual void init();
   int transferLibrary(int iLib, const ProgressIndicator* parentProgress);
   virtual void commit();
+  bool inputCommitted(int iFile);
+  bool writeMappedIndex() const { return write_mapped_index; }
+  void beginInput(int iFile);
+  void endInput();
+  void abortInput();
   void insertPeaks(int spectraID, 
                    int peaksCount, 
                    double* pM, 
@@ -98,13 +104,30 @@ class BlibBuilder : public BlibMaker
 
  protected:
   int parseNextSwitch(int i, int argc, char* argv[]);
+  virtual bool keepIndexesOnAppend();
+  double estimateNewSpectra();
+  int countInputSpectra(const char* fileName);
+  void statInputFile(int iFile);
+  const string& getInputFileHash(int iFile);
+  void removeSpectraFrom(int firstSpectrumId);
+  void removeUncommittedInputs();
 
  private:
   // Command-line options
   //double probability_cutoff; 
   double scoreThresholds[NUM_BUILD_INPUTS]; // replaces probability_cutoff
   int level_compress;
+  PEAK_CODEC peak_codec;   // how insertPeaks() encodes m/z and intensity
+  double max_append_ratio; // keep indexes if new/existing spec is below
+  bool resume;             // skip inputs already committed to the library
+  bool write_mapped_index; // write a MappedLibrary sidecar when done
   vector<char*> input_files;
+  int cur_manifest_id;     // BuildManifest row of the input being added
+  int cur_first_spec_id;   // first RefSpectra id added for that input
+  int info_file;           // input whose size, time and hash are below
+  sqlite3_int64 info_size;
+  sqlite3_int64 info_mod_time;
+  string info_hash;        // empty until the contents have been read
 };
 
 } // namespace
@@ -52,17 +52,43 @@
 #include "DotProduct.h"
 #include "Match.h"
 #include "BlibMaker.h"
+#include "MappedLibrary.h"
 #include "ProgressIndicator.h"
 #include "BlibUtils.h"
 #include "Verbosity.h"
 #include "CommandLine.h"
 #include "boost/program_options.hpp"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <deque>
 
 using namespace std;
 namespace ops = boost::program_options;
 
 namespace BiblioSpec {
 
+// Ions with fewer spectra compare all pairs, larger ones first bound
+// the scores to find which spectra could be the best
+const static int MIN_SPECTRA_FOR_BOUNDS = 20;
+// Limit on ions waiting to be scored or inserted, per thread
+const static int MAX_QUEUED_IONS_PER_THREAD = 16;
+
+/**
+ * The spectra for one peptide ion and which of them was chosen to
+ * represent it.
+ */
+struct IonGroup {
+    vector<RefSpectrum*> spectra;
+    int bestIdx;             // spectrum to keep, -1 to leave the ion out
+    double bestAverageScore;
+    int numCompared;         // number compared to all others
+    bool scored;             // true once bestIdx is final
+
+    IonGroup() : bestIdx(-1), bestAverageScore(0), numCompared(0), 
+                 scored(false) {}
+    ~IonGroup(){ clearVector(spectra); }
+};
+
 class BlibFilter : public BlibMaker
 {
  public:
@@ -78,10 +104,14 @@ class BlibFilter : public BlibMaker
  protected:
     virtual string getLSID();
     virtual void getNextRevision(int* major, int* minor);
-    vector<PEAK_T> getUncompressedPeaks(int& numPeaks,
-                                        int& mzLen, Byte* comprM, 
-                                        int& intensityLen, Byte* comprI);
-    void compAndInsert(vector<RefSpectrum*>& oneIon);
+    void setPeaks(RefSpectrum* spec, sqlite3_stmt* pStmt, int numPeaksCol);
+    void fetchPeaks(vector<RefSpectrum*>& oneIon, sqlite3_stmt* peaksStmt);
+    void selectBestSpectrum(IonGroup& ion);
+    void insertIon(IonGroup& ion);
+    void sumAllScores(vector<RefSpectrum*>& oneIon, vector<double>& scores);
+    int sumCandidateScores(vector<RefSpectrum*>& oneIon, 
+                           vector<double>& scores);
+    double sumScores(vector<RefSpectrum*>& oneIon, int specIdx);
 
  private:
     string redundantFileName_;  // The name of the file being filtered
@@ -92,8 +122,27 @@ class BlibFilter : public BlibMaker
 
     bool redundantLibHasAdditionalColumns_;
     char zSql[2048];
+    PeakDecoder peakDecoder_;            // buffers reused for every spectrum
+    smart_stmt insertIonStmt_;           // one row of PeptideIons
+    smart_stmt insertRetentionTimeStmt_; // one row of RetentionTimes
+
+    // for scoring ions in worker threads while this one reads and inserts
+    int numThreads_;
+    boost::thread_group workers_;
+    boost::mutex queueMutex_;
+    boost::condition_variable ionQueued_; // ion added to toScore_ or stop
+    boost::condition_variable ionScored_; // an ion in queuedIons_ is scored
+    deque<IonGroup*> toScore_;    // waiting for a worker
+    deque<IonGroup*> queuedIons_; // all ions not yet inserted, input order
+    bool stopWorkers_;
 
     void getCommandLineValues(ops::variables_map& options_table);
+    void prepareIonInserts();
+    void startWorkers();
+    void stopWorkers();
+    void scoreQueuedIons();
+    void queueIon(IonGroup* ion);
+    void insertScoredIons(bool insertAll);
 };
 } // namespace
 
@@ -120,6 +169,10 @@ int main(int argc, char* argv[])
     Verbosity::debug("Finished filtering.");
     filter.endTransaction();
     filter.commit();
+
+    if( options_table.count("mapped-index") ){
+        MappedLibrary::write(filter.getLibName());
+    }
 }
 
 BlibFilter::BlibFilter()
@@ -128,6 +181,8 @@ BlibFilter::BlibFilter()
     minPeaks_ = 20; 
     minAverageScore_ = 0;
     redundantLibHasAdditionalColumns_ = true;
+    numThreads_ = 1;
+    stopWorkers_ = false;
     // Never append to a non-redundant library
     setOverwrite(true);
     setRedundant(false);
@@ -166,6 +221,13 @@ void BlibFilter::parseCommandLine(const int argc,
              value<double>()->default_value(0),
              "Best spectrum must have at least this average score to be included.  Default 0.")
 
+            ("threads,t",
+             value<int>()->default_value(0),
+             "Number of threads for comparing spectra.  Default 0, one per processor.")
+
+            ("mapped-index,x",
+             "Also write a memory-mapped index of the filtered library (<filtered-library>.idx) for BlibSearch to read spectra from.")
+
             ;
 
         // define the required command line args
@@ -201,6 +263,13 @@ void BlibFilter::getCommandLineValues(ops::variables_map& options_table){
     redundantFileName_ = options_table["redundant-library"].as<string>();
     minPeaks_ = options_table["min-peaks"].as<int>();
     minAverageScore_ = options_table["min-score"].as<double>();
+    numThreads_ = options_table["threads"].as<int>();
+    if( numThreads_ < 1 ){
+        numThreads_ = (int)boost::thread::hardware_concurrency();
+    }
+    if( numThreads_ < 1 ){
+        numThreads_ = 1;
+    }
     setLibName(options_table["filtered-library"].as<string>());
 }
 
@@ -316,17 +385,41 @@ void BlibFilter::buildNonRedundantLib()
     Verbosity::debug("Counting Spectra.");
     ProgressIndicator progress(getSpectrumCount(redundantDbName_));
 
+    // Sort only the light columns and fetch peaks for each ion as it
+    // is completed.  This needs an index on RefSpectraPeaks for the
+    // lookups; without one, sort the peaks along with the spectra.
+    bool fetchPeaksLater = indexExists(redundantDbName_, "RefSpectraPeaks",
+                                       "RefSpectraID");
+    if( ! indexExists(redundantDbName_, "RefSpectra", 
+                      "peptideModSeq,precursorCharge") ){
+        Verbosity::debug("Redundant library has no index on sequence and "
+                         "charge.");
+    }
     Verbosity::debug("Sorting spectra by sequence and charge.");
-    //first Order by peptideModSeq and charge, filter by num peaks
-    sprintf(zSql,
-            "SELECT id,peptideSeq,precursorMZ,precursorCharge,peptideModSeq,"
-            "prevAA, nextAA, numPeaks, peakMZ, peakIntensity %s "
-            "FROM %s.RefSpectra, %s.RefSpectraPeaks "
-            "WHERE %s.RefSpectra.id=%s.RefSpectraPeaks.RefSpectraID "
-            " and %s.RefSpectra.numPeaks >= %i "
-            "ORDER BY peptideModSeq, precursorCharge", optional_cols,
-            redundantDbName_, redundantDbName_, redundantDbName_,
-            redundantDbName_, redundantDbName_, minPeaks_);
+    //first Order by peptideModSeq and charge, filter by num peaks.  Order
+    //by id within an ion so that the same best spectrum is always chosen
+    if( fetchPeaksLater ){
+        sprintf(zSql,
+                "SELECT id,peptideSeq,precursorMZ,precursorCharge,"
+                "peptideModSeq, prevAA, nextAA, numPeaks, NULL, NULL %s "
+                "FROM %s.RefSpectra "
+                "WHERE numPeaks >= %i "
+                "ORDER BY peptideModSeq, precursorCharge, id", optional_cols,
+                redundantDbName_, minPeaks_);
+    } else {
+        Verbosity::warn("Redundant library has no index on spectrum peaks. "
+                        "Sorting peaks with spectra.");
+        sprintf(zSql,
+                "SELECT id,peptideSeq,precursorMZ,precursorCharge,"
+                "peptideModSeq, prevAA, nextAA, numPeaks, peakMZ, "
+                "peakIntensity %s "
+                "FROM %s.RefSpectra, %s.RefSpectraPeaks "
+                "WHERE %s.RefSpectra.id=%s.RefSpectraPeaks.RefSpectraID "
+                " and %s.RefSpectra.numPeaks >= %i "
+                "ORDER BY peptideModSeq, precursorCharge, id", optional_cols,
+                redundantDbName_, redundantDbName_, redundantDbName_,
+                redundantDbName_, redundantDbName_, minPeaks_);
+    }
 
     smart_stmt pStmt;
     int rc = sqlite3_prepare(getDb(), zSql, -1, &pStmt, 0);
@@ -335,7 +428,21 @@ void BlibFilter::buildNonRedundantLib()
              "Failed selecting redundant spectra for comparison.");
     Verbosity::debug("Successfully sorted.");
 
+    smart_stmt peaksStmt;
+    if( fetchPeaksLater ){
+        sprintf(zSql,
+                "SELECT numPeaks, peakMZ, peakIntensity "
+                "FROM %s.RefSpectra, %s.RefSpectraPeaks "
+                "WHERE id = ?1 AND RefSpectraID = ?1",
+                redundantDbName_, redundantDbName_);
+        rc = sqlite3_prepare(getDb(), zSql, -1, &peaksStmt, 0);
+        check_rc(rc, zSql, "Failed preparing to select redundant peaks.");
+    }
+
+    prepareIonInserts();
+
     rc = sqlite3_step(pStmt);
+    startWorkers();
 
     // for each spectrum entry in table
     while( rc==SQLITE_ROW ) {
@@ -362,24 +469,9 @@ void BlibFilter::buildNonRedundantLib()
         tmpRef->setPrevAA("-");
         tmpRef->setNextAA("-");
         
-        int numPeaks = sqlite3_column_int(pStmt,7);
-
-        int numBytes1=sqlite3_column_bytes(pStmt,8);
-        Byte* comprM = (Byte*)sqlite3_column_blob(pStmt,8);
-        int numBytes2=sqlite3_column_bytes(pStmt,9);
-        Byte* comprI = (Byte*)sqlite3_column_blob(pStmt,9);
-        
-        
-        // is this slow for copying the peak vector? better to return a ptr?
-        vector<PEAK_T> peaks = getUncompressedPeaks(numPeaks, numBytes1,
-                                                    comprM, numBytes2, comprI);
-        if (peaks.size() == 0) {
-            Verbosity::error("Unable to read peaks for redundant library "
-                             "spectrum %i, sequence %s, charge %i.",
-                             tmpRef->getLibSpecID(), (tmpRef->getSeq()).c_str(),
-                             tmpRef->getCharge());
+        if( !fetchPeaksLater ){
+            setPeaks(tmpRef, pStmt, 7);
         }
-        tmpRef->setRawPeaks(peaks);
         // TODO end nextRefSpec
 
         // if this spec has same seq and charge, add to the collection
@@ -387,12 +479,16 @@ void BlibFilter::buildNonRedundantLib()
             oneIon.push_back(tmpRef);
         } else {// filter & start new collection for a different seq and charge
             
+            if( fetchPeaksLater ){
+                fetchPeaks(oneIon, peaksStmt);
+            }
             if(!oneIon.empty()) {
                 Verbosity::comment(V_DETAIL, "Selecting spec for %s, charge %i"
                                    " from %i spectra.", lastPepModSeq,
                                    lastCharge, oneIon.size());
-                compAndInsert(oneIon);
-                clearVector(oneIon);
+                IonGroup* ion = new IonGroup();
+                ion->spectra.swap(oneIon);
+                queueIon(ion);
             }
             
             oneIon.push_back(tmpRef);
@@ -406,93 +502,101 @@ void BlibFilter::buildNonRedundantLib()
     }// next table entry
     
     // Insert the last spectrum
+    if( fetchPeaksLater ){
+        fetchPeaks(oneIon, peaksStmt);
+    }
     if (!oneIon.empty()) {
         progress.increment();
         Verbosity::comment(V_DETAIL, "Selecting spec for %s, charge %i"
                            " from %i spectra.", lastPepModSeq,
                            lastCharge, oneIon.size());
-        compAndInsert(oneIon);
-        clearVector(oneIon);
+        IonGroup* ion = new IonGroup();
+        ion->spectra.swap(oneIon);
+        queueIon(ion);
     }
+    insertScoredIons(true);
+    stopWorkers();
     // we may have selected fewer spectra than were in the library
     // update the progress indicator
     progress.finish();
 }
 
-vector<PEAK_T> BlibFilter::getUncompressedPeaks(int& numPeaks,
-                                                int& mzLen, Byte* comprM, 
-                                                int& intensityLen, Byte* comprI)
+/**
+ * Decode the peaks in the current row of the statement and add
+ * them to the spectrum.  The number of peaks is in the given column
+ * followed by the m/z and intensity blobs.
+ */
+void BlibFilter::setPeaks(RefSpectrum* spec, sqlite3_stmt* pStmt,
+                          int numPeaksCol)
 {
-    //variables for compressed files
-    uLong uncomprLen;
-    double *mz;
-    float *intensity;
-
-    uncomprLen=numPeaks*sizeof(double);
-    if ((int)uncomprLen == mzLen)
-        mz = (double*) comprM;
-    else {
-        mz = new double[numPeaks];
-        uncompress((Bytef*)mz, &uncomprLen, comprM, mzLen);
+    int numPeaks = sqlite3_column_int(pStmt, numPeaksCol);
+    const void* comprM = sqlite3_column_blob(pStmt, numPeaksCol + 1);
+    int numBytes1 = sqlite3_column_bytes(pStmt, numPeaksCol + 1);
+    const void* comprI = sqlite3_column_blob(pStmt, numPeaksCol + 2);
+    int numBytes2 = sqlite3_column_bytes(pStmt, numPeaksCol + 2);
+
+    // a spectrum with no peaks is as unusable as one with corrupted peaks
+    if( numPeaks <= 0 || 
+        !peakDecoder_.decode(numPeaks, comprM, numBytes1, comprI, numBytes2,
+                             true) ){
+        Verbosity::error("Unable to read peaks for redundant library "
+                         "spectrum %i, sequence %s, charge %i.",
+                         spec->getLibSpecID(), (spec->getSeq()).c_str(),
+                         spec->getCharge());
     }
+    vector<PEAK_T> peaks;
+    peakDecoder_.getPeaks(peaks);
+    spec->swapRawPeaks(peaks);
+}
 
-    uncomprLen=numPeaks*sizeof(float);
-    if ((int)uncomprLen == intensityLen)
-        intensity = (float*) comprI;
-    else {
-        intensity = new float[numPeaks];
-        uncompress((Bytef*)intensity, &uncomprLen, comprI, intensityLen);
-    }
-    
-    vector<PEAK_T> peaks(numPeaks);
-    PEAK_T p;
-    for(int i=0;i<numPeaks;i++) {
-        p.mz = mz[i];
-        p.intensity = intensity[i];
-        // Check for corruption
-        if (p.mz != p.mz || p.mz < 0 || p.mz > 100000 ||
-            p.intensity != p.intensity || p.intensity < 0) {
-            // Corrupted peaks
-            peaks.clear();
-            return peaks;
+/**
+ * Look up the peaks for each spectrum of one ion by its id.  Spectra
+ * with no peaks in the redundant library are removed from the ion,
+ * as they would be by a join.
+ */
+void BlibFilter::fetchPeaks(vector<RefSpectrum*>& oneIon, 
+                            sqlite3_stmt* peaksStmt)
+{
+    size_t kept = 0;
+    for(size_t i = 0; i < oneIon.size(); i++){
+        sqlite3_bind_int(peaksStmt, 1, oneIon[i]->getLibSpecID());
+        int rc = sqlite3_step(peaksStmt);
+        if( rc == SQLITE_ROW ){
+            setPeaks(oneIon[i], peaksStmt, 0);
+            oneIon[kept++] = oneIon[i];
+        } else {
+            if( rc != SQLITE_DONE ){
+                check_rc(rc, "SELECT peakMZ, peakIntensity",
+                         "Failed selecting redundant peaks.");
+            }
+            delete oneIon[i];
         }
-        peaks[i] = p;
+        sqlite3_reset(peaksStmt);
     }
-
-    if (mz != (double*)comprM)
-        delete [] mz;
-    if (intensity != (float*)comprI)
-        delete [] intensity;
-
-    return peaks;
+    oneIon.resize(kept);
 }
 
 /**
- * Given a vector containing RefSpectrum for the same sequence and
- * charge, find the best representative and insert into the current table.
- * The "best representative" is currently defined as the spectrum that
- * has the highest average dot product when compared to all other
- * spectra.  
+ * Given a collection of RefSpectrum for the same sequence and charge,
+ * find the best representative.  The "best representative" is
+ * currently defined as the spectrum that has the highest average dot
+ * product when compared to all other spectra.  Only computes; the
+ * results are stored in the ion so that this can run in any thread.
  *
- * When the collection contains exactly one spectrum, add it.  When the
+ * When the collection contains exactly one spectrum, choose it.  When the
  * spectrum contains exactly two spectra, the average dot product will
  * be the same for both so use a different criterion to choose.
  * Eventually, when a quailty-of-match score (e.g. p-value) is stored,
  * use the spec with the higher score.  For now, use the one with more
  * peaks. 
  */
-void BlibFilter::compAndInsert(vector<RefSpectrum*>& oneIon)
+void BlibFilter::selectBestSpectrum(IonGroup& ion)
 {
+    vector<RefSpectrum*>& oneIon = ion.spectra;
     int num_spec = oneIon.size();
-    RefSpectrum* bestSpec = NULL;
-    int specID = 0; // id RefSpec table in filtered index
 
     if(num_spec == 1){ // add that one spectrum
-        specID = transferSpectrum(redundantDbName_, 
-                                  oneIon.at(0)->getLibSpecID(), 
-                                  num_spec,
-                                  redundantLibHasAdditionalColumns_);
-        bestSpec = oneIon.front();
+        ion.bestIdx = 0;
     } else if(num_spec == 2) { // choose the one with more peaks
         // in the future, pick the one with the best search score
         int best_idx = 0;
@@ -500,11 +604,7 @@ void BlibFilter::compAndInsert(vector<RefSpectrum*>& oneIon)
             best_idx = 1;
         }
 
-        specID = transferSpectrum(redundantDbName_, 
-                                  oneIon.at(0)->getLibSpecID(), 
-                                  num_spec,
-                                  redundantLibHasAdditionalColumns_);
-        bestSpec = oneIon.at(0);
+        ion.bestIdx = 0;
     } else { // compute all-by-all dot-products
         
         // preprocess all RefSpectrum in oneIon
@@ -521,69 +621,303 @@ void BlibFilter::compAndInsert(vector<RefSpectrum*>& oneIon)
         }
         
         // create an array where we'll sum scores for each spectrum
-        // initialize to 0
-        vector<double> scores(oneIon.size(), 0);
-
-        // for each spectrum
-        for(int i=0; i<(int)oneIon.size(); i++) {
-            RefSpectrum* tmpRef1 = oneIon.at(i);
-
-            // compare to all subsequent spectrum
-            for(int j=i+1; j<(int)oneIon.size(); j++) {
-
-                RefSpectrum* tmpRef2 = oneIon.at(j);
-                Match thisMatch(tmpRef1, tmpRef2);
-                DotProduct::compare(thisMatch);
-                double dotProduct = thisMatch.getScore(DOTP);
-
-                // add the score to the running total for both spec
-                scores[i] += dotProduct;
-                scores[j] += dotProduct;
-            }
-        } // next spectrum
+        vector<double> scores;
+        if( num_spec < MIN_SPECTRA_FOR_BOUNDS ){
+            sumAllScores(oneIon, scores);
+            ion.numCompared = num_spec;
+        } else {
+            ion.numCompared = sumCandidateScores(oneIon, scores);
+        }
 
         // find the best score and keep the spectrum associated with it
         size_t maxScoreIndex = getMaxElementIndex(scores);
         double bestScore = scores[maxScoreIndex];
-        double bestAverageScore = bestScore / (double)oneIon.size() ;
+        ion.bestAverageScore = bestScore / (double)oneIon.size() ;
 
         // If best average score is too low, don't include it 
-        if ( bestAverageScore >= minAverageScore_ ){
-            specID = transferSpectrum(redundantDbName_, 
-                                      oneIon.at(maxScoreIndex)->getLibSpecID(), 
-                                      oneIon.size(),
-                                      redundantLibHasAdditionalColumns_);
-            bestSpec = oneIon.at(maxScoreIndex);
+        if ( ion.bestAverageScore >= minAverageScore_ ){
+            ion.bestIdx = maxScoreIndex;
         } else {
-            Verbosity::warn("Best score is %f for %s, charge %d after "
-                            "comparing %i spectra.  This sequence will not be "
-                            "included in the filtered library.", 
-                            bestAverageScore, (oneIon.at(0)->getSeq()).c_str(),
-                            oneIon.at(0)->getCharge(), oneIon.size());
-            return;
+            ion.bestIdx = -1;
         }
     }
+}
+
+/**
+ * Insert the spectrum chosen for an ion into the current table along
+ * with its PeptideIons and RetentionTimes entries.
+ */
+void BlibFilter::insertIon(IonGroup& ion)
+{
+    vector<RefSpectrum*>& oneIon = ion.spectra;
+    int num_spec = oneIon.size();
+
+    if( num_spec > 2 ){
+        Verbosity::comment(V_DETAIL, "Compared %d of %d spectra to all others.",
+                           ion.numCompared, num_spec);
+    }
+    if( ion.bestIdx < 0 ){
+        Verbosity::warn("Best score is %f for %s, charge %d after "
+                        "comparing %i spectra.  This sequence will not be "
+                        "included in the filtered library.", 
+                        ion.bestAverageScore, (oneIon.at(0)->getSeq()).c_str(),
+                        oneIon.at(0)->getCharge(), oneIon.size());
+        return;
+    }
+
+    RefSpectrum* bestSpec = oneIon.at(ion.bestIdx);
+    int specID = transferSpectrum(redundantDbName_, 
+                                  bestSpec->getLibSpecID(), 
+                                  num_spec,
+                                  redundantLibHasAdditionalColumns_);
 
     // add the sequence, charge, representative spec into PeptideIons
-    sprintf(zSql,
-            "INSERT INTO PeptideIons (spectrumID, bareSequence, "
-            "modifiedSequence, charge) "
-            "VALUES (%d, '%s', '%s', %d)",
-            specID, bestSpec->getSeq().c_str(), bestSpec->getMods().c_str(),
-            bestSpec->getCharge());
-    sql_stmt(zSql);
+    string seq = bestSpec->getSeq();
+    string mods = bestSpec->getMods();
+    sqlite3_bind_int(insertIonStmt_, 1, specID);
+    sqlite3_bind_text(insertIonStmt_, 2, seq.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(insertIonStmt_, 3, mods.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(insertIonStmt_, 4, bestSpec->getCharge());
+    if( sqlite3_step(insertIonStmt_) != SQLITE_DONE ){
+        check_rc(sqlite3_reset(insertIonStmt_), "INSERT INTO PeptideIons",
+                 "Failed inserting peptide ion.");
+    }
+    sqlite3_reset(insertIonStmt_);
 
     // add rt, peptideIonId for all refspec
     int peptideIonID = (int)sqlite3_last_insert_rowid(getDb());
+    sqlite3_bind_int(insertRetentionTimeStmt_, 1, peptideIonID);
     for(int i = 0; i < num_spec; i++){
         // if( oneIon.at(i)->getRetentionTime() == 0){ continue; }
-        sprintf(zSql,
-                "INSERT INTO RetentionTimes (peptideID, retentionTime) "
-                "VALUES (%d, %f)", peptideIonID, 
-                oneIon.at(i)->getRetentionTime());
-        sql_stmt(zSql);
+        sqlite3_bind_double(insertRetentionTimeStmt_, 2,
+                            oneIon.at(i)->getRetentionTime());
+        if( sqlite3_step(insertRetentionTimeStmt_) != SQLITE_DONE ){
+            check_rc(sqlite3_reset(insertRetentionTimeStmt_),
+                     "INSERT INTO RetentionTimes",
+                     "Failed inserting retention time.");
+        }
+        sqlite3_reset(insertRetentionTimeStmt_);
+    }
+}
+
+/**
+ * Prepare the statements used by insertIon() once for all ions.
+ * Values are bound for each row so sequences are never quoted into
+ * the SQL.
+ */
+void BlibFilter::prepareIonInserts()
+{
+    sprintf(zSql,
+            "INSERT INTO PeptideIons (spectrumID, bareSequence, "
+            "modifiedSequence, charge) VALUES (?, ?, ?, ?)");
+    int rc = sqlite3_prepare(getDb(), zSql, -1, &insertIonStmt_, 0);
+    check_rc(rc, zSql, "Failed preparing peptide ion insert.");
+
+    sprintf(zSql,
+            "INSERT INTO RetentionTimes (peptideID, retentionTime) "
+            "VALUES (?, ?)");
+    rc = sqlite3_prepare(getDb(), zSql, -1, &insertRetentionTimeStmt_, 0);
+    check_rc(rc, zSql, "Failed preparing retention time insert.");
+}
+
+/**
+ * Start the threads that score ions.  With one thread, ions are
+ * scored as they are queued instead.
+ */
+void BlibFilter::startWorkers()
+{
+    if( numThreads_ < 2 ){
+        return;
+    }
+    Verbosity::debug("Comparing spectra with %d threads.", numThreads_);
+    stopWorkers_ = false;
+    for(int i = 0; i < numThreads_; i++){
+        workers_.create_thread(boost::bind(&BlibFilter::scoreQueuedIons, 
+                                           this));
+    }
+}
+
+void BlibFilter::stopWorkers()
+{
+    {
+        boost::mutex::scoped_lock lock(queueMutex_);
+        stopWorkers_ = true;
+    }
+    ionQueued_.notify_all();
+    workers_.join_all();
+}
+
+/**
+ * Worker thread loop.  Take ions off the queue and select the best
+ * spectrum for each until told to stop.  No SQLite or Verbosity calls
+ * are made here; the main thread does all of those.
+ */
+void BlibFilter::scoreQueuedIons()
+{
+    while( true ){
+        IonGroup* ion = NULL;
+        {
+            boost::mutex::scoped_lock lock(queueMutex_);
+            while( toScore_.empty() && !stopWorkers_ ){
+                ionQueued_.wait(lock);
+            }
+            if( toScore_.empty() ){ // and stopping
+                return;
+            }
+            ion = toScore_.front();
+            toScore_.pop_front();
+        }
+
+        selectBestSpectrum(*ion);
+
+        {
+            boost::mutex::scoped_lock lock(queueMutex_);
+            ion->scored = true;
+        }
+        ionScored_.notify_all();
+    }
+}
+
+/**
+ * Hand an ion to the workers and insert any that are finished, in the
+ * order they were queued so that the library is the same for any
+ * number of threads.  Takes ownership of the ion.
+ */
+void BlibFilter::queueIon(IonGroup* ion)
+{
+    if( numThreads_ < 2 ){
+        selectBestSpectrum(*ion);
+        insertIon(*ion);
+        delete ion;
+        return;
+    }
+
+    {
+        boost::mutex::scoped_lock lock(queueMutex_);
+        toScore_.push_back(ion);
+        queuedIons_.push_back(ion);
+    }
+    ionQueued_.notify_one();
+
+    insertScoredIons(false);
+}
+
+/**
+ * Insert scored ions from the front of the queue.  Stop at the first
+ * unscored ion unless insertAll is true or the queue is full, in which
+ * case wait for it.
+ */
+void BlibFilter::insertScoredIons(bool insertAll)
+{
+    size_t maxQueued = MAX_QUEUED_IONS_PER_THREAD * numThreads_;
+    while( true ){
+        IonGroup* ion = NULL;
+        {
+            boost::mutex::scoped_lock lock(queueMutex_);
+            if( queuedIons_.empty() ){
+                return;
+            }
+            while( !queuedIons_.front()->scored ){
+                if( !insertAll && queuedIons_.size() < maxQueued ){
+                    return;
+                }
+                ionScored_.wait(lock);
+            }
+            ion = queuedIons_.front();
+            queuedIons_.pop_front();
+        }
+
+        insertIon(*ion);
+        delete ion;
     }
 }
+
+/**
+ * Sum the dot product of each spectrum compared to all others by
+ * comparing every pair.  Assumes the peaks have been processed.
+ */
+void BlibFilter::sumAllScores(vector<RefSpectrum*>& oneIon, 
+                              vector<double>& scores)
+{
+    scores.assign(oneIon.size(), 0);
+
+    // for each spectrum
+    for(int i=0; i<(int)oneIon.size(); i++) {
+        RefSpectrum* tmpRef1 = oneIon.at(i);
+
+        // compare to all subsequent spectrum
+        for(int j=i+1; j<(int)oneIon.size(); j++) {
+
+            RefSpectrum* tmpRef2 = oneIon.at(j);
+            Match thisMatch(tmpRef1, tmpRef2);
+            DotProduct::compare(thisMatch);
+            double dotProduct = thisMatch.getScore(DOTP);
+
+            // add the score to the running total for both spec
+            scores[i] += dotProduct;
+            scores[j] += dotProduct;
+        }
+    } // next spectrum
+}
+
+/**
+ * Sum the dot products as in sumAllScores, but only for the spectra
+ * that could have the highest sum.  Bounds on every sum are found in
+ * one pass over the peaks and only spectra whose upper bound reaches
+ * the largest lower bound are compared to all others.  The rest get a
+ * score of -1.  The candidates' sums are added up in the same order
+ * as in sumAllScores, so the best spectrum and its score are the same.
+ * \returns The number of candidates.
+ */
+int BlibFilter::sumCandidateScores(vector<RefSpectrum*>& oneIon, 
+                                   vector<double>& scores)
+{
+    int numSpec = oneIon.size();
+    vector<const vector<PEAK_T>*> peakLists(numSpec);
+    for(int i = 0; i < numSpec; i++){
+        peakLists[i] = &(oneIon.at(i)->getProcessedPeaks());
+    }
+
+    vector<double> lower;
+    vector<double> upper;
+    DotProduct::getScoreSumBounds(peakLists, lower, upper);
+
+    // allow for rounding in the single-precision intensities
+    double tolerance = 1e-4 * numSpec;
+    double bestLower = lower[getMaxElementIndex(lower)] - tolerance;
+
+    scores.assign(numSpec, -1);
+    int numCandidates = 0;
+    for(int i = 0; i < numSpec; i++){
+        if( upper[i] + tolerance >= bestLower ){
+            scores[i] = sumScores(oneIon, i);
+            numCandidates++;
+        }
+    }
+    return numCandidates;
+}
+
+/**
+ * Sum the dot products of one spectrum compared to each other in the
+ * collection.  Each pair is compared with the lower index first, as in
+ * sumAllScores.
+ */
+double BlibFilter::sumScores(vector<RefSpectrum*>& oneIon, int specIdx)
+{
+    double score = 0;
+    for(int j = 0; j < (int)oneIon.size(); j++){
+        if( j == specIdx ){
+            continue;
+        }
+        int first = min(j, specIdx);
+        int second = max(j, specIdx);
+        Match thisMatch(oneIon.at(first), oneIon.at(second));
+        DotProduct::compare(thisMatch);
+        score += thisMatch.getScore(DOTP);
+    }
+    return score;
+}
+
 /*
  * Local Variables:
  * mode: c
@@ -173,10 +173,19 @@ void BlibMaker::init()
     if (overwrite){
         createTables();
     } else {
-        // Drop indexes for large numbers of insertions
-        sql_stmt("DROP INDEX idxPeptide", true);
-        sql_stmt("DROP INDEX idxPeptideMod", true);
-        sql_stmt("DROP INDEX idxRefIdPeaks", true);
+        if( keepIndexesOnAppend() ){
+            // Small append, cheaper to update indexes than rebuild them
+            Verbosity::status("Appending to %s with indexes kept in place.",
+                              lib_name);
+        } else {
+            // Drop indexes for large numbers of insertions
+            Verbosity::status("Appending to %s, indexes will be rebuilt.",
+                              lib_name);
+            sql_stmt("DROP INDEX idxPeptide", true);
+            sql_stmt("DROP INDEX idxPeptideMod", true);
+            sql_stmt("DROP INDEX idxRefIdPeaks", true);
+            sql_stmt("DROP INDEX idxChargeMz", true);
+        }
 
         // Add any missing tables or columns
         updateTables();
@@ -263,10 +272,15 @@ void BlibMaker::commit()
 
     sql_stmt("BEGIN");
 
-    // Add indexes
-    sql_stmt("CREATE INDEX idxPeptide ON RefSpectra (peptideSeq, precursorCharge)");
-    sql_stmt("CREATE INDEX idxPeptideMod ON RefSpectra (peptideModSeq, precursorCharge)");
-    sql_stmt("CREATE INDEX idxRefIdPeaks ON RefSpectraPeaks (RefSpectraID)");
+    // Add indexes, unless they were kept while appending
+    sql_stmt("CREATE INDEX IF NOT EXISTS idxPeptide "
+             "ON RefSpectra (peptideSeq, precursorCharge)");
+    sql_stmt("CREATE INDEX IF NOT EXISTS idxPeptideMod "
+             "ON RefSpectra (peptideModSeq, precursorCharge)");
+    sql_stmt("CREATE INDEX IF NOT EXISTS idxRefIdPeaks "
+             "ON RefSpectraPeaks (RefSpectraID)");
+    sql_stmt("CREATE INDEX IF NOT EXISTS idxChargeMz "
+             "ON RefSpectra (precursorCharge, precursorMZ)");
 
     // And commit all changes
     sql_stmt("COMMIT");
@@ -366,6 +380,20 @@ void BlibMaker::createTable(const char* tableName){
                     i, scoreTypeNames[i]);
             sql_stmt(zSql);
         }
+    } else if( strcmp(tableName, "BuildManifest") == 0 ){
+        // one row per input file, committed = 1 once all of its
+        // spectra have been added
+        strcpy(zSql,
+               "CREATE TABLE BuildManifest (id INTEGER PRIMARY KEY "
+               "autoincrement not null, "
+               "fileName VARCHAR(512), "
+               "fileSize INTEGER, "
+               "modTime INTEGER, "
+               "contentHash VARCHAR(16), "
+               "firstSpectrumID INTEGER, "
+               "numSpectra INTEGER, "
+               "committed TINYINT)" );
+        sql_stmt(zSql);
     } else {
         Verbosity::error("Cannot create '%s' table. Unknown name.",
                          tableName);
@@ -462,6 +490,67 @@ bool BlibMaker::tableExists(const char* schemaTmp, const char* tableName){
     return ( return_code == SQLITE_ROW );
 }
 
+/**
+ * Check if the incoming library has an index on the given table.
+ * \returns True if at least one index exists or false if none do.
+ */
+bool BlibMaker::indexExists(const char* schemaTmp, const char* tableName){
+    sprintf(zSql,
+            "SELECT name FROM %s.sqlite_master "
+            "WHERE type = 'index' AND tbl_name = \"%s\"",
+            schemaTmp, tableName);
+    smart_stmt pStmt;
+    int return_code = sqlite3_prepare(db, zSql, -1, &pStmt, 0);
+    check_rc(return_code, zSql, 
+             "Failed checking for the existance of an index");
+    return_code = sqlite3_step(pStmt);
+    // if a row exists, the index exists
+    return ( return_code == SQLITE_ROW );
+}
+
+/**
+ * Check if the incoming library has an index on the given table whose
+ * leading columns are columnNames, a comma-separated list without
+ * spaces (e.g. "peptideModSeq,precursorCharge").
+ * \returns True if there is such an index.
+ */
+bool BlibMaker::indexExists(const char* schemaTmp, const char* tableName,
+                            const char* columnNames){
+    vector<string> indexNames;
+    sprintf(zSql, "PRAGMA %s.index_list(\"%s\")", schemaTmp, tableName);
+    smart_stmt listStmt;
+    int return_code = sqlite3_prepare(db, zSql, -1, &listStmt, 0);
+    check_rc(return_code, zSql, 
+             "Failed checking for the existance of an index");
+    while( sqlite3_step(listStmt) == SQLITE_ROW ){
+        indexNames.push_back((const char*)sqlite3_column_text(listStmt, 1));
+    }
+
+    string wanted = columnNames;
+    for(size_t i = 0; i < indexNames.size(); i++){
+        sprintf(zSql, "PRAGMA %s.index_info(\"%s\")", schemaTmp, 
+                indexNames.at(i).c_str());
+        smart_stmt infoStmt;
+        return_code = sqlite3_prepare(db, zSql, -1, &infoStmt, 0);
+        check_rc(return_code, zSql, 
+                 "Failed checking the columns of an index");
+
+        // rows are in order of seqno
+        string columns;
+        while( sqlite3_step(infoStmt) == SQLITE_ROW ){
+            if( ! columns.empty() ){
+                columns += ",";
+            }
+            columns += (const char*)sqlite3_column_text(infoStmt, 2);
+        }
+        if( columns == wanted || 
+            columns.compare(0, wanted.size() + 1, wanted + ",") == 0 ){
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
  * Check if the given table in the incoming library contains the given
  * column name.
@@ -616,7 +705,90 @@ int BlibMaker::transferSpectrum(const char* schemaTmp,
     return spectraID;
 }
 
-void BlibMaker::transferModifications(const char* schemaTmp, 
+/**
+ * Copy every spectrum in the given attached library (along with its
+ * peaks, modifications and source files) into the default database.
+ * Rather than calling transferSpectrum() for each row, ids in the
+ * incoming library are shifted by a constant offset so that each
+ * table can be copied with a single INSERT ... SELECT.  Every
+ * transferred spectrum is given one copy.
+ * \returns The number of spectra transferred.
+ */
+int BlibMaker::transferAllSpectra(const char* schemaTmp,
+                                  bool tmpHasAdditionalColumns)
+{
+    // source files: shift ids past those already in the new library
+    string fileIdExpr;
+    if( tableExists(schemaTmp, "SpectrumSourceFiles") &&
+        tableColumnExists(schemaTmp, "RefSpectra", "fileID") ){
+        int fileOffset = getMaxId("main", "SpectrumSourceFiles");
+        sprintf(zSql,
+                "INSERT INTO SpectrumSourceFiles(id, fileName) "
+                "SELECT id + %d, fileName FROM %s.SpectrumSourceFiles",
+                fileOffset, schemaTmp);
+        sql_stmt(zSql);
+
+        sprintf(zSql, "fileID + %d", fileOffset);
+        fileIdExpr = zSql;
+    } else {
+        // add "unknown" source file if we haven't already
+        if( unknown_file_id == -1 ){
+            Verbosity::warn("Orignal library does not contain filenames for "
+                            "the  library spectra");
+            strcpy(zSql, "INSERT INTO SpectrumSourceFiles (fileName) "
+                   "VALUES ('UNKNOWN')");
+            sql_stmt(zSql);
+            unknown_file_id = (int)sqlite3_last_insert_rowid(db);
+        }
+        sprintf(zSql, "%d", unknown_file_id);
+        fileIdExpr = zSql;
+    }
+
+    // spectra: the first incoming spectrum follows the last existing one
+    int specOffset = getMaxId("main", "RefSpectra");
+    sprintf(zSql, "SELECT min(id) FROM %s.RefSpectra", schemaTmp);
+    smart_stmt pStmt;
+    int rc = sqlite3_prepare(db, zSql, -1, &pStmt, 0);
+    check_step(rc, pStmt, zSql, "Failed getting first spectrum id.");
+    if( sqlite3_column_type(pStmt, 0) == SQLITE_NULL ){
+        return 0; // nothing to transfer
+    }
+    specOffset -= sqlite3_column_int(pStmt, 0) - 1;
+
+    const char* alternate_cols ="retentionTime, specIDinFile, score, scoreType";
+    if( ! tmpHasAdditionalColumns ){
+        alternate_cols = "'0', '0', '0', '0'";
+    }
+
+    sprintf(zSql,
+            "INSERT INTO RefSpectra(id, peptideSeq, precursorMZ, "
+            "precursorCharge, peptideModSeq, prevAA, nextAA, copies, numPeaks, "
+            "fileID, retentionTime, specIDinFile, score, scoreType) "
+            "SELECT id + %d, peptideSeq, precursorMZ, precursorCharge, "
+            "peptideModSeq, prevAA, nextAA, 1, numPeaks, %s, %s "
+            "FROM %s.RefSpectra ORDER BY id",
+            specOffset, fileIdExpr.c_str(), alternate_cols, schemaTmp);
+    sql_stmt(zSql);
+    int numTransferred = sqlite3_changes(db);
+
+    sprintf(zSql,
+            "INSERT INTO RefSpectraPeaks(RefSpectraID, peakMZ, peakIntensity) "
+            "SELECT RefSpectraID + %d, peakMZ, peakIntensity "
+            "FROM %s.RefSpectraPeaks",
+            specOffset, schemaTmp);
+    sql_stmt(zSql);
+
+    sprintf(zSql,
+            "INSERT INTO Modifications(RefSpectraID, position, mass) "
+            "SELECT RefSpectraID + %d, position, mass "
+            "FROM %s.Modifications",
+            specOffset, schemaTmp);
+    sql_stmt(zSql);
+
+    return numTransferred;
+}
+
+void BlibMaker::transferModifications(const char* schemaTmp,
                                       int spectraID, 
                                       int spectraTmpID)
 {
@@ -680,45 +852,16 @@ void BlibMaker::transferPeaks(const char* schemaTmp,
         fail_sql(rc, zSql, NULL, "Failed importing peaks.");
 }
 
+/**
+ * Insert the peaks of one spectrum, encoded with the given codec.
+ * levelCompress is the zlib compression level, 0 for none.
+ */
 void BlibMaker::insertPeaks(int spectraID, int levelCompress, int peaksCount, 
-                            double* pM, float* pI)
+                            double* pM, float* pI, PEAK_CODEC codec)
 {
-    const uLong sizeM = (uLong) peaksCount*sizeof(double);
-    const uLong sizeI = (uLong) peaksCount*sizeof(float);
-
-    Byte *comprM, *comprI;
-    uLong comprLenM, comprLenI;
-
-    if (levelCompress == 0) {
-        // No compression
-        comprM = (Byte*)pM;
-        comprLenM = sizeM;
-        
-        comprI = (Byte*)pI;
-        comprLenI = sizeI;
-    } else {
-        // compress mz
-        comprLenM = compressBound(sizeM);
-        comprM = (Byte*)calloc((uInt)comprLenM, 1);
-        int err = compress(comprM, &comprLenM, (const Bytef*)pM, sizeM);
-        if (comprLenM >= sizeM) {
-            // no mz compression
-            free(comprM);
-            comprM = (Byte*)pM;
-            comprLenM = sizeM;
-        }
-        
-        // compress intensity
-        comprLenI = compressBound(sizeI);
-        comprI = (Byte*)calloc((uInt)comprLenI, 1);
-        err = compress(comprI, &comprLenI, (const Bytef*)pI, sizeI);
-        if (comprLenI >= sizeI) {
-            // no intensity compression
-            free(comprI);
-            comprI = (Byte*)pI;
-            comprLenI = sizeI;
-        }
-    }
+    vector<unsigned char> comprM, comprI;
+    encodePeakMzs(codec, levelCompress, peaksCount, pM, comprM);
+    encodePeakIntensities(codec, levelCompress, peaksCount, pI, comprI);
     
     sprintf(zSql, "INSERT INTO RefSpectraPeaks VALUES(%d, ?,?)", spectraID);
     
@@ -727,18 +870,17 @@ void BlibMaker::insertPeaks(int spectraID, int levelCompress, int peaksCount,
     
     check_rc(rc, zSql, "Failed importing peaks.");
     
-    sqlite3_bind_blob(pStmt, 1, comprM, (int)comprLenM, SQLITE_STATIC);
-    sqlite3_bind_blob(pStmt, 2, comprI, (int)comprLenI, SQLITE_STATIC);
+    // an empty vector has no first element to point to
+    static const unsigned char noPeaks = 0;
+    sqlite3_bind_blob(pStmt, 1, comprM.empty() ? &noPeaks : &comprM[0], 
+                      (int)comprM.size(), SQLITE_STATIC);
+    sqlite3_bind_blob(pStmt, 2, comprI.empty() ? &noPeaks : &comprI[0], 
+                      (int)comprI.size(), SQLITE_STATIC);
     
     rc = sqlite3_step(pStmt);
     
     if (rc != SQLITE_DONE)
         fail_sql(rc, zSql, NULL, "Failed importing peaks.");
-    
-    if (comprLenM != sizeM)
-        free(comprM);
-    if (comprLenI != sizeI)
-        free(comprI);
 }
 
 void BlibMaker::updateLibInfo()
@@ -806,6 +948,24 @@ int BlibMaker::countSpectra(const char* databaseName /* = NULL */)
     return sqlite3_column_int(pStmt,0);
 }
 
+/**
+ * Query the given database for the largest value in the given column
+ * of the given table.
+ * \returns The largest value or 0 if the table is empty.
+ */
+int BlibMaker::getMaxId(const char* schemaName,
+                        const char* tableName,
+                        const char* columnName /* = "id" */)
+{
+    sprintf(zSql, "SELECT ifnull(max(%s), 0) FROM %s.%s",
+            columnName, schemaName, tableName);
+    smart_stmt pStmt;
+    int rc = sqlite3_prepare(getDb(), zSql, -1, &pStmt, 0);
+    check_step(rc, pStmt, zSql, "Failed getting largest id.");
+
+    return sqlite3_column_int(pStmt, 0);
+}
+
 void BlibMaker::getNextRevision(int* major, int* minor)
 {
     getRevisionInfo(NULL, major, minor);
@@ -39,6 +39,7 @@
 #include <map>
 #include "smart_stmt.h"
 #include "Verbosity.h"
+#include "PeakCodec.h"
 
 using namespace std;
 
@@ -99,7 +100,8 @@ public:
                   const char* msg = NULL) const;
 
     void insertPeaks(int spectraID, int levelCompress, int peaksCount, 
-                     double* pM, float* pI);
+                     double* pM, float* pI, 
+                     PEAK_CODEC codec = ZLIB_PEAK_CODEC);
     void beginTransaction();
     void endTransaction();
     void undoActiveTransaction();
@@ -109,6 +111,7 @@ protected:
     virtual int parseNextSwitch(int i, int argc, char* argv[]);
 
     virtual void attachAll() {}
+    virtual bool keepIndexesOnAppend() { return false; }
     virtual void createTables();
     virtual void createTable(const char* tableName);
     virtual void updateTables();
@@ -119,6 +122,9 @@ protected:
     virtual void getNextRevision(int* major, int* minor);
 
     bool tableExists(const char* schmaTmp, const char* tableName);
+    bool indexExists(const char* schmaTmp, const char* tableName);
+    bool indexExists(const char* schmaTmp, const char* tableName,
+                     const char* columnNames);
     bool tableColumnExists(const char* schmaTmp, const char* tableName, 
                            const char* columnName);
     int getNewFileId(const char* libName, int specId);
@@ -127,6 +133,8 @@ protected:
                          int spectraTmpID, 
                          int copies,
                          bool tmpHasAdditionalColumns = true);
+    int transferAllSpectra(const char* schemaTmp,
+                           bool tmpHasAdditionalColumns = true);
     void transferModifications(const char* schemaTmp, int spectraID, int spectraTmpID);
     void transferPeaks(const char* schemaTmp, int spectraID, int spectraTmpID);
     void transferSpectrumFiles(const char* schmaTmp);
@@ -134,6 +142,8 @@ protected:
 
     int getSpectrumCount(const char* schemaName = NULL);
     int countSpectra(const char* schemaName = NULL);
+    int getMaxId(const char* schemaName, const char* tableName,
+                 const char* columnName = "id");
     void getRevisionInfo(const char* schemaName, int* major, int* minor);
 
     // Property accessors
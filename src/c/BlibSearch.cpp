@@ -40,13 +40,21 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <deque>
+#include <queue>
+#include <functional>
 #include <sstream>
+#include <fstream>
+#include <cstring>
 #include "RefSpectrum.h"
 #include "Match.h"
 #include "PeakProcess.h"
 #include "Reportfile.h"
 #include "LibReader.h"
+#include "ResidentLibrary.h"
 #include "SearchLibrary.h"
+#include "SearchCheckpoint.h"
+#include "TargetDecoyQvalues.h"
 #include "Verbosity.h"
 #include "boost/program_options.hpp"
 #include "BlibUtils.h"
@@ -54,11 +62,36 @@
 #include "PsmFile.h"
 #include "PwizReader.h"
 #include "SpecFileReader.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#ifndef _MSC_VER
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#endif
 
 using namespace std;
 namespace ops = boost::program_options;
 using namespace BiblioSpec;
 
+// longest search job request read from a daemon client
+const static size_t MAX_REQUEST_LENGTH = 4096;
+
+/**
+ * State shared by the daemon's listening thread and its job threads.
+ */
+struct SearchDaemon{
+    const ResidentLibrary* library;
+    const ops::variables_map* options;
+    int listenSocket;
+    deque<int> clients;    // connections waiting for a job thread
+    bool stopping;         // set by a shutdown request
+    boost::mutex lock;     // for clients and stopping
+    boost::condition_variable clientWaiting;
+};
+
 // Private functions
 void runSearch(BiblioSpec::Spectrum& s, 
                vector<string>& libfiles, 
@@ -66,18 +99,35 @@ void runSearch(BiblioSpec::Spectrum& s,
                BiblioSpec::PsmFile* psmFile,
                const ops::variables_map& options_table);
 
-void checkFileExtensions(string specFileName, vector<string> libraryNames);
+void checkFileExtensions(const vector<string>& specFileNames, 
+                         const vector<string>& libraryNames);
+bool hasSpectrumExtension(const string& specFileName);
 
 void ParseCommandline(const int argc, 
                            char** const argv,         
                            ops::variables_map& options_table);
 string getTargetReportName(const string& specFileName, 
                            const ops::variables_map& options_table);
+string checkpointOptionsString(const ops::variables_map& options_table);
+void getSpectrumFileNames(const string& firstArgument,
+                          vector<string>& libraryNames,
+                          vector<string>& specFileNames);
+int searchFiles(BiblioSpec::SearchLibrary& searcher,
+                const vector<string>& specFileNames,
+                const vector<string>& reportFileNames,
+                const vector<string>& psmFileNames,
+                const ops::variables_map& options_table,
+                BiblioSpec::SearchCheckpoint* checkpoint);
+void runDaemon(const string& socketName,
+               vector<string>& libraryNames,
+               const ops::variables_map& options_table);
+void serveClients(SearchDaemon* daemon);
+string runJob(SearchDaemon* daemon, const string& request);
 
 /**
  * The starting point for BlibSearch.
  *
- * Compares all spectra in the given file to spectra in the library
+ * Compares all spectra in the given files to spectra in the library
  * whose m/z is with in +/- mzWindow.  Stores results in an sqlite db
  * and prints to text file.
  */
@@ -87,11 +137,30 @@ int main(int argc, char* argv[])
     ops::variables_map options_table;
 
     ParseCommandline(argc, argv, options_table);
+    if( options_table.count("q-values") && 
+        options_table["decoys-per-target"].as<int>() < 1 ){
+        Verbosity::error("Computing q-values requires decoys-per-target "
+                         "of at least 1.");
+    }
 
     // get input files
     string specFileName = options_table["spectrum-file"].as<string>();
     vector<string> libraryNames = options_table["library"].as< vector<string> >();
-    checkFileExtensions(specFileName, libraryNames);
+
+    // first argument is the socket to listen on
+    if( options_table.count("daemon") ){
+        runDaemon(specFileName, libraryNames, options_table);
+        return 0;
+    }
+
+    vector<string> specFileNames;
+    getSpectrumFileNames(specFileName, libraryNames, specFileNames);
+    checkFileExtensions(specFileNames, libraryNames);
+
+    // reports and .psm files list the libraries from the options
+    options_table.erase("library");
+    options_table.insert(make_pair(string("library"), 
+                                   ops::variable_value(libraryNames, false)));
 
     // print status
     ostringstream stringBuilder;
@@ -100,74 +169,661 @@ int main(int argc, char* argv[])
     BiblioSpec::Verbosity::status("Using library(s) %s.", 
                                   concatLibNames.c_str());
 
-    // open the report files
-    BiblioSpec::Reportfile targetReport(options_table);
-    BiblioSpec::Reportfile decoyReport(options_table);
-    string reportFileName = getTargetReportName(specFileName, options_table);
-    targetReport.open(reportFileName.c_str());
-    if( options_table["decoys-per-target"].as<int>() > 0 ){
-        BiblioSpec::replaceExtension(reportFileName,"decoy.report"); 
-        decoyReport.open(reportFileName.c_str());
+    // name the output files for each spectrum file
+    if( specFileNames.size() > 1 && options_table.count("report-file") ){
+        Verbosity::error("Cannot use one report file for %d spectrum files.",
+                         specFileNames.size());
     }
-
-    // Initialize a .psm file (sqlite db), if requested
-    BiblioSpec::PsmFile* psmFile = NULL;
-    if( options_table.count("psm-result-file") ){
-        psmFile = 
-            new BiblioSpec::PsmFile(options_table["psm-result-file"].as<string>().c_str(),
-                        options_table );
+    vector<string> reportFileNames;
+    vector<string> psmFileNames;
+    for(size_t i = 0; i < specFileNames.size(); i++){
+        reportFileNames.push_back(getTargetReportName(specFileNames.at(i),
+                                                      options_table));
+        string psmFileName;
+        if( options_table.count("psm-result-file") ){
+            psmFileName = options_table["psm-result-file"].as<string>();
+            if( specFileNames.size() > 1 ){
+                psmFileName = specFileNames.at(i);
+                BiblioSpec::replaceExtension(psmFileName, "psm");
+            }
+        }
+        psmFileNames.push_back(psmFileName);
     }
 
+    // record progress next to the first report to resume from
+    string checkpointName = reportFileNames.at(0);
+    BiblioSpec::replaceExtension(checkpointName, "checkpoint");
+    BiblioSpec::SearchCheckpoint checkpoint(checkpointName, 
+                                 options_table.count("preserve-order") > 0,
+                                 checkpointOptionsString(options_table));
+
     // Initialize a searcher with libraries and options
     BiblioSpec::SearchLibrary searcher(libraryNames, options_table);
 
-    // TODO replace with a SpecFileReader
-    PwizReader* fileReader = new PwizReader();
-    fileReader->setIdType(INDEX_ID); // for getNextSpectrum look up
-    bool mzSort = (options_table.count("preserve-order") == 0);
-    fileReader->openFile(specFileName.c_str(), mzSort);
+    searchFiles(searcher, specFileNames, reportFileNames, psmFileNames,
+                options_table, &checkpoint);
+    return 0;
 
-    BiblioSpec::Verbosity::status("Searching spectra in '%s'.", 
-                                  specFileName.c_str());
+}// end main
 
-    // TODO include a progress indicator
-    BiblioSpec::Spectrum curSpectrum;
-    while( fileReader->getNextSpectrum(curSpectrum) ) {
-        
-        searcher.searchSpectrum(curSpectrum);
-
-        const vector<BiblioSpec::Match>& targetMatches = searcher.getTargetMatches();
-        const vector<BiblioSpec::Match>& decoyMatches = searcher.getDecoyMatches();
-        
-        if(targetMatches.size() == 0){
-            curSpectrum.clear();
-            continue;
+/**
+ * Describe the search for its checkpoint so that it is only resumed
+ * by the same search: the libraries and options in the report header
+ * and the other options that change what is written.
+ * \returns One "# name = value" line per option.
+ */
+string checkpointOptionsString(const ops::variables_map& options_table)
+{
+    const char* resultOptions[] = { 
+        "cluster-queries", "compute-p-values", "pooled-p-values", 
+        "pool-bin-width", "pool-warmup", "fraction-to-fit", 
+        "min-weibull-scores", "weibull-param-file", "correlation-tolerance",
+        "print-all-params", "decoys-per-target", "q-values", "circ-shift",
+        "bin-size", "bin-offset", "remove-noise-first", 
+        "shift-raw-spectrum" };
+
+    ostringstream options;
+    options << Reportfile::searchOptionsString(options_table);
+    for(size_t i = 0; i < sizeof(resultOptions) / sizeof(char*); i++){
+        const char* name = resultOptions[i];
+        options << "# " << name << " = ";
+        if( options_table.count(name) == 0 ){
+            options << "unset";
+        } else {
+            const boost::any& value = options_table[name].value();
+            if( boost::any_cast<int>(&value) ){
+                options << boost::any_cast<int>(value);
+            } else if( boost::any_cast<double>(&value) ){
+                options << boost::any_cast<double>(value);
+            } else if( boost::any_cast<bool>(&value) ){
+                options << (boost::any_cast<bool>(value) ? "true" : "false");
+            } else if( boost::any_cast<string>(&value) ){
+                options << boost::any_cast<string>(value);
+            } else {
+                options << "set"; // a switch with no value
+            }
+        }
+        options << endl;
+    }
+    return options.str();
+}
+
+/**
+ * Fill specFileNames with the spectrum files to search.  The first
+ * argument is either a spectrum file or a .txt file listing one
+ * spectrum file per line.  Any further arguments with spectrum file
+ * extensions are moved from libraryNames to specFileNames.
+ */
+void getSpectrumFileNames(const string& firstArgument,
+                          vector<string>& libraryNames,
+                          vector<string>& specFileNames){
+    if( BiblioSpec::hasExtension(firstArgument, ".txt") ){
+        ifstream listFile(firstArgument.c_str());
+        if( ! listFile.is_open() ){
+            Verbosity::error("Could not open spectrum file list '%s'.",
+                             firstArgument.c_str());
+        }
+        string line;
+        while( getline(listFile, line) ){
+            size_t start = line.find_first_not_of(" \t\r");
+            if( start == string::npos ){
+                continue; // blank line
+            }
+            size_t end = line.find_last_not_of(" \t\r");
+            specFileNames.push_back(line.substr(start, end - start + 1));
+        }
+        if( specFileNames.empty() ){
+            Verbosity::error("No spectrum files listed in '%s'.", 
+                             firstArgument.c_str());
+        }
+    } else {
+        specFileNames.push_back(firstArgument);
+    }
+
+    vector<string>::iterator firstLibrary = libraryNames.begin();
+    while( firstLibrary != libraryNames.end() && 
+           hasSpectrumExtension(*firstLibrary) ){
+        specFileNames.push_back(*firstLibrary);
+        ++firstLibrary;
+    }
+    libraryNames.erase(libraryNames.begin(), firstLibrary);
+    if( libraryNames.empty() ){
+        Verbosity::error("No library given to search.");
+    }
+}
+
+/**
+ * A spectrum file being searched, the spectrum from it waiting to be
+ * searched and the files its results are written to.
+ */
+struct QueryFile{
+    string specFileName;
+    PwizReader* reader;
+    BiblioSpec::Spectrum spectrum;
+    size_t position; // of spectrum in the reader, or of the end
+    BiblioSpec::Reportfile targetReport;
+    BiblioSpec::Reportfile decoyReport;
+    BiblioSpec::PsmFile* psmFile;
+
+    QueryFile(const string& specFileName, const string& reportFileName,
+              const string& psmFileName, 
+              const ops::variables_map& options_table,
+              const CheckpointFile* resumeFrom);
+    ~QueryFile();
+    bool readNextSpectrum();
+    void searchSpectrum(BiblioSpec::SearchLibrary& searcher);
+    CheckpointFile checkpoint();
+};
+
+/**
+ * Open the spectrum file and the named report file, a decoy report
+ * file if decoys are searched, and a .psm file if psmFileName is not
+ * empty.  If resumeFrom is not NULL, continue the files from that
+ * checkpoint instead of starting them again.
+ */
+QueryFile::QueryFile(const string& specName, 
+                     const string& reportFileName,
+                     const string& psmFileName, 
+                     const ops::variables_map& options_table,
+                     const CheckpointFile* resumeFrom) :
+    specFileName(specName),
+    reader(NULL), 
+    position(0),
+    targetReport(options_table, specName),
+    decoyReport(options_table, specName),
+    psmFile(NULL)
+{
+    // open the report files
+    bool decoys = (options_table["decoys-per-target"].as<int>() > 0);
+    string decoyReportName = reportFileName;
+    BiblioSpec::replaceExtension(decoyReportName,"decoy.report"); 
+    if( resumeFrom ){
+        targetReport.reopen(reportFileName.c_str(), resumeFrom->reportSize);
+        if( decoys ){
+            decoyReport.reopen(decoyReportName.c_str(), 
+                               resumeFrom->decoyReportSize);
+        }
+    } else {
+        targetReport.open(reportFileName.c_str());
+        if( decoys ){
+            decoyReport.open(decoyReportName.c_str());
         }
+    }
 
-        // write to the .report file
-        targetReport.writeMatches(targetMatches);
-        decoyReport.writeMatches(decoyMatches);
+    // Initialize a .psm file (sqlite db), if requested
+    if( ! psmFileName.empty() ){
+        if( resumeFrom ){
+            psmFile = new BiblioSpec::PsmFile(psmFileName.c_str(), 
+                                              options_table,
+                                              resumeFrom->lastResultID);
+        } else {
+            psmFile = new BiblioSpec::PsmFile(psmFileName.c_str(), 
+                                              options_table);
+        }
+    }
 
-        // write to the .psm file
-        if(psmFile) {
-            psmFile->insertMatches(targetMatches);
-            psmFile->insertMatches(decoyMatches);
-            // restore this eventually
-            //psmFile->insertSpecData(curSpectrum, allMatches, searcher);
+    // TODO replace with a SpecFileReader
+    reader = new PwizReader();
+    reader->setIdType(INDEX_ID); // for getNextSpectrum look up
+    bool mzSort = (options_table.count("preserve-order") == 0);
+    try{
+        reader->openFile(specFileName.c_str(), mzSort);
+        if( resumeFrom ){
+            reader->setNextPosition(resumeFrom->nextPosition);
         }
-        curSpectrum.clear();
-    } // next spectrum
+    } catch(...) { // a daemon job's errors are thrown
+        delete reader;
+        delete psmFile;
+        throw;
+    }
+    position = reader->getNextPosition();
+
+    BiblioSpec::Verbosity::status("Searching spectra in '%s'.", 
+                                  specFileName.c_str());
+}
 
+QueryFile::~QueryFile(){
     if( psmFile )
         psmFile->commit();
     
     // todo close report file
-    delete fileReader;
+    delete reader;
     delete psmFile;
-    return 0;
+}
 
-}// end main
+/**
+ * Replace spectrum with the next one in the file.
+ * \returns False if there are no more spectra in the file.
+ */
+bool QueryFile::readNextSpectrum(){
+    spectrum.clear();
+    position = reader->getNextPosition();
+    if( ! reader->getNextSpectrum(spectrum) ){
+        position = reader->getNextPosition();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Search the current spectrum and write any matches to this file's
+ * results.
+ */
+void QueryFile::searchSpectrum(BiblioSpec::SearchLibrary& searcher){
+    searcher.searchSpectrum(spectrum);
 
+    const vector<BiblioSpec::Match>& targetMatches = searcher.getTargetMatches();
+    const vector<BiblioSpec::Match>& decoyMatches = searcher.getDecoyMatches();
+    
+    if(targetMatches.size() == 0){
+        return;
+    }
+
+    // write to the .report file
+    targetReport.writeMatches(targetMatches);
+    decoyReport.writeMatches(decoyMatches);
+
+    // write to the .psm file
+    if(psmFile) {
+        psmFile->insertMatches(targetMatches);
+        psmFile->insertMatches(decoyMatches);
+        // restore this eventually
+        //psmFile->insertSpecData(curSpectrum, allMatches, searcher);
+    }
+}
+
+/**
+ * Deletes the QueryFiles in a list when it goes out of scope.
+ */
+struct QueryFileDeleter{
+    vector<QueryFile*>& queryFiles;
+    QueryFileDeleter(vector<QueryFile*>& files) : queryFiles(files) {}
+    ~QueryFileDeleter(){ clearVector(queryFiles); }
+};
+
+/**
+ * Save all results for the spectra before the current one.
+ * \returns Where to resume this file, assuming the current spectrum
+ * has not been searched.
+ */
+CheckpointFile QueryFile::checkpoint(){
+    CheckpointFile state;
+    state.specFileName = specFileName;
+    state.nextPosition = position;
+    state.reportSize = targetReport.flush();
+    state.decoyReportSize = decoyReport.flush();
+    if( psmFile ){
+        state.lastResultID = psmFile->checkpoint();
+    }
+    return state;
+}
+
+/**
+ * Save the results so far for all files and record in the checkpoint
+ * where each file's search is to resume.  Must be called between
+ * reading a file's next spectrum and searching it.
+ */
+void writeCheckpoint(SearchCheckpoint& checkpoint, 
+                     vector<QueryFile*>& queryFiles){
+    vector<CheckpointFile> files;
+    for(size_t i = 0; i < queryFiles.size(); i++){
+        files.push_back(queryFiles.at(i)->checkpoint());
+    }
+    checkpoint.write(files);
+    Verbosity::debug("Wrote checkpoint.");
+}
+
+/**
+ * Search all spectra in the given files with the searcher.  Write the
+ * results for each spectrum file to its report file, to a decoy
+ * report file if decoys are searched, and to its .psm file unless the
+ * psm file name is empty.  Unless the original order is to be
+ * preserved, spectra from all files are searched together in order
+ * of precursor m/z so that the searcher reads each library spectrum
+ * once.  If checkpoint is not NULL, record progress in it every
+ * checkpoint-interval spectra and, with the resume option, start from
+ * where it left off.  With the q-values option, annotate each report
+ * once its search is finished.
+ * \returns The number of spectra read from the files.
+ */
+int searchFiles(BiblioSpec::SearchLibrary& searcher,
+                const vector<string>& specFileNames,
+                const vector<string>& reportFileNames,
+                const vector<string>& psmFileNames,
+                const ops::variables_map& options_table,
+                SearchCheckpoint* checkpoint)
+{
+    // continue an interrupted search, if there is a checkpoint
+    bool resuming = false;
+    if( checkpoint && options_table.count("resume") ){
+        resuming = checkpoint->read();
+        if( ! resuming ){
+            Verbosity::warn("No checkpoint found, starting the search "
+                            "from the beginning.");
+        } else if( checkpoint->getFiles().size() != specFileNames.size() ){
+            Verbosity::error("The checkpoint is for %d spectrum files, "
+                             "not %d.", checkpoint->getFiles().size(),
+                             specFileNames.size());
+        }
+    }
+
+    vector<QueryFile*> queryFiles;
+    QueryFileDeleter deleter(queryFiles); // also if a daemon job throws
+    for(size_t i = 0; i < specFileNames.size(); i++){
+        const CheckpointFile* resumeFrom = NULL;
+        if( resuming ){
+            resumeFrom = &checkpoint->getFiles().at(i);
+            if( resumeFrom->specFileName != specFileNames.at(i) ){
+                Verbosity::error("The checkpoint is for spectrum file '%s', "
+                                 "not '%s'.", resumeFrom->specFileName.c_str(),
+                                 specFileNames.at(i).c_str());
+            }
+        }
+        queryFiles.push_back(new QueryFile(specFileNames.at(i), 
+                                           reportFileNames.at(i),
+                                           psmFileNames.at(i),
+                                           options_table,
+                                           resumeFrom));
+    }
+    if( resuming ){
+        Verbosity::status("Resuming the search from its last checkpoint.");
+    } else if( checkpoint ){
+        checkpoint->discard(); // left by a different search
+    }
+
+    int checkpointInterval = options_table["checkpoint-interval"].as<int>();
+    if( checkpoint == NULL ){
+        checkpointInterval = 0;
+    }
+
+    // TODO include a progress indicator
+    int numSpectra = 0;
+    if( options_table.count("preserve-order") ){
+        for(size_t i = 0; i < queryFiles.size(); i++){
+            while( queryFiles.at(i)->readNextSpectrum() ){
+                if( checkpointInterval > 0 && numSpectra > 0 &&
+                    numSpectra % checkpointInterval == 0 ){
+                    writeCheckpoint(*checkpoint, queryFiles);
+                }
+                numSpectra++;
+                queryFiles.at(i)->searchSpectrum(searcher);
+            }
+        }
+    } else {
+        // each file's next precursor m/z and file index, lowest on top
+        typedef pair<double, size_t> MzFilePair;
+        priority_queue< MzFilePair, vector<MzFilePair>, 
+                        greater<MzFilePair> > nextSpectra;
+        for(size_t i = 0; i < queryFiles.size(); i++){
+            if( queryFiles.at(i)->readNextSpectrum() ){
+                nextSpectra.push(make_pair(queryFiles.at(i)->spectrum.getMz(),
+                                           i));
+            }
+        }
+
+        while( ! nextSpectra.empty() ){
+            if( checkpointInterval > 0 && numSpectra > 0 &&
+                numSpectra % checkpointInterval == 0 ){
+                writeCheckpoint(*checkpoint, queryFiles);
+            }
+
+            size_t i = nextSpectra.top().second;
+            nextSpectra.pop();
+            numSpectra++;
+            queryFiles.at(i)->searchSpectrum(searcher);
+
+            if( queryFiles.at(i)->readNextSpectrum() ){
+                nextSpectra.push(make_pair(queryFiles.at(i)->spectrum.getMz(),
+                                           i));
+            }
+        } // next spectrum
+    }
+
+    clearVector(queryFiles);
+    if( checkpoint ){
+        checkpoint->discard();
+    }
+
+    if( options_table.count("q-values") ){
+        for(size_t i = 0; i < reportFileNames.size(); i++){
+            string decoyReportName = reportFileNames.at(i);
+            BiblioSpec::replaceExtension(decoyReportName, "decoy.report");
+            BiblioSpec::TargetDecoyQvalues qvalues(reportFileNames.at(i),
+                                                   decoyReportName);
+            qvalues.annotateReport();
+        }
+    }
+    return numSpectra;
+}
+
+/**
+ * Load the libraries once and search spectrum files for clients that
+ * connect to the named Unix-domain socket until one sends a shutdown
+ * request.  Each connection carries one request, a line with the
+ * spectrum file name and, optionally, the report and .psm file names,
+ * separated by tabs.  The reply is a line starting with OK and the
+ * number of spectra read, or with ERROR and a message.
+ */
+void runDaemon(const string& socketName,
+               vector<string>& libraryNames,
+               const ops::variables_map& options_table)
+{
+#ifdef _MSC_VER
+    Verbosity::error("BlibSearch --daemon is not supported on Windows.");
+#else
+    checkFileExtensions(vector<string>(), libraryNames);
+    if( options_table.count("weibull-param-file") ){
+        Verbosity::error("Cannot write a Weibull parameter file with --daemon.");
+    }
+    if( options_table.count("resume") ){
+        Verbosity::error("Cannot resume a search with --daemon.");
+    }
+    // each request names its own output files
+    if( options_table.count("report-file") || 
+        options_table.count("psm-result-file") ){
+        Verbosity::error("Output files are named by each request with "
+                         "--daemon, not with --report-file or "
+                         "--psm-result-file.");
+    }
+    int numJobs = options_table["daemon-jobs"].as<int>();
+    if( numJobs < 1 ){
+        Verbosity::error("The number of daemon jobs must be at least 1.");
+    }
+
+    ResidentLibrary library(libraryNames, options_table);
+    double megabytes = library.getMemoryUsed() / (1024.0 * 1024.0);
+    Verbosity::status("Holding %d spectra from %d libraries in %.0f MB.",
+                      library.getNumSpectra(), library.getNumLibraries(),
+                      megabytes);
+    int memoryLimit = options_table["memory-limit"].as<int>();
+    if( memoryLimit > 0 && megabytes > memoryLimit ){
+        Verbosity::error("Libraries need %.0f MB, more than the memory "
+                         "limit of %d MB.", megabytes, memoryLimit);
+    }
+
+    SearchDaemon daemon;
+    daemon.library = &library;
+    daemon.options = &options_table;
+    daemon.stopping = false;
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if( socketName.size() >= sizeof(address.sun_path) ){
+        Verbosity::error("Socket name '%s' is too long.", socketName.c_str());
+    }
+    strcpy(address.sun_path, socketName.c_str());
+
+    daemon.listenSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if( daemon.listenSocket < 0 ||
+        ::bind(daemon.listenSocket, (sockaddr*)&address, sizeof(address)) != 0 ||
+        ::listen(daemon.listenSocket, SOMAXCONN) != 0 ){
+        Verbosity::error("Cannot listen on socket '%s': %s.  Remove it if "
+                         "no daemon is using it.", socketName.c_str(),
+                         strerror(errno));
+    }
+
+    // a client that hangs up before its reply must not stop the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    // fail a bad request rather than the daemon
+    Verbosity::throw_on_error(true);
+
+    boost::thread_group jobThreads;
+    for(int i = 0; i < numJobs; i++){
+        jobThreads.create_thread(boost::bind(serveClients, &daemon));
+    }
+    Verbosity::status("Listening for search jobs on %s.", socketName.c_str());
+
+    // hand each connection to a job thread until shut down
+    while( true ){
+        int client = ::accept(daemon.listenSocket, NULL, NULL);
+        if( client < 0 ){
+            if( errno == EINTR ){
+                continue;
+            }
+            break; // listening socket was shut down
+        }
+        boost::mutex::scoped_lock guard(daemon.lock);
+        daemon.clients.push_back(client);
+        daemon.clientWaiting.notify_one();
+    }
+
+    {
+        boost::mutex::scoped_lock guard(daemon.lock);
+        daemon.stopping = true;
+        daemon.clientWaiting.notify_all();
+    }
+    jobThreads.join_all();
+    close(daemon.listenSocket);
+    unlink(socketName.c_str());
+    Verbosity::status("Stopped listening on %s.", socketName.c_str());
+#endif
+}
+
+#ifndef _MSC_VER
+/**
+ * Read one request from each waiting client, run it, and send the
+ * reply.  Run by each daemon job thread.  Returns when the daemon is
+ * stopping and no clients are waiting.
+ */
+void serveClients(SearchDaemon* daemon)
+{
+    while( true ){
+        int client;
+        {
+            boost::mutex::scoped_lock guard(daemon->lock);
+            while( daemon->clients.empty() && ! daemon->stopping ){
+                daemon->clientWaiting.wait(guard);
+            }
+            if( daemon->clients.empty() ){
+                return;
+            }
+            client = daemon->clients.front();
+            daemon->clients.pop_front();
+        }
+
+        // read up to the end of the first line
+        string request;
+        char buffer[512];
+        while( request.find('\n') == string::npos &&
+               request.size() < MAX_REQUEST_LENGTH ){
+            ssize_t numRead = recv(client, buffer, sizeof(buffer), 0);
+            if( numRead < 0 && errno == EINTR ){
+                continue;
+            }
+            if( numRead <= 0 ){
+                break;
+            }
+            request.append(buffer, numRead);
+        }
+        request = request.substr(0, request.find_first_of("\r\n"));
+
+        string reply = runJob(daemon, request) + "\n";
+        size_t sent = 0;
+        while( sent < reply.size() ){
+            ssize_t numSent = send(client, reply.data() + sent, 
+                                   reply.size() - sent, 0);
+            if( numSent < 0 && errno == EINTR ){
+                continue;
+            }
+            if( numSent <= 0 ){
+                break;
+            }
+            sent += numSent;
+        }
+        close(client);
+    }
+}
+
+/**
+ * Carry out one client request, either a search or a shutdown.
+ * \returns The reply for the client, without the end of line.
+ */
+string runJob(SearchDaemon* daemon, const string& request)
+{
+    if( request == "shutdown" ){
+        Verbosity::status("Received shutdown request.");
+        ::shutdown(daemon->listenSocket, SHUT_RDWR);
+        return "OK";
+    }
+
+    // spectrum file, report file, psm file
+    vector<string> fileNames;
+    size_t start = 0;
+    while( start <= request.size() ){
+        size_t tab = request.find('\t', start);
+        if( tab == string::npos ){
+            tab = request.size();
+        }
+        fileNames.push_back(request.substr(start, tab - start));
+        start = tab + 1;
+    }
+
+    string specFileName = fileNames.at(0);
+    if( specFileName.empty() || fileNames.size() > 3 ){
+        return "ERROR Expected <spectrum file>[<tab><report file>"
+            "[<tab><psm file>]].";
+    }
+    if( ! hasSpectrumExtension(specFileName) ){
+        return "ERROR Spectrum file '" + specFileName + "' must be of type "
+            ".ms2, .cms2, .bms2, .mzML, .mzXML, .MGF, or .wiff.";
+    }
+    if( ! ifstream(specFileName.c_str()).is_open() ){
+        return "ERROR Cannot read spectrum file '" + specFileName + "'.";
+    }
+
+    string reportFileName = getTargetReportName(specFileName, 
+                                                *daemon->options);
+    if( fileNames.size() > 1 && ! fileNames.at(1).empty() ){
+        reportFileName = fileNames.at(1);
+    }
+    if( ! ofstream(reportFileName.c_str(), ios::app).is_open() ){
+        return "ERROR Cannot write report file '" + reportFileName + "'.";
+    }
+    string psmFileName;
+    if( fileNames.size() > 2 ){
+        psmFileName = fileNames.at(2);
+    }
+
+    try{
+        BiblioSpec::SearchLibrary searcher(*daemon->library, 
+                                           *daemon->options);
+        int numSpectra = searchFiles(searcher, 
+                                     vector<string>(1, specFileName), 
+                                     vector<string>(1, reportFileName),
+                                     vector<string>(1, psmFileName), 
+                                     *daemon->options, NULL);
+        ostringstream reply;
+        reply << "OK " << numSpectra;
+        return reply.str();
+    } catch(std::exception& e) {
+        return string("ERROR ") + e.what();
+    } catch(...) {
+        return "ERROR Search failed.";
+    }
+}
+#endif
 
 /**
  * Return the correct name of the report file for the target matches.
@@ -221,6 +877,10 @@ void ParseCommandline(const int argc,
              value<double>()->default_value(3),
              "Compare query to library spectra with precursor m/z +/- ARG.")
 
+            ("precursor-tolerance-ppm",
+             value<double>()->default_value(0),
+             "Compare query to library spectra with precursor m/z within ARG ppm of the query, instead of mz-window.  Default 0, use mz-window.")
+
             ("low-charge,L",
              value<int>()->default_value(1),
              "Search only spectra with charge no less than ARG.")
@@ -235,16 +895,45 @@ void ParseCommandline(const int argc,
             
             ("psm-result-file",
              value<string>(),
-             "Return results in a .psm file named ARG.")
+             "Return results in a .psm file named ARG.  With several spectrum files, each gets a .psm file named after it.")
 
             ("report-file,R",
              value<string>(),
-             "Return results in report file named ARG.  Default is <spectrum file name>.report.")
+             "Return results in report file named ARG.  Default is <spectrum file name>.report.  Only for a single spectrum file.")
 
             ("preserve-order",
-             "Search spectra in the order they appear in the file.  Default to search as sorted by precursor m/z."
+             "Search spectra in the order they appear in the file, one file after another.  Default to search spectra from all files as sorted by precursor m/z."
              )
 
+            ("cluster-queries",
+             "Search only the first of any queries with the same charge, precursor m/z within cluster-mz-tolerance and similar peaks, and give the rest its matches.  Not with preserve-order.")
+
+            ("cluster-mz-tolerance",
+             value<double>()->default_value(0.02),
+             "With cluster-queries, include queries with precursor m/z up to ARG above the first query's.  Default 0.02.")
+
+            ("cluster-min-dotp",
+             value<double>()->default_value(0.9),
+             "With cluster-queries, include queries whose processed peaks have a dot product of at least ARG with the first query's.  Default 0.9.")
+
+            ("checkpoint-interval",
+             value<int>()->default_value(1000),
+             "Save results and record progress every ARG spectra so that an interrupted search can be resumed.  0 for no checkpoints.  Default 1000.")
+
+            ("resume",
+             "Continue an interrupted search from its last checkpoint.  Without a checkpoint, start from the beginning.")
+
+            ("daemon",
+             "Load the libraries once and search files for clients of the Unix-domain socket named by the first argument.")
+
+            ("daemon-jobs",
+             value<int>()->default_value(1),
+             "With --daemon, run up to ARG searches at once.  Default 1.")
+
+            ("memory-limit",
+             value<int>()->default_value(0),
+             "With --daemon, stop if the libraries need more than ARG MB of memory.  Default 0, no limit.")
+
             /*
             ("",
              value<>(),
@@ -257,6 +946,18 @@ void ParseCommandline(const int argc,
              value<bool>()->default_value(false),
              "Compute q-values for matches based on the Weibull distribution.  Default TRUE.")
 
+            ("pooled-p-values",
+             value<bool>()->default_value(false),
+             "With compute-p-values, fit one Weibull to the scores of the first pool-warmup queries in each precursor m/z bin and charge, and use it for the rest of the queries in the bin.  Default false.")
+
+            ("pool-bin-width",
+             value<double>()->default_value(100),
+             "Width in m/z of the precursor bins for pooled-p-values.  Default 100.")
+
+            ("pool-warmup",
+             value<int>()->default_value(20),
+             "Number of queries in a bin to fit individually, collecting their scores, before fitting the bin for pooled-p-values.  Default 20.")
+
             ("fraction-to-fit,f",
              value<double>()->default_value(0.5),
              "Fraction of scores to use in Weibull parameter estimation.")
@@ -276,6 +977,9 @@ void ParseCommandline(const int argc,
              value<int>()->default_value(0),
              "Search ARG randomized library spectra for each real library spectrum. Default 0.")
 
+            ("q-values",
+             "After searching, add q-value and PEP columns to each report, estimated from the matches in its decoy report.  Requires decoys-per-target.")
+
             ("circ-shift",
              value<double>()->default_value(3),
              "Generate randomized spectra by adding ARG m/z to each peak.  Default 3.")
@@ -327,24 +1031,19 @@ void ParseCommandline(const int argc,
 
 
 /**
- * Confirm that the spectrum filename ends in a legitimate extension
+ * Confirm that the spectrum filenames end in a legitimate extension
  * and that all of the library names end in .blib.  Die on error.
  */
-void  checkFileExtensions(string specFileName, vector<string> libraryNames){
-
-    // check spec file
-    // eventually allow more file types
-    if( !BiblioSpec::hasExtension(specFileName, ".ms2") &&
-        !BiblioSpec::hasExtension(specFileName, ".cms2") &&
-        !BiblioSpec::hasExtension(specFileName, ".bms2") &&
-        !BiblioSpec::hasExtension(specFileName, ".mzML") &&
-        !BiblioSpec::hasExtension(specFileName, ".mzXML") &&
-        !BiblioSpec::hasExtension(specFileName, ".MGF") &&
-        !BiblioSpec::hasExtension(specFileName, ".wiff")
-        ) {
-        BiblioSpec::Verbosity::error("Spectrum file '%s' must be of type .ms2,"
-                         " .cms2, .bms2, .mzML, .mzXML, .MGF, or .wiff.",
-                         specFileName.c_str());
+void  checkFileExtensions(const vector<string>& specFileNames, 
+                          const vector<string>& libraryNames){
+
+    // check spec files
+    for(size_t i = 0; i < specFileNames.size(); i++) {
+        if( ! hasSpectrumExtension(specFileNames.at(i)) ) {
+            BiblioSpec::Verbosity::error("Spectrum file '%s' must be of type "
+                             ".ms2, .cms2, .bms2, .mzML, .mzXML, .MGF, or "
+                             ".wiff.", specFileNames.at(i).c_str());
+        }
     }
 
     // check libraries
@@ -358,6 +1057,21 @@ void  checkFileExtensions(string specFileName, vector<string> libraryNames){
 }
 
 
+/**
+ * \returns True if the spectrum filename ends in an extension that
+ * can be searched.
+ */
+bool hasSpectrumExtension(const string& specFileName){
+    // eventually allow more file types
+    return( BiblioSpec::hasExtension(specFileName, ".ms2") ||
+            BiblioSpec::hasExtension(specFileName, ".cms2") ||
+            BiblioSpec::hasExtension(specFileName, ".bms2") ||
+            BiblioSpec::hasExtension(specFileName, ".mzML") ||
+            BiblioSpec::hasExtension(specFileName, ".mzXML") ||
+            BiblioSpec::hasExtension(specFileName, ".MGF") ||
+            BiblioSpec::hasExtension(specFileName, ".wiff") );
+}
+
 /*
  * Local Variables:
  * mode: c
@@ -31,7 +31,7 @@
 */
 /*
  * Main for BiblioSpec utility BlibToMs2 for converting sqlite format
- * libraries to modified .ms2 format.
+ * libraries to modified .ms2 format or to .mgf, .msp or binary files.
  */
 
 
@@ -41,15 +41,33 @@
 #include "LibReader.h"
 #include "BlibUtils.h"
 #include "Ms2Writer.h"
+#include "MgfWriter.h"
+#include "MspWriter.h"
+#include "BinarySpecWriter.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <stdio.h>
 
 using namespace std;
 namespace ops = boost::program_options;
 using namespace BiblioSpec;
 
+// spectra read while the previous ones are formatted by other threads
+const static int SPECTRA_PER_BATCH = 2000;
+
 // Private functions
 void ParseCommandline(const int argc,
                       char** const argv,
                       ops::variables_map& options_table);
+SpecWriter* createWriter(const string& format, 
+                         const ops::variables_map& options_table);
+void writeAll(LibReader* library, SpecWriter* fileWriter, int numThreads);
+void writeInParallel(LibReader& library, SpecWriter& fileWriter, 
+                     int numThreads);
+void writeRanges(const string& libName, const string& outName, 
+                 const string& format, int numRanges, bool splitFiles,
+                 const ops::variables_map& options_table);
+string rangeFileName(const string& outName, int rangeNum);
 
 int main(int argc, char* argv[])
 {
@@ -61,33 +79,240 @@ int main(int argc, char* argv[])
     
     // get file names
     string libName = options_table["library"].as<string>();
-    string ms2Name = options_table["file-name"].as<string>();
-    if( ms2Name.empty() ){
-        ms2Name = libName;
-        replaceExtension(ms2Name, "ms2");
+    string format = options_table["format"].as<string>();
+    string outName = options_table["file-name"].as<string>();
+    if( outName.empty() ){
+        outName = libName;
+        replaceExtension(outName, format.c_str());
     }
     
+    int numRanges = options_table["ranges"].as<int>();
+    if( numRanges > 1 ){
+        bool splitFiles = (options_table.count("split-files") > 0);
+        writeRanges(libName, outName, format, numRanges, splitFiles, 
+                    options_table);
+        return 0;
+    }
+
     // open library reader
     Verbosity::status("Opening library %s.", libName.c_str());
     LibReader library(libName.c_str());
 
     // open a spectrum writer
-    Verbosity::status("Writing spectra to %s.", ms2Name.c_str());
-    Ms2Writer fileWriter(options_table);
-    fileWriter.openFile(ms2Name.c_str());
+    Verbosity::status("Writing spectra to %s.", outName.c_str());
+    SpecWriter* fileWriter = createWriter(format, options_table);
+    fileWriter->openFile(outName.c_str());
 
     // write header
     string fullLibName = getAbsoluteFilePath(libName);
-    fileWriter.writeLibName(fullLibName.c_str()); 
+    fileWriter->writeLibName(fullLibName.c_str()); 
+
+    writeAll(&library, fileWriter, options_table["threads"].as<int>());
+
+    // close files
+    delete fileWriter;
+}
+
+/**
+ * \returns A new writer for the given format, one of ms2, mgf, msp
+ * or bin.  Exits if the format is not one of those.
+ */
+SpecWriter* createWriter(const string& format, 
+                         const ops::variables_map& options_table)
+{
+    if( format == "ms2" ){
+        return new Ms2Writer(options_table);
+    } else if( format == "mgf" ){
+        return new MgfWriter(options_table);
+    } else if( format == "msp" ){
+        return new MspWriter(options_table);
+    } else if( format == "bin" ){
+        return new BinarySpecWriter(options_table);
+    }
+    Verbosity::error("Unknown output format '%s'.  Use ms2, mgf, msp, or bin.",
+                     format.c_str());
+    return NULL;
+}
+
+/**
+ * Write all remaining spectra from the library with the writer,
+ * formatting them with numThreads threads.
+ */
+void writeAll(LibReader* library, SpecWriter* fileWriter, int numThreads)
+{
+    if( numThreads > 1 ){
+        writeInParallel(*library, *fileWriter, numThreads);
+        return;
+    }
 
     // for each spectrum
     RefSpectrum curSpectrum;
-    while( library.getNextSpectrum(curSpectrum) ){
-        fileWriter.writeSpectrum(curSpectrum);        
+    while( library->getNextSpectrum(curSpectrum) ){
+        fileWriter->writeSpectrum(curSpectrum);        
         curSpectrum.clear();
     } // next spectrum
+}
 
-    // close files
+/**
+ * Split the library into numRanges ranges of spectrum ids and write
+ * each range in its own thread.  Each range is written to its own
+ * file, named by rangeFileName().  Unless splitFiles is true, the
+ * range files are then copied in order into outName and removed.
+ */
+void writeRanges(const string& libName, const string& outName, 
+                 const string& format, int numRanges, bool splitFiles,
+                 const ops::variables_map& options_table)
+{
+    Verbosity::status("Opening library %s.", libName.c_str());
+    string fullLibName = getAbsoluteFilePath(libName);
+    int numThreads = options_table["threads"].as<int>();
+
+    vector<LibReader*> libraries;
+    vector<SpecWriter*> writers;
+    vector<string> rangeNames;
+    boost::thread_group rangeWriters;
+
+    libraries.push_back(new LibReader(libName.c_str()));
+    int maxId = libraries.front()->getMaxSpecId();
+    int idsPerRange = (maxId + numRanges - 1) / numRanges;
+    Verbosity::debug("Writing %d ranges of %d spectrum ids.", 
+                     numRanges, idsPerRange);
+
+    for(int i = 0; i < numRanges; i++){
+        if( i > 0 ){
+            libraries.push_back(new LibReader(libName.c_str()));
+        }
+        libraries[i]->setIdRange(i * idsPerRange + 1, (i + 1) * idsPerRange);
+
+        rangeNames.push_back(rangeFileName(outName, i + 1));
+        writers.push_back(createWriter(format, options_table));
+        writers[i]->openFile(rangeNames[i].c_str(), splitFiles);
+        if( splitFiles ){
+            Verbosity::status("Writing spectra to %s.", rangeNames[i].c_str());
+            writers[i]->writeLibName(fullLibName.c_str());
+        } else if( i > 0 ){
+            writers[i]->continueFile();
+        }
+        rangeWriters.create_thread(boost::bind(writeAll, libraries[i],
+                                               writers[i], numThreads));
+    }
+    rangeWriters.join_all();
+
+    for(int i = 0; i < numRanges; i++){
+        delete writers[i];
+        delete libraries[i];
+    }
+    if( splitFiles ){
+        return;
+    }
+
+    Verbosity::status("Writing spectra to %s.", outName.c_str());
+    SpecWriter* fileWriter = createWriter(format, options_table);
+    fileWriter->openFile(outName.c_str());
+    fileWriter->writeLibName(fullLibName.c_str());
+    for(int i = 0; i < numRanges; i++){
+        fileWriter->appendFile(rangeNames[i].c_str());
+        remove(rangeNames[i].c_str());
+    }
+    delete fileWriter;
+}
+
+/**
+ * \returns The name of the file for the given range, the output file
+ * name with the range number before its extension.
+ */
+string rangeFileName(const string& outName, int rangeNum)
+{
+    char number[16];
+    sprintf(number, ".%d", rangeNum);
+
+    size_t dot = outName.find_last_of('.');
+    size_t slash = outName.find_last_of("/\\");
+    if( dot == string::npos || (slash != string::npos && dot < slash) ){
+        return outName + number;
+    }
+    string name = outName;
+    name.insert(dot, number);
+    return name;
+}
+
+/**
+ * Read up to batch.size() spectra from the library into the batch.
+ * \returns The number read, 0 when there are no more.
+ */
+size_t readBatch(LibReader& library, SpecWriter& fileWriter, 
+                 vector<RefSpectrum>& batch, vector<char>& fixedNumbers)
+{
+    size_t count = 0;
+    while( count < batch.size() ){
+        batch[count].clear();
+        if( !library.getNextSpectrum(batch[count]) ){
+            break;
+        }
+        fixedNumbers[count] = fileWriter.startSpectrum(batch[count]);
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Format spectra begin to end-1 of the batch into text.  Run by the
+ * formatting threads.
+ */
+void formatBatch(SpecWriter* fileWriter, const vector<RefSpectrum>* batch,
+                 const vector<char>* fixedNumbers, size_t begin, size_t end,
+                 string* text)
+{
+    text->clear();
+    for(size_t i = begin; i < end; i++){
+        fileWriter->formatSpectrum(batch->at(i), fixedNumbers->at(i) != 0, 
+                                   *text);
+    }
+}
+
+/**
+ * Write all spectra in the library, splitting each batch among
+ * numThreads formatting threads while the next batch is read.
+ * Spectra are written in the same order as with one thread.
+ */
+void writeInParallel(LibReader& library, SpecWriter& fileWriter, 
+                     int numThreads)
+{
+    Verbosity::debug("Formatting spectra with %d threads.", numThreads);
+    vector<RefSpectrum> batches[2];
+    vector<char> fixedNumbers[2];
+    for(int i = 0; i < 2; i++){
+        batches[i].resize(SPECTRA_PER_BATCH);
+        fixedNumbers[i].resize(SPECTRA_PER_BATCH);
+    }
+    vector<string> texts(numThreads);
+
+    int cur = 0;
+    size_t count = readBatch(library, fileWriter, batches[cur], 
+                             fixedNumbers[cur]);
+    while( count > 0 ){
+        size_t perThread = (count + numThreads - 1) / numThreads;
+        boost::thread_group formatters;
+        for(int i = 0; i < numThreads; i++){
+            size_t begin = min(count, i * perThread);
+            size_t end = min(count, begin + perThread);
+            formatters.create_thread(boost::bind(formatBatch, &fileWriter,
+                                                 &batches[cur],
+                                                 &fixedNumbers[cur],
+                                                 begin, end, &texts[i]));
+        }
+
+        int next = 1 - cur;
+        size_t nextCount = readBatch(library, fileWriter, batches[next],
+                                     fixedNumbers[next]);
+
+        formatters.join_all();
+        for(int i = 0; i < numThreads; i++){
+            fileWriter.writeFormatted(texts[i]);
+        }
+        cur = next;
+        count = nextCount;
+    }
 }
 
 void ParseCommandline(const int argc,
@@ -101,18 +326,37 @@ void ParseCommandline(const int argc,
         optionsDescription.add_options()
             ("file-name,f",
              value<string>()->default_value(""),
-             "Name the output ms2 file.  Default is <library name>.ms2."
+             "Name the output file.  Default is <library name>.<format>."
+             )
+
+            ("format,F",
+             value<string>()->default_value("ms2"),
+             "Output format: ms2, mgf, msp, or bin.  Default ms2."
              )
 
             ("mz-precision,m",
              value<int>()->default_value(2),
-             "Precision for peak m/z printed to ms2.  Default 2."
+             "Precision for peak m/z.  Default 2."
              )
 
             ("intensity-precision,i",
              value<int>()->default_value(1),
              "Precision for peak intensities.  Default 1."
              )
+
+            ("threads,t",
+             value<int>()->default_value(1),
+             "Number of threads for formatting spectra.  Default 1."
+             )
+
+            ("ranges,r",
+             value<int>()->default_value(1),
+             "Split the library into ARG ranges of spectrum ids written in parallel.  Default 1."
+             )
+
+            ("split-files,s",
+             "With --ranges, leave each range in its own file, <file name>.<range>.<format>.  Default to join them into one file."
+             )
             ;
 
         // define the required command line args
@@ -31,7 +31,13 @@
 */
 
 #include "BlibUtils.h"
-
+#ifdef _MSC_VER
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#endif
 
 using namespace std;
 namespace bfs = boost::filesystem;
@@ -168,6 +174,24 @@ void replaceExtension(string& filename, const char* ext){
     return;
 }
 
+/**
+ * Cut the named file down to its first size bytes.  Returns false if
+ * the file could not be truncated.
+ */
+bool truncateFile(const char* filename, long size){
+#ifdef _MSC_VER
+    int fd = _open(filename, _O_RDWR);
+    if( fd < 0 ){
+        return false;
+    }
+    bool truncated = (_chsize(fd, size) == 0);
+    _close(fd);
+    return truncated;
+#else
+    return (truncate(filename, size) == 0);
+#endif
+}
+
 /**
  * Sum the masses of amino acids and modifications from the given
  * array of masses (as initialized by AminoAcidMasses).
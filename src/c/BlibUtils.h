@@ -107,6 +107,12 @@ bool hasExtension(const char* filename, const char* ext);
  */
 void replaceExtension(string& filename, const char* ext);
 
+/**
+ * Cut the named file down to its first size bytes.  Returns false if
+ * the file could not be truncated.
+ */
+bool truncateFile(const char* filename, long size);
+
 /**
  * Compare the first element of a pair of doubles for sorting in
  * descending order. 
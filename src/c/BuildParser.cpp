@@ -531,6 +531,22 @@ string BuildParser::getFileName() {
     return fullFilename_;
 }
 
+/**
+ * \brief Return the builder so that subclasses can create additional
+ * parsers for the same library.
+ */
+BlibBuilder& BuildParser::getBlibBuilder() {
+    return blibMaker_;
+}
+
+/**
+ * \brief Return the name of the spectrum file registered by
+ * setSpecFileName().
+ */
+string BuildParser::getSpecFileName() {
+    return curSpecFileName_;
+}
+
 
 /**
  * \brief Read through the mxXML file one spec at a time and match up
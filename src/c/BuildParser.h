@@ -113,6 +113,8 @@ class BuildParser : protected SAXHandler{
                        const vector<const char*>& extensions,
                        const vector<const char*>& directories = vector<const char*>());
 
+  BlibBuilder& getBlibBuilder();
+  string getSpecFileName();
   double getScoreThreshold(BUILD_INPUT fileType);
   void findScanNumFromName();
   void findScanIndexFromName();
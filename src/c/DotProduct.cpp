@@ -32,6 +32,8 @@
 //class definition of DotProduct
 
 #include "DotProduct.h"
+#include <map>
+#include <algorithm>
 
 using namespace std;
 
@@ -55,6 +57,16 @@ void DotProduct::compare(Match& match)
     match.setScore( DOTP, getAngle(exp, ref));
 }
 
+/**
+ * Score two lists of processed peaks against each other, as compare()
+ * scores a match.  Used to compare two query spectra.
+ */
+double DotProduct::comparePeaks(const vector<PEAK_T>& exp,
+                                const vector<PEAK_T>& ref)
+{
+    return getAngle(exp, ref);
+}
+
 
 //sum the square of the peak intensities for both spec separately
 //sum the product of intenisties of the two spec for peaks of same mass
@@ -97,6 +109,130 @@ double DotProduct::getAngle(const vector<PEAK_T>& exp,
 // return expRefIntSum / sqrt(expIntSqSum*refIntSqSum);
 }
 
+/**
+ * For each of the given processed spectra, bound the sum of its
+ * getAngle() scores against all the others without comparing every
+ * pair.  Takes O(total peaks * log(distinct m/z)) time.
+ *
+ * If getAngle() were the cosine of two peak vectors, spectrum i's sum
+ * would be v_i . (sum of all v) - 1, with v the peaks scaled to unit
+ * length.  getAngle() stops at the end of the shorter peak list, so
+ * its norms leave out the peaks of each spectrum above the last m/z of
+ * the other.  Dividing by the full norms can only make the score
+ * smaller, giving the lower bound.  For the upper bound, pick a cutoff
+ * m/z.  For two spectra both ending at or above it, dividing by the
+ * norms of only the peaks up to the cutoff can only make the score
+ * larger.  Scores with spectra ending below the cutoff are at most 1.
+ * A few cutoffs are tried and the smallest bound kept.
+ */
+void DotProduct::getScoreSumBounds(const vector<const vector<PEAK_T>*>& spectra,
+                                   vector<double>& lower, 
+                                   vector<double>& upper)
+{
+    size_t numSpec = spectra.size();
+    lower.assign(numSpec, 0);
+    upper.assign(numSpec, 0);
+
+    vector<double> lastMzs;
+    for(size_t i = 0; i < numSpec; i++){
+        if( !spectra[i]->empty() ){
+            lastMzs.push_back(spectra[i]->back().mz);
+        }
+    }
+    if( lastMzs.empty() ){
+        return;
+    }
+    int numNonEmpty = lastMzs.size();
+    sort(lastMzs.begin(), lastMzs.end());
+
+    // lower bound, dot each spectrum with the sum of unit vectors
+    vector<double> norms(numSpec, 0);
+    map<double, double> unitSum;
+    for(size_t i = 0; i < numSpec; i++){
+        const vector<PEAK_T>& peaks = *spectra[i];
+        double normSq = 0;
+        for(size_t p = 0; p < peaks.size(); p++){
+            normSq += (double)peaks[p].intensity * peaks[p].intensity;
+        }
+        norms[i] = sqrt(normSq);
+        if( norms[i] == 0 ){
+            continue;
+        }
+        for(size_t p = 0; p < peaks.size(); p++){
+            unitSum[peaks[p].mz] += peaks[p].intensity / norms[i];
+        }
+    }
+    for(size_t i = 0; i < numSpec; i++){
+        const vector<PEAK_T>& peaks = *spectra[i];
+        if( peaks.empty() ){
+            continue;
+        }
+        upper[i] = numNonEmpty - 1;
+        if( norms[i] == 0 ){
+            continue;
+        }
+        double dot = 0;
+        double self = 0;
+        for(size_t p = 0; p < peaks.size(); p++){
+            double scaled = peaks[p].intensity / norms[i];
+            dot += scaled * unitSum[peaks[p].mz];
+            self += scaled * scaled;
+        }
+        lower[i] = max(0.0, dot - self);
+    }
+
+    // upper bound, try cutoffs at a few quantiles of the last m/z
+    const double quantiles[] = { 0, 0.02, 0.05, 0.1, 0.2 };
+    const int numQuantiles = sizeof(quantiles) / sizeof(double);
+    double lastCutoff = -1;
+    vector<double> truncNorms(numSpec, 0);
+    for(int q = 0; q < numQuantiles; q++){
+        double cutoff = lastMzs[(int)(quantiles[q] * numNonEmpty)];
+        if( cutoff == lastCutoff ){
+            continue;
+        }
+        lastCutoff = cutoff;
+
+        // scale each full vector by the norm of its peaks to the cutoff
+        map<double, double> scaledSum;
+        int numAtMostOne = 0; // spectra whose scores are only bounded by 1
+        for(size_t i = 0; i < numSpec; i++){
+            const vector<PEAK_T>& peaks = *spectra[i];
+            truncNorms[i] = 0;
+            if( peaks.empty() ){
+                continue;
+            }
+            double normSq = 0;
+            for(size_t p = 0; p < peaks.size() && peaks[p].mz <= cutoff; p++){
+                normSq += (double)peaks[p].intensity * peaks[p].intensity;
+            }
+            if( peaks.back().mz < cutoff || normSq == 0 ){
+                numAtMostOne++;
+                continue;
+            }
+            truncNorms[i] = sqrt(normSq);
+            for(size_t p = 0; p < peaks.size(); p++){
+                scaledSum[peaks[p].mz] += peaks[p].intensity / truncNorms[i];
+            }
+        }
+
+        for(size_t i = 0; i < numSpec; i++){
+            if( truncNorms[i] == 0 ){
+                continue;
+            }
+            const vector<PEAK_T>& peaks = *spectra[i];
+            double dot = 0;
+            double self = 0;
+            for(size_t p = 0; p < peaks.size(); p++){
+                double scaled = peaks[p].intensity / truncNorms[i];
+                dot += scaled * scaledSum[peaks[p].mz];
+                self += scaled * scaled;
+            }
+            upper[i] = min(upper[i], dot - self + numAtMostOne);
+        }
+    }
+}
+
 } // namespace
 
 /*
@@ -66,6 +66,11 @@ class DotProduct
   DotProduct();
   ~DotProduct();
   static void compare(Match& match); 
+  static double comparePeaks(const vector<PEAK_T>& exp,
+                             const vector<PEAK_T>& ref);
+  static void getScoreSumBounds(const vector<const vector<PEAK_T>*>& spectra,
+                                vector<double>& lower, 
+                                vector<double>& upper);
 };
 
 } // namespace
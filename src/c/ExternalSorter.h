@@ -0,0 +1,202 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * The ExternalSorter sorts more fixed-size records than fit in
+ * memory.  Records are collected into a buffer of bounded size which
+ * is sorted and written to a temporary file each time it fills.  The
+ * files are then merged, reading one record at a time from each.
+ */
+
+#include <cstdio>
+#include <algorithm>
+#include <queue>
+#include <string>
+#include <vector>
+#include "Verbosity.h"
+
+using namespace std;
+
+namespace BiblioSpec {
+
+/**
+ * RECORD must be plain data that can be written with fwrite.  LESS
+ * orders two records.  Temporary files are named <runPrefix>.<n>.tmp
+ * and removed when the sorter is destroyed.
+ */
+template<class RECORD, class LESS>
+class ExternalSorter {
+ public:
+    ExternalSorter(const string& runPrefix, size_t maxRecordsInMemory) :
+        runPrefix_(runPrefix), 
+        maxRecords_(maxRecordsInMemory > 0 ? maxRecordsInMemory : 1), 
+        nextRecord_(0), sorted_(false)
+    {}
+
+    ~ExternalSorter(){
+        for(size_t i = 0; i < runs_.size(); i++){
+            fclose(runs_.at(i));
+            ::remove(runNames_.at(i).c_str());
+        }
+    }
+
+    /**
+     * Add a record to be sorted.  Must not be called after sort().
+     */
+    void add(const RECORD& record){
+        buffer_.push_back(record);
+        if( buffer_.size() >= maxRecords_ ){
+            writeRun();
+        }
+    }
+
+    /**
+     * Finish adding records and prepare to return them in order.
+     */
+    void sort(){
+        sorted_ = true;
+        if( runs_.empty() ){
+            std::sort(buffer_.begin(), buffer_.end(), less_);
+            nextRecord_ = 0;
+            return;
+        }
+
+        if( ! buffer_.empty() ){
+            writeRun();
+        }
+        vector<RECORD>().swap(buffer_); // release the memory
+
+        for(size_t i = 0; i < runs_.size(); i++){
+            rewind(runs_.at(i));
+            readFromRun(i);
+        }
+    }
+
+    /**
+     * Set record to the next one in sorted order.
+     * \returns False when all records have been returned.
+     */
+    bool next(RECORD& record){
+        if( ! sorted_ ){
+            sort();
+        }
+
+        if( runs_.empty() ){
+            if( nextRecord_ >= buffer_.size() ){
+                return false;
+            }
+            record = buffer_[nextRecord_++];
+            return true;
+        }
+
+        if( heads_.empty() ){
+            return false;
+        }
+        record = heads_.top().first;
+        size_t run = heads_.top().second;
+        heads_.pop();
+        readFromRun(run);
+        return true;
+    }
+
+ private:
+    typedef pair<RECORD, size_t> RunHead; // next record and its run
+
+    // orders the heap so that the lowest record is on top
+    struct RunHeadGreater {
+        LESS less;
+        bool operator()(const RunHead& left, const RunHead& right) const {
+            return less(right.first, left.first);
+        }
+    };
+
+    string runPrefix_;
+    size_t maxRecords_;
+    LESS less_;
+    vector<RECORD> buffer_;
+    size_t nextRecord_;       // in buffer_ if nothing was written
+    bool sorted_;
+    vector<FILE*> runs_;
+    vector<string> runNames_;
+    priority_queue<RunHead, vector<RunHead>, RunHeadGreater> heads_;
+
+    /**
+     * Sort the buffered records and move them to a new temporary file.
+     */
+    void writeRun(){
+        std::sort(buffer_.begin(), buffer_.end(), less_);
+
+        char suffix[32];
+        sprintf(suffix, ".%d.tmp", (int)runs_.size());
+        string runName = runPrefix_ + suffix;
+        FILE* run = fopen(runName.c_str(), "w+b");
+        if( run == NULL ){
+            Verbosity::error("Could not create temporary file '%s'.",
+                             runName.c_str());
+        }
+        runs_.push_back(run);
+        runNames_.push_back(runName);
+
+        if( fwrite(&buffer_[0], sizeof(RECORD), buffer_.size(), run) 
+            != buffer_.size() ){
+            Verbosity::error("Could not write temporary file '%s'.",
+                             runName.c_str());
+        }
+        buffer_.clear();
+    }
+
+    /**
+     * Put the next record from the given run on the heap, if the run
+     * has one.
+     */
+    void readFromRun(size_t run){
+        RunHead head;
+        if( fread(&head.first, sizeof(RECORD), 1, runs_.at(run)) == 1 ){
+            head.second = run;
+            heads_.push(head);
+        }
+    }
+
+    // not copyable
+    ExternalSorter(const ExternalSorter&);
+    ExternalSorter& operator=(const ExternalSorter&);
+};
+
+} // namespace BiblioSpec
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -32,6 +32,7 @@
 //class definition for LibReader.h
 
 #include "LibReader.h"
+#include <algorithm>
 
 using namespace std;
 
@@ -45,7 +46,10 @@ LibReader::LibReader() :
     expHighChg_(-1),
     totalCount_(-1),
     curSpecId_(1),
-    maxSpecId_(0)
+    maxSpecId_(0),
+    lastSpecId_(0),
+    nextSpecStmt_(NULL),
+    decodePeaks_(true)
 {
 }
 
@@ -57,14 +61,22 @@ LibReader::LibReader(const char* libName) :
     expHighChg_(-1),
     totalCount_(-1),
     curSpecId_(1),
-    maxSpecId_(0)
+    maxSpecId_(0),
+    lastSpecId_(0),
+    nextSpecStmt_(NULL),
+    decodePeaks_(true)
 {
     strcpy(libraryName_, libName);
     initialize();
 }
 
 
-LibReader::~LibReader() {sqlite3_close(db_);}
+LibReader::~LibReader() {
+    if( nextSpecStmt_ != NULL ){
+        sqlite3_finalize(nextSpecStmt_);
+    }
+    sqlite3_close(db_);
+}
 
 void LibReader::initialize()
 {
@@ -75,6 +87,19 @@ void LibReader::initialize()
     }
 
     setMaxLibId();
+
+    mappedLibrary_.open(libraryName_);
+}
+
+/**
+ * The value the SQL statements in getSpecInMzRange() compare
+ * against, which prints the bound with six decimal places.  Used so
+ * that ranges read from the sidecar hold exactly the same spectra.
+ */
+static double sqlMzBound(double mz){
+    char buffer[64];
+    sprintf(buffer, "%f", mz);
+    return atof(buffer);
 }
 
 void LibReader::setMaxLibId(){
@@ -97,6 +122,7 @@ void LibReader::setMaxLibId(){
     }
 
     maxSpecId_ = sqlite3_column_int(statement, 0);
+    lastSpecId_ = maxSpecId_;
 
     Verbosity::debug("Highest lib spec ID is %d.", maxSpecId_);
 }
@@ -104,13 +130,20 @@ void LibReader::setMaxLibId(){
  * Select from the library all RefSpectra with precursor m/z between
  * minMz and maxMz, inclusive.  Get spectra of all charge states.
  * Only add spec with the at least the minimum number of peaks. Adds
- * to the given vector of spectra.  
+ * to the given vector of spectra.  Reads from the library's sidecar
+ * (see MappedLibrary) instead of the database when it has one.
  * \Returns The number of spectra added.
  */
 int LibReader::getSpecInMzRange(double minMz, 
                                 double maxMz,
                                 int minPeaks,
                                 vector<RefSpectrum*>& returnedSpectra ){
+    if( mappedLibrary_.isOpen() ){
+        return mappedLibrary_.getSpecInMzRange(sqlMzBound(minMz), 
+                                               sqlMzBound(maxMz), true,
+                                               minPeaks, 0, returnedSpectra);
+    }
+
     char sqlStmtBuffer[1024];
     sprintf(sqlStmtBuffer,
             "SELECT id, peptideSeq, precursorMZ, precursorCharge, "
@@ -146,14 +179,7 @@ int LibReader::getSpecInMzRange(double minMz,
         tmpSpec->setMods(reinterpret_cast<const char*>(sqlite3_column_text(statement, 4)));
         tmpSpec->setCopies(sqlite3_column_int(statement, 5));
 
-        int numPeaks = sqlite3_column_int(statement, 6);
-        int numBytes1 = sqlite3_column_bytes(statement, 7);
-        Byte* comprM = (Byte*)sqlite3_column_blob(statement, 7);
-        int numBytes2 = sqlite3_column_bytes(statement, 8);
-        Byte* comprI = (Byte*)sqlite3_column_blob(statement, 8);
-
-        tmpSpec->setRawPeaks(getUncompressedPeaks(numPeaks, numBytes1, comprM, 
-                                                 numBytes2, comprI));
+        readRangePeaks(statement, 6, *tmpSpec);
 
         returnedSpectra.push_back(tmpSpec);
 
@@ -167,25 +193,41 @@ int LibReader::getSpecInMzRange(double minMz,
 }
 
 /** 
- * Select from the library all RefSpectra with precursor m/z between
- * minMz and maxMz, inclusive.  Get spectra of all charge states.
- * Only add spec with at least minPeaks. Adds to the given deque of
- * spectra.  
+ * Select from the library all RefSpectra with precursor m/z above
+ * minMz and no greater than maxMz.  Get spectra with the given
+ * precursor charge, or of all charge states if charge is 0, so that
+ * spectra at other charges are never read or decoded.  Only add spec
+ * with more than minPeaks. Adds to the given deque of spectra.
+ * Reads from the sidecar when there is one, as above.
  * \Returns The number of spectra added.
  */
 int LibReader::getSpecInMzRange(double minMz, 
                                 double maxMz,
                                 int minPeaks,
+                                int charge,
                                 deque<RefSpectrum*>& returnedSpectra ){
+    if( mappedLibrary_.isOpen() ){
+        return mappedLibrary_.getSpecInMzRange(sqlMzBound(minMz), 
+                                               sqlMzBound(maxMz), false,
+                                               minPeaks, charge, 
+                                               returnedSpectra);
+    }
+
+    // with a charge, precursorCharge = %d AND precursorMZ range can
+    // use the idxChargeMz index
+    char chargeClause[64] = "";
+    if( charge > 0 ){
+        sprintf(chargeClause, "precursorCharge = %d AND ", charge);
+    }
     char sqlStmtBuffer[1024];
     sprintf(sqlStmtBuffer,
             "SELECT id, peptideSeq, precursorMZ, precursorCharge, "
             "peptideModSeq, copies, numPeaks, peakMZ, "
             "peakIntensity FROM RefSpectra, RefSpectraPeaks "
-            "WHERE precursorMZ > %f and precursorMZ <= %f "
+            "WHERE %sprecursorMZ > %f and precursorMZ <= %f "
             "AND numPeaks > %d "
             "AND id = RefSpectraId",
-            minMz, maxMz, minPeaks);
+            chargeClause, minMz, maxMz, minPeaks);
     // NOTE: it's not faster to sort here (in the select statement) than
     // to sort the cache after new spec are added
 
@@ -214,14 +256,7 @@ int LibReader::getSpecInMzRange(double minMz,
         tmpSpec->setMods(reinterpret_cast<const char*>(sqlite3_column_text(statement, 4)));
         tmpSpec->setCopies(sqlite3_column_int(statement, 5));
 
-        int numPeaks = sqlite3_column_int(statement, 6);
-        int numBytes1 = sqlite3_column_bytes(statement, 7);
-        Byte* comprM = (Byte*)sqlite3_column_blob(statement, 7);
-        int numBytes2 = sqlite3_column_bytes(statement, 8);
-        Byte* comprI = (Byte*)sqlite3_column_blob(statement, 8);
-
-        tmpSpec->setRawPeaks(getUncompressedPeaks(numPeaks, numBytes1, comprM, 
-                                                 numBytes2, comprI));
+        readRangePeaks(statement, 6, *tmpSpec);
 
         Verbosity::comment(V_DETAIL, "Adding spectrum %d, precursor %.2f.", 
                            tmpSpec->getLibSpecID(), tmpSpec->getMz());
@@ -375,15 +410,7 @@ RefSpectrum LibReader::getRefSpec(int libID)
         tmpRef.setPrevAA(reinterpret_cast<const char*>(sqlite3_column_text(pStmt,5)));
         tmpRef.setNextAA(reinterpret_cast<const char*>(sqlite3_column_text(pStmt,6)));
         tmpRef.setCopies(sqlite3_column_int(pStmt,7));
-        int numPeaks = sqlite3_column_int(pStmt,8);
-
-        int numBytes1=sqlite3_column_bytes(pStmt,9);
-        Byte* comprM = (Byte*)sqlite3_column_blob(pStmt,9);
-        int numBytes2=sqlite3_column_bytes(pStmt,10);
-        Byte* comprI = (Byte*)sqlite3_column_blob(pStmt,10);
-
-
-        tmpRef.setRawPeaks(getUncompressedPeaks(numPeaks, numBytes1,comprM, numBytes2,comprI));
+        readPeaks(pStmt, 8, tmpRef);
 
         //tmpRef->printMe();
         //rc = sqlite3_step(pStmt);
@@ -428,16 +455,7 @@ bool LibReader::getRefSpec(int libID, RefSpectrum& spec)
         spec.setPrevAA("-");
         spec.setNextAA("-");
         spec.setCopies(sqlite3_column_int(pStmt,7));
-        int numPeaks = sqlite3_column_int(pStmt,8);
-
-        int numBytes1=sqlite3_column_bytes(pStmt,9);
-        Byte* comprM = (Byte*)sqlite3_column_blob(pStmt,9);
-        int numBytes2=sqlite3_column_bytes(pStmt,10);
-        Byte* comprI = (Byte*)sqlite3_column_blob(pStmt,10);
-
-
-        spec.setRawPeaks(getUncompressedPeaks(numPeaks, numBytes1,
-                                              comprM, numBytes2, comprI));
+        readPeaks(pStmt, 8, spec);
 
     } else {
         Verbosity::debug("SQLITE error message: %s", sqlite3_errmsg(db_) );
@@ -451,54 +469,58 @@ bool LibReader::getRefSpec(int libID, RefSpectrum& spec)
     return true;
 }
 
-vector<PEAK_T> LibReader::getUncompressedPeaks(int& numPeaks, 
-                                               int& mzLen, 
-                                               Byte* comprM, 
-                                               int& intensityLen, 
-                                               Byte* comprI)
+/**
+ * Decode the peaks in the current row of the statement and give them
+ * to the spectrum.  The number of peaks is in the given column,
+ * followed by the m/z and intensity blobs.
+ */
+void LibReader::readPeaks(sqlite3_stmt* pStmt, int numPeaksCol, 
+                          Spectrum& spec)
 {
-    vector<PEAK_T> peaks;
+    int numPeaks = sqlite3_column_int(pStmt, numPeaksCol);
+    const void* comprM = sqlite3_column_blob(pStmt, numPeaksCol + 1);
+    int numBytes1 = sqlite3_column_bytes(pStmt, numPeaksCol + 1);
+    const void* comprI = sqlite3_column_blob(pStmt, numPeaksCol + 2);
+    int numBytes2 = sqlite3_column_bytes(pStmt, numPeaksCol + 2);
 
-    int i;
-    PEAK_T p;
-
-    //variables for compressed files
-    uLong uncomprLenM, uncomprLenI;
-    double *mz;
-    float *intensity;
-
-    uncomprLenM = numPeaks*sizeof(double);
-    if ((int)uncomprLenM == mzLen)
-        mz = (double*) comprM;
-    else {
-        mz = new double[numPeaks];
-        uncompress((Bytef*)mz, &uncomprLenM, comprM, mzLen);
-    }
-    
-    uncomprLenI=numPeaks*sizeof(float);
-    if ((int)uncomprLenI == intensityLen)
-        intensity = (float*) comprI;
-    else {
-        intensity = new float[numPeaks];
-        uncompress((Bytef*)intensity, &uncomprLenI, comprI, intensityLen);
-    }
-    
-    for(i=0;i<numPeaks;i++) {
-        p.mz = mz[i];
-        p.intensity = intensity[i];
-        peaks.push_back(p);
+    vector<PEAK_T> peaks;
+    if( peakDecoder_.decode(numPeaks, comprM, numBytes1, comprI, numBytes2) ){
+        peakDecoder_.getPeaks(peaks);
+    } else {
+        Verbosity::warn("Unable to read peaks from %s.", libraryName_);
     }
+    spec.swapRawPeaks(peaks);
+}
 
 
-    if ((int)uncomprLenM != mzLen)
-        delete [] mz;
-    if ((int)uncomprLenI != intensityLen)
-        delete [] intensity;
-
-    return peaks;
-
+/**
+ * Read the peaks of a spectrum returned by getSpecInMzRange(),
+ * decoding them unless setDecodePeaks(false) was called.
+ */
+void LibReader::readRangePeaks(sqlite3_stmt* pStmt, int numPeaksCol, 
+                               RefSpectrum& spec)
+{
+    if( decodePeaks_ ){
+        readPeaks(pStmt, numPeaksCol, spec);
+        return;
+    }
+    spec.setStoredPeaks(sqlite3_column_int(pStmt, numPeaksCol),
+                        sqlite3_column_blob(pStmt, numPeaksCol + 1),
+                        sqlite3_column_bytes(pStmt, numPeaksCol + 1),
+                        sqlite3_column_blob(pStmt, numPeaksCol + 2),
+                        sqlite3_column_bytes(pStmt, numPeaksCol + 2));
 }
 
+/**
+ * With decode false, spectra from getSpecInMzRange() keep their peaks
+ * as stored in the library, for the caller to decode with
+ * RefSpectrum::decodeStoredPeaks() only if they are needed.  Spectra
+ * read from a sidecar already have decoded peaks.
+ */
+void LibReader::setDecodePeaks(bool decode)
+{
+    decodePeaks_ = decode;
+}
 
 vector<RefSpectrum> LibReader::getRefSpecsInRange(int lowLibID, int highLibID)
 {
@@ -536,14 +558,7 @@ vector<RefSpectrum> LibReader::getRefSpecsInRange(int lowLibID, int highLibID)
         tmpRef.setPrevAA(reinterpret_cast<const char*>(sqlite3_column_text(pStmt,5)));
         tmpRef.setNextAA(reinterpret_cast<const char*>(sqlite3_column_text(pStmt,6)));
         tmpRef.setCopies(sqlite3_column_int(pStmt,7));
-        int numPeaks = sqlite3_column_int(pStmt,8);
-
-        int numBytes1=sqlite3_column_bytes(pStmt,9);
-        Byte* comprM = (Byte*)sqlite3_column_blob(pStmt,9);
-        int numBytes2=sqlite3_column_bytes(pStmt,10);
-        Byte* comprI = (Byte*)sqlite3_column_blob(pStmt,10);
-
-        tmpRef.setRawPeaks(getUncompressedPeaks(numPeaks, numBytes1,comprM, numBytes2,comprI));
+        readPeaks(pStmt, 8, tmpRef);
         specs.push_back(tmpRef);
 
         rc = sqlite3_step(pStmt);
@@ -615,15 +630,7 @@ int LibReader::getAllRefSpec(vector<RefSpectrum*>& specs)
         tmpRef->setNextAA("-");
         tmpRef->setCopies(sqlite3_column_int(pStmt,7));
 
-        int numPeaks = sqlite3_column_int(pStmt,8);
-
-        int numBytes1 = sqlite3_column_bytes(pStmt,9);
-        Byte* comprM = (Byte*)sqlite3_column_blob(pStmt,9);
-        int numBytes2 = sqlite3_column_bytes(pStmt,10);
-        Byte* comprI = (Byte*)sqlite3_column_blob(pStmt,10);
-
-        tmpRef->setRawPeaks(getUncompressedPeaks(numPeaks, numBytes1, comprM, 
-                                              numBytes2, comprI));
+        readPeaks(pStmt, 8, *tmpRef);
 
         specs.push_back(tmpRef);
 
@@ -647,21 +654,71 @@ int LibReader::getAllRefSpec(vector<RefSpectrum*>& specs)
  */
 bool LibReader::getNextSpectrum(RefSpectrum& spec){
 
-    // keep trying spec ids until we find one or get to the end
-    while( curSpecId_ <= maxSpecId_  && !getRefSpec(curSpecId_, spec) ){
-        Verbosity::debug("Skipping spectrum %d.", curSpecId_);
-        curSpecId_++;
+    // read all remaining spectra with one statement, in id order
+    if( nextSpecStmt_ == NULL ){
+        if( curSpecId_ > lastSpecId_ ){
+            return false;
+        }
+        char szSqlStmt[1024];
+        sprintf(szSqlStmt, "SELECT id, peptideSeq,precursorMZ, precursorCharge,"
+                "peptideModSeq,prevAA, nextAA, copies, numPeaks, peakMZ, "
+                "peakIntensity "
+                "FROM RefSpectra, RefSpectraPeaks WHERE id >= %d "
+                "AND id <= %d AND id=RefSpectraID ORDER BY id", 
+                curSpecId_, lastSpecId_);
+        int rc = sqlite3_prepare(db_, szSqlStmt, -1, &nextSpecStmt_, 0);
+        if( rc != SQLITE_OK ) {
+            Verbosity::debug("SQLITE error message: %s", sqlite3_errmsg(db_) );
+            Verbosity::error("LibReader::getNextSpectrum cannot prepare SQL "
+                             "statement for reading spectra from %s.",
+                             libraryName_);
+        }
     }
 
-    if( curSpecId_ > maxSpecId_ ){
+    if( sqlite3_step(nextSpecStmt_) != SQLITE_ROW ){
         Verbosity::debug("Returned the last spec from the library.");
+        sqlite3_finalize(nextSpecStmt_);
+        nextSpecStmt_ = NULL;
+        curSpecId_ = lastSpecId_ + 1;
         return false;
     }
-    curSpecId_++;
+
+    spec.setLibSpecID(sqlite3_column_int(nextSpecStmt_,0));
+    spec.setSeq(reinterpret_cast<const char*>(sqlite3_column_text(nextSpecStmt_,
+                                                                    1)));
+    spec.setMz(sqlite3_column_double(nextSpecStmt_,2));
+    spec.setCharge(sqlite3_column_int(nextSpecStmt_,3));
+    spec.setMods(reinterpret_cast<const char*>(sqlite3_column_text(nextSpecStmt_,
+                                                                     4)));
+    spec.setPrevAA("-");
+    spec.setNextAA("-");
+    spec.setCopies(sqlite3_column_int(nextSpecStmt_,7));
+    readPeaks(nextSpecStmt_, 8, spec);
+
+    curSpecId_ = spec.getLibSpecID() + 1;
     
     return true;
 }
 
+/**
+ * Limit getNextSpectrum() to the spectra with LibIds from firstLibID
+ * to lastLibID, inclusive, and start over at firstLibID.
+ */
+void LibReader::setIdRange(int firstLibID, int lastLibID){
+    if( nextSpecStmt_ != NULL ){
+        sqlite3_finalize(nextSpecStmt_);
+        nextSpecStmt_ = NULL;
+    }
+    curSpecId_ = firstLibID;
+    lastSpecId_ = min(lastLibID, maxSpecId_);
+}
+
+/**
+ * \returns The largest LibId in the library.
+ */
+int LibReader::getMaxSpecId(){
+    return maxSpecId_;
+}
 
 } // namespace
 
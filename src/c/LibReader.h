@@ -49,6 +49,8 @@
 #include <cstring>
 #include "sqlite3.h"
 #include "zlib.h"
+#include "PeakCodec.h"
+#include "MappedLibrary.h"
 #include "RefSpectrum.h"
 #include "Verbosity.h"
 
@@ -62,13 +64,15 @@ class LibReader{
 
   int getSpecInMzRange(double minMz, double maxMz, int minPeaks,
                        vector<RefSpectrum*>& returnedSpectra );
-  int getSpecInMzRange(double minMz, double maxMz, int minPeaks, 
+  int getSpecInMzRange(double minMz, double maxMz, int minPeaks, int charge,
                        deque<RefSpectrum*>& returnedSpectra );
   RefSpectrum getRefSpec(int libID); //given specific libSpecNumber, get a RefSpectrum
   bool getRefSpec(int libID, RefSpectrum& spec);
   vector<RefSpectrum> getRefSpecsInRange(int lowLibID, int highLibID);
   int getAllRefSpec(vector<RefSpectrum*>& spec);
   bool getNextSpectrum(RefSpectrum& spec);
+  void setIdRange(int firstLibID, int lastLibID);
+  void setDecodePeaks(bool decode);
 
   //setters and getters
   //  void setLibName(const char* libName);
@@ -85,6 +89,7 @@ class LibReader{
   int getHighChg();
   //  int getTotalCount();
   int countAllSpec();
+  int getMaxSpecId();
   
 
   void initialize();
@@ -100,8 +105,16 @@ class LibReader{
   int totalCount_; //total RefSpectra in the mz range
   int curSpecId_;  // id of the next spectrum to get when getNextSpec called
   int maxSpecId_;  // biggest spec id in the library
+  int lastSpecId_; // id of the last spectrum getNextSpec will return
+  sqlite3_stmt* nextSpecStmt_; // open while getNextSpectrum() reads through
   
-  vector<PEAK_T> getUncompressedPeaks(int& numPeaks, int& mzLen, Byte* comprM,int& intensityLen, Byte* comprI);
+  PeakDecoder peakDecoder_; // buffers reused for every spectrum read
+  bool decodePeaks_; // false to leave range query peaks for the caller
+  MappedLibrary mappedLibrary_; // sidecar for m/z ranges, if there is one
+
+  void readPeaks(sqlite3_stmt* pStmt, int numPeaksCol, Spectrum& spec);
+  void readRangePeaks(sqlite3_stmt* pStmt, int numPeaksCol, 
+                      RefSpectrum& spec);
   void setMaxLibId();
 };
 
@@ -42,6 +42,7 @@
 #include <algorithm>
 #include <string>
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <vector>
 #include <cstdio>
@@ -59,91 +60,252 @@
 #include "zlib.h"
 #include <iomanip>
 #include <map>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 
 using namespace std;
 
+// spectra inserted between commits
+const static int SPECTRA_PER_TRANSACTION = 10000;
+
+// where a spectrum starts in a legacy library file
+struct spec_position{
+    int id;
+    streampos position;
+};
+
+struct compSpecPositionId : public binary_function<spec_position, spec_position, bool>
+{
+    bool operator()(const spec_position& p1, const spec_position& p2) {return p1.id < p2.id;}
+};
+
+// prepared inserts and peak buffers reused for every spectrum
+struct insert_statements{
+    sqlite3_stmt* refSpectra;
+    sqlite3_stmt* peaks;
+    sqlite3_stmt* mods;
+    vector<double> mzs;
+    vector<float> intensities;
+    vector<Byte> comprM;
+    vector<Byte> comprI;
+    z_stream deflater; // reset for each array rather than allocated by compress()
+};
+
+// old and new library names, in pairs, taken in turn by each thread
+struct conversion_queue{
+    vector<string>* names;
+    size_t next;
+    boost::mutex lock;
+};
+
 void sql_stmt(sqlite3* db, const char* stmt);
 string getPeptideModSeq(string pepSeq, string modString, map<int,double>& specMods);
-void add2Table(RefSpectrum* tmpSpec, sqlite3* db);
+void convertLibrary(const string& oldName, const string& newName, bool showProgress);
+void convertLibraries(conversion_queue* queue);
+bool indexLibrary(ifstream& infile, int numSpec, vector<spec_position>& positions);
+void createTables(sqlite3* db, LIBHEAD_T& header, const string& newName);
+void prepareInserts(sqlite3* db, insert_statements& statements);
+void finalizeInserts(insert_statements& statements);
+void add2Table(RefSpectrum* tmpSpec, sqlite3* db, insert_statements& statements);
 
 int main(int argc, char* argv[])
 {
 // TODO: add option for redundant/not redundant
-    if(argc < 3) {
-        cerr << "Usage: LibToSqlite3 <old version lib> <new lib name>" <<endl;
+    int numThreads = 1;
+    int firstName = 1;
+    if( argc > 2 && strcmp(argv[1], "-t") == 0 ) {
+        numThreads = atoi(argv[2]);
+        firstName = 3;
+    }
+
+    int numNames = argc - firstName;
+    if( numNames < 2 || numNames % 2 != 0 || numThreads < 1 ) {
+        cerr << "Usage: LibToSqlite3 [-t <threads>] <old version lib> <new lib name> "
+             << "[<old version lib> <new lib name> ...]" <<endl;
         exit(1);
     }
-    
-    string oldName = argv[1];
-    string newName = argv[2];
-/*
-    string libName = argv[1];
-    string partLibName;
-    
-    //first parse the string in order to get output db name
-    size_t found = libName.find_last_of('.');
-    size_t found_slash = libName.find_last_of('/');
-    int len;
-    if(found_slash != string::npos) {
-        len=found-found_slash-1;
-        partLibName = libName.substr(found_slash+1, len);
-    } else
-        partLibName=libName.substr(0,found);
-    
-    
-    string outLibName(partLibName);
-*/    
-    
-    //Library thisLib(argv[1],2);
-    Library oldLib(oldName.c_str(), 2);
-    //outLibName += "."+thisLib.getVersion_str()+".blib";
-    
-    //LIBHEAD_T header = thisLib.getHeader();
-    LIBHEAD_T header = oldLib.getHeader();
-    
-    //LibIterator allSpec = thisLib.getAllSpec();
-    LibIterator allSpec = oldLib.getAllSpec();
-    
-    vector<RefSpectrum*> libSpecs;
-    
-    while( allSpec.hasSpec() ) {
-        RefSpectrum* tmpSpec = allSpec.getSpecp();
-        libSpecs.push_back(tmpSpec);
+    vector<string> names(argv + firstName, argv + argc);
+
+    if( names.size() == 2 ) {
+        convertLibrary(names.at(0), names.at(1), true);
+        return 0;
     }
 
-    sort( libSpecs.begin(), libSpecs.end(), compRefSpecPtrId());
+    // convert several libraries at once, each into its own file
+    conversion_queue queue;
+    queue.names = &names;
+    queue.next = 0;
+    numThreads = min(numThreads, numNames / 2);
 
-    // CONSIDER: Use BlibMaker instead?
-    // Now all the RefSpecs are in the vector,create database
-    // and create two tables
+    boost::thread_group converters;
+    for(int i=0; i<numThreads; i++) {
+        converters.create_thread(boost::bind(convertLibraries, &queue));
+    }
+    converters.join_all();
 
-    // for meta_table
-    time_t t= time(NULL);
-    char* date = ctime(&t);
+    return 0;
+}
 
-    char blibLSID[2048];
-    //bool redundant = false;
-    bool redundant = true;
-    // TODO: Need a way to specify the library type
-    const char* libType = (redundant ? "redundant" : "nr");
-    //sprintf(blibLSID,"urn:lsid:proteome.gs.washington.edu:spectral_library:bibliospec:%s:%s",libType,partLibName.c_str());
-    sprintf(blibLSID,"urn:lsid:proteome.gs.washington.edu:spectral_library:bibliospec:%s:%s",libType,newName.c_str());
+/**
+ * Convert libraries from the queue until there are none left.  Run by
+ * each conversion thread.
+ */
+void convertLibraries(conversion_queue* queue)
+{
+    while( true ) {
+        size_t i;
+        {
+            boost::mutex::scoped_lock guard(queue->lock);
+            if( queue->next >= queue->names->size() )
+                return;
+            i = queue->next;
+            queue->next += 2;
+        }
+        convertLibrary(queue->names->at(i), queue->names->at(i+1), false);
+        printf("Converted %s to %s.\n", queue->names->at(i).c_str(),
+               queue->names->at(i+1).c_str());
+    }
+}
 
+/**
+ * Write the legacy library oldName as the sqlite library newName.
+ * Spectra are read from the legacy file one at a time in order by id,
+ * so only the id and file position of each is held in memory.
+ */
+void convertLibrary(const string& oldName, const string& newName, bool showProgress)
+{
+    ifstream infile (oldName.c_str(), ios::binary);
+    if( ! infile.is_open() ) {
+        cerr << "Could not open library file " << oldName << endl;
+        exit(1);
+    }
+    LIBHEAD_T header;
+    infile.read( (char*)&header, sizeof(LIBHEAD_T) );
+
+    // legacy libraries are usually sorted by m/z
+    vector<spec_position> positions;
+    bool sortedById = indexLibrary(infile, header.numSpec, positions);
+    if( ! sortedById ) {
+        sort( positions.begin(), positions.end(), compSpecPositionId());
+    }
 
     sqlite3* db;
-    //sqlite3_open(outLibName.c_str(), &db);
     sqlite3_open(newName.c_str(), &db);
 
     if (db == 0) {
-        printf("Could not open database.");
-        return 1;
+        cerr << "Could not open database " << newName << endl;
+        exit(1);
     }
     
     sql_stmt(db,"PRAGMA cache_size=750000");
     sql_stmt(db,"PRAGMA synchronous=OFF");
     sql_stmt(db,"PRAGMA temp_store=MEMORY");
+
+    createTables(db, header, newName);
+
+    insert_statements statements;
+    prepareInserts(db, statements);
+
+    RefSpectrum tmpSpec;
+    tmpSpec.clear(); // so there are no peaks to delete on the first read
+
+    infile.clear();
+    if( ! positions.empty() ) {
+        infile.seekg(positions.front().position);
+    }
+
+    sql_stmt(db, "BEGIN");
+
+    for(int i=0; i<(int)positions.size(); i++) {
+        if (i > 0) {
+            if(showProgress && i % 1000 == 0) {
+                cout<<i<<" ";
+                cout.flush();
+            }
+            
+            if(showProgress && i % 10000 == 0) {
+                cout<<"\n";
+                cout.flush();
+            }
+
+            if(i % SPECTRA_PER_TRANSACTION == 0) {
+                sql_stmt(db, "COMMIT");
+                sql_stmt(db, "BEGIN");
+            }
+        }
+
+        // files already in id order are read straight through
+        if( ! sortedById ) {
+            infile.seekg(positions.at(i).position);
+        }
+        tmpSpec.readFromFile(infile);
+        add2Table(&tmpSpec, db, statements);
+    }
     
     char zSql[1024];
+    strcpy(zSql, "CREATE INDEX idxPeptide ON RefSpectra (peptideSeq, precursorCharge)");
+    sql_stmt(db, zSql);
+
+    strcpy(zSql, "CREATE INDEX idxPeptideMod ON RefSpectra (peptideModSeq, precursorCharge)");
+    sql_stmt(db, zSql);
+
+    strcpy(zSql, "CREATE INDEX idxRefIdPeaks ON RefSpectraPeaks (RefSpectraID)");
+    sql_stmt(db,zSql);
+
+    strcpy(zSql, "CREATE INDEX idxChargeMz ON RefSpectra (precursorCharge, precursorMZ)");
+    sql_stmt(db,zSql);
+
+    sql_stmt(db, "COMMIT");
+
+    finalizeInserts(statements);
+    sqlite3_close(db);
+}
+
+/**
+ * Read through the numSpec spectra of a legacy library, starting at
+ * the current position of infile, and record where each one starts.
+ * \returns True if the spectra are already in order by id.
+ */
+bool indexLibrary(ifstream& infile, int numSpec, vector<spec_position>& positions)
+{
+    positions.reserve(numSpec);
+    bool sortedById = true;
+
+    RefSpectrum tmpSpec;
+    tmpSpec.clear();
+    for(int i=0; i<numSpec; i++) {
+        spec_position position;
+        position.position = infile.tellg();
+        tmpSpec.readFromFile(infile);
+        if( ! infile ) {
+            cerr << "Could not read spectrum " << i+1 << " of " << numSpec
+                 << " from library file." << endl;
+            exit(1);
+        }
+        position.id = tmpSpec.getID();
+        if( ! positions.empty() && position.id < positions.back().id )
+            sortedById = false;
+        positions.push_back(position);
+    }
+
+    return sortedById;
+}
+
+// CONSIDER: Use BlibMaker instead?
+void createTables(sqlite3* db, LIBHEAD_T& header, const string& newName)
+{
+    // for meta_table
+    time_t t= time(NULL);
+    char* date = ctime(&t);
+
+    char blibLSID[2048];
+    //bool redundant = false;
+    bool redundant = true;
+    // TODO: Need a way to specify the library type
+    const char* libType = (redundant ? "redundant" : "nr");
+    sprintf(blibLSID,"urn:lsid:proteome.gs.washington.edu:spectral_library:bibliospec:%s:%s",libType,newName.c_str());
+
+    char zSql[4096];
     strcpy(zSql, "CREATE TABLE LibInfo(libLSID TEXT, createTime TEXT, numSpecs INTEGER, majorVersion INTEGER, minorVersion INTEGER)");
     sql_stmt(db,zSql);
     zSql[0]='\0';
@@ -184,177 +346,144 @@ int main(int argc, char* argv[])
         "position INTEGER, "
         "mass REAL)";
     sql_stmt(db,stmt);
+}
 
-
-    sql_stmt(db, "BEGIN");
-
-    for(int i=0; i<(int)libSpecs.size(); i++) {
-        if (i > 0) {
-            if(i % 1000 == 0) {
-                cout<<i<<" ";
-                cout.flush();
-            }
-            
-            if(i % 10000 == 0) {
-                cout<<"\n";
-                cout.flush();
-            }
-        }
-        
-        RefSpectrum* tmpSpec = libSpecs.at(i);
-        add2Table(tmpSpec,db);
+sqlite3_stmt* prepareInsert(sqlite3* db, const char* zSql)
+{
+    sqlite3_stmt *pStmt;
+    int rc = sqlite3_prepare(db, zSql, -1, &pStmt, 0);
+    if( rc!=SQLITE_OK ) {
+        cout<<"can't prepare SQL statement!"<<rc<<endl;
+        exit(1);
     }
-    
-    strcpy(zSql, "CREATE INDEX idxPeptide ON RefSpectra (peptideSeq, precursorCharge)");
-    sql_stmt(db, zSql);
-
-    strcpy(zSql, "CREATE INDEX idxPeptideMod ON RefSpectra (peptideModSeq, precursorCharge)");
-    sql_stmt(db, zSql);
-
-    strcpy(zSql, "CREATE INDEX idxRefIdPeaks ON RefSpectraPeaks (RefSpectraID)");
-    sql_stmt(db,zSql);
-
-    sql_stmt(db, "COMMIT");
-
-    return 0;
+    return pStmt;
 }
 
-void add2Table(RefSpectrum* tmpSpec, sqlite3* db)
+void prepareInserts(sqlite3* db, insert_statements& statements)
 {
-    //now get each RefSpec information and fill in the table
-    int libID;
-    string pepSeq;
-    string modString;
-    int copies;
-    float preMZ;
-    int preChg;
-    string pepModSeq;
-    map<int, double> specMods;
-    vector<PEAK_T> peaks;
-
-    libID = tmpSpec->getID();
-    pepSeq = tmpSpec->getSeq();
-
-
-    modString = tmpSpec->getMods();
-    copies = tmpSpec -> getCopies();
-    preMZ = tmpSpec -> getMz();
-    preChg = tmpSpec -> getCharge();
-
-    //cout<<"libID="<<libID<<" pepSeq="<<pepSeq<<"modString="<<modString<<endl;
-    pepModSeq = getPeptideModSeq(pepSeq, modString,specMods);
-
-
-
-    peaks = tmpSpec->getPeaks();
-
-    int j;
-
-    //file compression
-    int err;
-    uLong len;
-    Byte *comprM, *comprI;
-    uLong comprLenM, comprLenI;
-    double *pD;
-    float *pF;
-    uLong sizeM;
-    uLong sizeI;
+    statements.refSpectra = prepareInsert(db,
+        "INSERT INTO RefSpectra(peptideSeq,precursorMZ,precursorCharge, "
+        "peptideModSeq,prevAA, nextAA, copies,numPeaks) "
+        "VALUES (?, ?, ?, ?,'-','-', ?, ?)");
+    statements.peaks = prepareInsert(db,
+        "INSERT INTO RefSpectraPeaks VALUES(?,?,?)");
+    statements.mods = prepareInsert(db,
+        "INSERT INTO Modifications(RefSpectraID, position,mass) "
+        "VALUES(?,?,?)");
+
+    statements.deflater.zalloc = Z_NULL;
+    statements.deflater.zfree = Z_NULL;
+    statements.deflater.opaque = Z_NULL;
+    if( deflateInit(&statements.deflater, Z_DEFAULT_COMPRESSION) != Z_OK ) {
+        cout<<"can't initialize compression!"<<endl;
+        exit(1);
+    }
+}
 
-    //Build arrays to hold scan prior to compression
+void finalizeInserts(insert_statements& statements)
+{
+    sqlite3_finalize(statements.refSpectra);
+    sqlite3_finalize(statements.peaks);
+    sqlite3_finalize(statements.mods);
+    deflateEnd(&statements.deflater);
+}
 
-    pD = new double[peaks.size()];
-    pF = new float[peaks.size()];
-    for(j=0;j<(int)peaks.size();j++) {
-        pD[j]=(double)(peaks.at(j).mass);
-        pF[j]=peaks.at(j).intensity;
+/**
+ * Step an insert statement and reset it for the next row.  Exits if
+ * the insert fails.
+ */
+void stepInsert(sqlite3* db, sqlite3_stmt* pStmt)
+{
+    if( sqlite3_step(pStmt) != SQLITE_DONE ) {
+        cout<<"can't insert into library! "<<sqlite3_errmsg(db)<<endl;
+        exit(1);
     }
+    sqlite3_reset(pStmt);
+}
 
-    //compress mz
-    len = (uLong)peaks.size()*sizeof(double);
-    sizeM = len;
-    comprLenM = compressBound(len);
-    comprM = (Byte*)calloc((uInt)comprLenM, 1);
-    err = compress(comprM, &comprLenM, (const Bytef*)pD, len);
-    if (comprLenM >= sizeM) {
-        // no mz compression
-        free(comprM);
-        comprM = (Byte*)pD;
-        comprLenM = sizeM;
+/**
+ * Bind len bytes of peak values to the given column, compressed as
+ * by compress() if that makes them smaller.  The values and buffer
+ * must not change until the statement is stepped.
+ */
+void bindPeaks(sqlite3_stmt* pStmt, int col, const void* values, uLong len,
+               vector<Byte>& buffer, z_stream& deflater)
+{
+    if( len == 0 ) {
+        sqlite3_bind_zeroblob(pStmt, col, 0);
+        return;
     }
 
-    //compress intensity
-    len = (uLong)peaks.size()*sizeof(float);
-    sizeI = len;
-    comprLenI = compressBound(len);
-    comprI = (Byte*)calloc((uInt)comprLenI, 1);
-    err = compress(comprI, &comprLenI, (const Bytef*)pF, len);
-    if (comprLenI >= sizeI) {
-        // no intensity compression
-        free(comprI);
-        comprI = (Byte*)pF;
-        comprLenI = sizeI;
+    buffer.resize(compressBound(len));
+    deflateReset(&deflater);
+    deflater.next_in = (Bytef*)values;
+    deflater.avail_in = (uInt)len;
+    deflater.next_out = &buffer[0];
+    deflater.avail_out = (uInt)buffer.size();
+    int err = deflate(&deflater, Z_FINISH);
+    uLong comprLen = deflater.total_out;
+    if( err != Z_STREAM_END || comprLen >= len ) {
+        // no compression
+        sqlite3_bind_blob(pStmt, col, values, (int)len, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_blob(pStmt, col, &buffer[0], (int)comprLen, SQLITE_STATIC);
     }
+}
 
+void add2Table(RefSpectrum* tmpSpec, sqlite3* db, insert_statements& statements)
+{
+    //now get each RefSpec information and fill in the table
+    string pepSeq = tmpSpec->getSeq();
+    string modString = tmpSpec->getMods();
+    map<int, double> specMods;
 
-    char zSql[8192];
-
-    sprintf(zSql,
-            "INSERT INTO RefSpectra(peptideSeq,precursorMZ,precursorCharge, "
-            "peptideModSeq,prevAA, nextAA, copies,numPeaks) "
-            "VALUES ('%s', %.2f, %d,'%s','-','-', %d,%d)",
-            pepSeq.c_str(),
-            preMZ,
-            preChg,
-            pepModSeq.c_str(),
-            copies,
-            (int)peaks.size());
-
-    sql_stmt(db,zSql);
-    zSql[0]='\0';
+    //cout<<"libID="<<libID<<" pepSeq="<<pepSeq<<"modString="<<modString<<endl;
+    string pepModSeq = getPeptideModSeq(pepSeq, modString,specMods);
+
+    vector<PEAK_T> peaks = tmpSpec->getPeaks();
+
+    // numbers are bound as text, rounded as they always have been,
+    // and stored as REAL by the column affinity
+    char number[64];
+    sqlite3_stmt* pStmt = statements.refSpectra;
+    sqlite3_bind_text(pStmt, 1, pepSeq.c_str(), -1, SQLITE_STATIC);
+    sprintf(number, "%.2f", tmpSpec->getMz());
+    sqlite3_bind_text(pStmt, 2, number, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(pStmt, 3, tmpSpec->getCharge());
+    sqlite3_bind_text(pStmt, 4, pepModSeq.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(pStmt, 5, tmpSpec->getCopies());
+    sqlite3_bind_int(pStmt, 6, (int)peaks.size());
+    stepInsert(db, pStmt);
 
     int spectraID = (int)sqlite3_last_insert_rowid(db);
 
-
-
-    sprintf(zSql, "INSERT INTO RefSpectraPeaks VALUES(%d,?,?)", spectraID);
-
-
-    //cout<<zSql<<endl;
-    sqlite3_stmt *pStmt;
-    int rc;
-
-    rc = sqlite3_prepare(db, zSql, -1, &pStmt, 0);
-    if( rc!=SQLITE_OK ) {
-        cout<<"can't prepare SQL statement!"<<rc<<endl;
-        exit(1);
+    //Build arrays to hold scan prior to compression
+    statements.mzs.resize(peaks.size());
+    statements.intensities.resize(peaks.size());
+    for(int j=0;j<(int)peaks.size();j++) {
+        statements.mzs[j]=(double)(peaks.at(j).mass);
+        statements.intensities[j]=peaks.at(j).intensity;
     }
 
-
-    sqlite3_bind_blob(pStmt, 1, comprM, (int)comprLenM, SQLITE_STATIC);
-    sqlite3_bind_blob(pStmt, 2, comprI, (int)comprLenI, SQLITE_STATIC);
-
-    rc = sqlite3_step(pStmt);
-    rc = sqlite3_finalize(pStmt);
-
-    //clean up memory
-    if (comprLenM != sizeM)
-        free(comprM);
-    if (comprLenI != sizeI)
-        free(comprI);
-    delete [] pD;
-    delete [] pF;
+    pStmt = statements.peaks;
+    sqlite3_bind_int(pStmt, 1, spectraID);
+    bindPeaks(pStmt, 2, peaks.empty() ? NULL : &statements.mzs[0],
+              (uLong)peaks.size()*sizeof(double), statements.comprM,
+              statements.deflater);
+    bindPeaks(pStmt, 3, peaks.empty() ? NULL : &statements.intensities[0],
+              (uLong)peaks.size()*sizeof(float), statements.comprI,
+              statements.deflater);
+    stepInsert(db, pStmt);
 
     //insert into modifications
+    pStmt = statements.mods;
     map<int,double>::iterator it;
     for(it=specMods.begin(); it != specMods.end(); it++) {
-        sprintf(zSql,
-                "INSERT INTO Modifications(RefSpectraID, position,mass) "
-                "VALUES(%d,%d,%.1f)",
-                spectraID,
-                (*it).first,
-                (*it).second);
-        sql_stmt(db,zSql);
-        zSql[0]='\0';
+        sqlite3_bind_int(pStmt, 1, spectraID);
+        sqlite3_bind_int(pStmt, 2, (*it).first);
+        sprintf(number, "%.1f", (*it).second);
+        sqlite3_bind_text(pStmt, 3, number, -1, SQLITE_TRANSIENT);
+        stepInsert(db, pStmt);
     }
     
 }
@@ -0,0 +1,459 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <sys/stat.h>
+#include "sqlite3.h"
+#include "zlib.h"
+#include "MappedLibrary.h"
+#include "PeakCodec.h"
+#include "Verbosity.h"
+
+using namespace std;
+
+namespace BiblioSpec {
+
+static const char MAPPED_LIBRARY_MAGIC[8] = "BLIBIDX";
+static const int MAPPED_LIBRARY_VERSION = 2;
+// reads back differently on a machine with the other byte order
+static const int MAPPED_LIBRARY_BYTE_ORDER = 0x01020304;
+// the part of an SQLite file that holds its change counter
+static const size_t SQLITE_HEADER_SIZE = 100;
+
+/**
+ * Pad the file with zeros to a multiple of 8 bytes.  \returns The new
+ * length.
+ */
+static long long padFile(ofstream& file){
+    static const char padding[8] = {0};
+    long long offset = file.tellp();
+    if( offset % 8 != 0 ){
+        file.write(padding, 8 - offset % 8);
+        offset += 8 - offset % 8;
+    }
+    return offset;
+}
+
+/**
+ * Append one column to the file.  \returns The offset it was written
+ * at.
+ */
+template<class T>
+static long long writeSection(ofstream& file, const vector<T>& column){
+    long long offset = file.tellp();
+    if( !column.empty() ){
+        file.write((const char*)&column[0], column.size() * sizeof(T));
+    }
+    padFile(file);
+    return offset;
+}
+
+MappedLibrary::MappedLibrary()
+  : header_(NULL), peaks_(NULL), mzs_(NULL), ids_(NULL), charges_(NULL),
+    copies_(NULL), numPeaks_(NULL), peakStarts_(NULL), textStarts_(NULL),
+    text_(NULL), maxPeaks_(0), textSize_(0)
+{
+}
+
+MappedLibrary::~MappedLibrary(){
+    close();
+}
+
+string MappedLibrary::getIndexName(const char* libName){
+    return string(libName) + ".idx";
+}
+
+/**
+ * Checksum the header of the library.  SQLite changes its file change
+ * counter on every write, so this tells apart two versions of a
+ * library with the same size written in the same second.
+ * \returns The checksum or -1 if the header cannot be read.
+ */
+long long MappedLibrary::getLibraryHeaderCrc(const char* libName){
+    FILE* file = fopen(libName, "rb");
+    if( file == NULL ){
+        return -1;
+    }
+    Bytef buffer[SQLITE_HEADER_SIZE];
+    size_t bytesRead = fread(buffer, 1, SQLITE_HEADER_SIZE, file);
+    fclose(file);
+    if( bytesRead != SQLITE_HEADER_SIZE ){
+        return -1;
+    }
+    return (long long)crc32(crc32(0L, Z_NULL, 0), buffer, 
+                            (uInt)SQLITE_HEADER_SIZE);
+}
+
+/**
+ * Read every spectrum from the library in order of precursor m/z,
+ * streaming the decoded peaks to the sidecar and collecting the other
+ * columns to write after them.  The sidecar is written under a
+ * temporary name and then renamed so that a search never maps a
+ * partly written one.
+ */
+void MappedLibrary::write(const char* libName){
+    struct stat libStat;
+    if( stat(libName, &libStat) != 0 ){
+        Verbosity::error("Could not find library '%s' to index.", libName);
+    }
+
+    sqlite3* db = NULL;
+    if( sqlite3_open(libName, &db) != SQLITE_OK ){
+        Verbosity::error("Could not open library '%s' to index.", libName);
+    }
+    const char* sql = 
+        "SELECT id, peptideSeq, precursorMZ, precursorCharge, "
+        "peptideModSeq, copies, numPeaks, peakMZ, peakIntensity "
+        "FROM RefSpectra, RefSpectraPeaks WHERE id = RefSpectraId "
+        "ORDER BY precursorMZ, id";
+    sqlite3_stmt* statement = NULL;
+    if( sqlite3_prepare(db, sql, -1, &statement, NULL) != SQLITE_OK ){
+        Verbosity::debug("SQLITE error message: %s", sqlite3_errmsg(db));
+        Verbosity::error("Could not read spectra from '%s' to index.",
+                         libName);
+    }
+
+    string idxName = getIndexName(libName);
+    string tmpName = idxName + ".tmp";
+    ofstream file(tmpName.c_str(), ios::out | ios::binary | ios::trunc);
+    if( !file.good() ){
+        Verbosity::error("Could not write index file '%s'.", tmpName.c_str());
+    }
+    MappedLibraryHeader header;
+    memset(&header, 0, sizeof(header));
+    file.write((const char*)&header, sizeof(header));
+
+    Verbosity::status("Writing index of '%s'.", libName);
+    vector<double> mzs;
+    vector<int> ids;
+    vector<int> charges;
+    vector<int> copies;
+    vector<int> numPeaks;
+    vector<long long> peakStarts(1, 0);
+    vector<long long> textStarts(1, 0);
+    vector<char> text;
+    PeakDecoder peakDecoder;
+    vector<PEAK_T> peaks;
+    vector<PEAK_T> zeroedPeaks; // without the padding's stray bytes
+
+    header.peaksOffset = file.tellp();
+    while( sqlite3_step(statement) == SQLITE_ROW ){
+        ids.push_back(sqlite3_column_int(statement, 0));
+        mzs.push_back(sqlite3_column_double(statement, 2));
+        charges.push_back(sqlite3_column_int(statement, 3));
+        copies.push_back(sqlite3_column_int(statement, 5));
+        numPeaks.push_back(sqlite3_column_int(statement, 6));
+
+        const char* seq = (const char*)sqlite3_column_text(statement, 1);
+        const char* modSeq = (const char*)sqlite3_column_text(statement, 4);
+        if( seq == NULL ){ seq = ""; }
+        if( modSeq == NULL ){ modSeq = ""; }
+        text.insert(text.end(), seq, seq + strlen(seq) + 1);
+        text.insert(text.end(), modSeq, modSeq + strlen(modSeq) + 1);
+        textStarts.push_back(text.size());
+
+        peaks.clear();
+        if( peakDecoder.decode(numPeaks.back(),
+                               sqlite3_column_blob(statement, 7),
+                               sqlite3_column_bytes(statement, 7),
+                               sqlite3_column_blob(statement, 8),
+                               sqlite3_column_bytes(statement, 8)) ){
+            peakDecoder.getPeaks(peaks);
+        } else {
+            Verbosity::warn("Unable to read peaks from %s.", libName);
+        }
+        if( !peaks.empty() ){
+            zeroedPeaks.resize(peaks.size());
+            memset((void*)&zeroedPeaks[0], 0, peaks.size() * sizeof(PEAK_T));
+            for(size_t i = 0; i < peaks.size(); i++){
+                zeroedPeaks[i].mz = peaks[i].mz;
+                zeroedPeaks[i].intensity = peaks[i].intensity;
+            }
+            file.write((const char*)&zeroedPeaks[0], 
+                       zeroedPeaks.size() * sizeof(PEAK_T));
+        }
+        peakStarts.push_back(peakStarts.back() + peaks.size());
+    }
+    sqlite3_finalize(statement);
+    sqlite3_close(db);
+
+    padFile(file);
+    int numSpectra = (int)ids.size();
+    header.mzOffset = writeSection(file, mzs);
+    header.idOffset = writeSection(file, ids);
+    header.chargeOffset = writeSection(file, charges);
+    header.copiesOffset = writeSection(file, copies);
+    header.numPeaksOffset = writeSection(file, numPeaks);
+    header.peakStartOffset = writeSection(file, peakStarts);
+    header.textStartOffset = writeSection(file, textStarts);
+    header.textOffset = writeSection(file, text);
+    header.fileSize = file.tellp();
+
+    memcpy(header.magic, MAPPED_LIBRARY_MAGIC, sizeof(header.magic));
+    header.version = MAPPED_LIBRARY_VERSION;
+    header.byteOrder = MAPPED_LIBRARY_BYTE_ORDER;
+    header.peakSize = sizeof(PEAK_T);
+    header.numSpectra = numSpectra;
+    header.librarySize = libStat.st_size;
+    header.libraryModTime = libStat.st_mtime;
+    header.libraryHeaderCrc = getLibraryHeaderCrc(libName);
+    file.seekp(0);
+    file.write((const char*)&header, sizeof(header));
+    file.close();
+    if( file.fail() ){
+        ::remove(tmpName.c_str());
+        Verbosity::error("Could not write index file '%s'.", tmpName.c_str());
+    }
+
+    ::remove(idxName.c_str()); // rename won't replace it on Windows
+    if( ::rename(tmpName.c_str(), idxName.c_str()) != 0 ){
+        Verbosity::error("Could not replace index file '%s'.", 
+                         idxName.c_str());
+    }
+    Verbosity::debug("Indexed %d spectra in '%s'.", numSpectra, 
+                     idxName.c_str());
+}
+
+bool MappedLibrary::open(const char* libName){
+    close();
+
+    string idxName = getIndexName(libName);
+    struct stat idxStat;
+    if( stat(idxName.c_str(), &idxStat) != 0 ){
+        return false; // no sidecar
+    }
+    if( !file_.open(idxName.c_str(), false) ){
+        Verbosity::warn("Could not open index file '%s'.", idxName.c_str());
+        return false;
+    }
+    if( !checkHeader(libName) ){
+        Verbosity::warn("Ignoring index file '%s'.  It does not match "
+                        "the library and should be rewritten.", 
+                        idxName.c_str());
+        close();
+        return false;
+    }
+
+    const char* data = file_.data();
+    peaks_ = (const PEAK_T*)(data + header_->peaksOffset);
+    mzs_ = (const double*)(data + header_->mzOffset);
+    ids_ = (const int*)(data + header_->idOffset);
+    charges_ = (const int*)(data + header_->chargeOffset);
+    copies_ = (const int*)(data + header_->copiesOffset);
+    numPeaks_ = (const int*)(data + header_->numPeaksOffset);
+    peakStarts_ = (const long long*)(data + header_->peakStartOffset);
+    textStarts_ = (const long long*)(data + header_->textStartOffset);
+    text_ = data + header_->textOffset;
+    maxPeaks_ = (header_->fileSize - header_->peaksOffset) / sizeof(PEAK_T);
+    textSize_ = header_->fileSize - header_->textOffset;
+    if( !checkEntries() ){
+        Verbosity::warn("Ignoring index file '%s'.  It is damaged and "
+                        "should be rewritten.", idxName.c_str());
+        close();
+        return false;
+    }
+
+    Verbosity::debug("Reading %d spectra from index file '%s'.", 
+                     header_->numSpectra, idxName.c_str());
+    return true;
+}
+
+/**
+ * Check that the mapped file is a sidecar this code can read and was
+ * written from the library as it is now.  Sets header_ if it is.
+ */
+bool MappedLibrary::checkHeader(const char* libName){
+    if( file_.size() < sizeof(MappedLibraryHeader) ){
+        return false;
+    }
+    const MappedLibraryHeader* header = 
+        (const MappedLibraryHeader*)file_.data();
+    if( memcmp(header->magic, MAPPED_LIBRARY_MAGIC, 
+               sizeof(header->magic)) != 0 ||
+        header->version != MAPPED_LIBRARY_VERSION ||
+        header->byteOrder != MAPPED_LIBRARY_BYTE_ORDER ||
+        header->peakSize != (int)sizeof(PEAK_T) ||
+        header->fileSize != (long long)file_.size() ){
+        return false;
+    }
+    long long offsets[] = { header->peaksOffset, header->mzOffset,
+                            header->idOffset, header->chargeOffset,
+                            header->copiesOffset, header->numPeaksOffset,
+                            header->peakStartOffset, 
+                            header->textStartOffset, header->textOffset };
+    for(size_t i = 0; i < sizeof(offsets) / sizeof(long long); i++){
+        if( offsets[i] < (long long)sizeof(MappedLibraryHeader) || 
+            offsets[i] > header->fileSize || offsets[i] % 8 != 0 ){
+            return false;
+        }
+    }
+
+    // each column must fit in the file
+    long long numSpectra = header->numSpectra;
+    long long columnEnds[] = { 
+        header->mzOffset + numSpectra * (long long)sizeof(double),
+        header->idOffset + numSpectra * (long long)sizeof(int),
+        header->chargeOffset + numSpectra * (long long)sizeof(int),
+        header->copiesOffset + numSpectra * (long long)sizeof(int),
+        header->numPeaksOffset + numSpectra * (long long)sizeof(int),
+        header->peakStartOffset + 
+        (numSpectra + 1) * (long long)sizeof(long long),
+        header->textStartOffset + 
+        (numSpectra + 1) * (long long)sizeof(long long) };
+    if( numSpectra < 0 ){
+        return false;
+    }
+    for(size_t i = 0; i < sizeof(columnEnds) / sizeof(long long); i++){
+        if( columnEnds[i] > header->fileSize ){
+            return false;
+        }
+    }
+
+    struct stat libStat;
+    if( stat(libName, &libStat) != 0 ||
+        header->librarySize != (long long)libStat.st_size ||
+        header->libraryModTime != (long long)libStat.st_mtime ||
+        header->libraryHeaderCrc != getLibraryHeaderCrc(libName) ){
+        return false;
+    }
+
+    header_ = header;
+    return true;
+}
+
+/**
+ * Check that every spectrum's peaks and text lie inside the file and
+ * that its text holds both the sequence and the modified sequence, so
+ * that nothing is read past an entry when it is copied.
+ */
+bool MappedLibrary::checkEntries() const {
+    for(int i = 0; i < header_->numSpectra; i++){
+        if( peakStarts_[i] < 0 || peakStarts_[i] > peakStarts_[i + 1] ||
+            peakStarts_[i + 1] > maxPeaks_ ||
+            textStarts_[i] < 0 || textStarts_[i] > textStarts_[i + 1] ||
+            textStarts_[i + 1] > textSize_ ){
+            return false;
+        }
+        const char* text = text_ + textStarts_[i];
+        const char* textEnd = text_ + textStarts_[i + 1];
+        const char* seqEnd = (const char*)memchr(text, '\0', textEnd - text);
+        if( seqEnd == NULL ||
+            memchr(seqEnd + 1, '\0', textEnd - (seqEnd + 1)) == NULL ){
+            return false;
+        }
+    }
+    return true;
+}
+
+void MappedLibrary::close(){
+    file_.close();
+    header_ = NULL;
+    peaks_ = NULL;
+    mzs_ = NULL;
+    ids_ = NULL;
+    charges_ = NULL;
+    copies_ = NULL;
+    numPeaks_ = NULL;
+    peakStarts_ = NULL;
+    textStarts_ = NULL;
+    text_ = NULL;
+    maxPeaks_ = 0;
+    textSize_ = 0;
+}
+
+int MappedLibrary::getSpecInMzRange(double minMz, double maxMz, 
+                                    bool includeMin, int minPeaks,
+                                    int charge,
+                                    vector<RefSpectrum*>& returnedSpectra){
+    return addSpectra(minMz, maxMz, includeMin, minPeaks, charge,
+                      returnedSpectra);
+}
+
+int MappedLibrary::getSpecInMzRange(double minMz, double maxMz, 
+                                    bool includeMin, int minPeaks,
+                                    int charge,
+                                    deque<RefSpectrum*>& returnedSpectra){
+    return addSpectra(minMz, maxMz, includeMin, minPeaks, charge,
+                      returnedSpectra);
+}
+
+/**
+ * Find the range by binary search on the sorted m/z column and copy
+ * each spectrum in it out of the mapping.
+ */
+template<class SPEC_CONTAINER>
+int MappedLibrary::addSpectra(double minMz, double maxMz, bool includeMin,
+                              int minPeaks, int charge, 
+                              SPEC_CONTAINER& returnedSpectra){
+    if( header_ == NULL ){
+        return 0;
+    }
+    const double* mzEnd = mzs_ + header_->numSpectra;
+    const double* first = includeMin ? lower_bound(mzs_, mzEnd, minMz)
+                                     : upper_bound(mzs_, mzEnd, minMz);
+    const double* last = upper_bound(first, mzEnd, maxMz);
+
+    int numSpec = 0;
+    for(int i = (int)(first - mzs_); i < (int)(last - mzs_); i++){
+        if( numPeaks_[i] <= minPeaks || 
+            (charge > 0 && charges_[i] != charge) ){
+            continue;
+        }
+        RefSpectrum* tmpSpec = new RefSpectrum();
+        tmpSpec->setLibSpecID(ids_[i]);
+        const char* seq = text_ + textStarts_[i];
+        tmpSpec->setSeq(seq);
+        tmpSpec->setMz(mzs_[i]);
+        tmpSpec->setCharge(charges_[i]);
+        tmpSpec->setMods(seq + strlen(seq) + 1);
+        tmpSpec->setCopies(copies_[i]);
+
+        vector<PEAK_T> peaks(peaks_ + peakStarts_[i], 
+                             peaks_ + peakStarts_[i + 1]);
+        tmpSpec->swapRawPeaks(peaks);
+
+        returnedSpectra.push_back(tmpSpec);
+        numSpec++;
+    }
+    return numSpec;
+}
+
+} // namespace
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
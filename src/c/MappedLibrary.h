@@ -0,0 +1,155 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * A read-only, memory-mapped copy of the spectra in a library, kept
+ * in a sidecar file next to it (<library>.idx).  The sidecar holds
+ * the spectra sorted by precursor m/z, one array per column, with
+ * the peaks already decoded, so that a range of precursor m/z can be
+ * read without SQL or peak decoding.  Because the file is mapped
+ * rather than read, searches running at the same time on one host
+ * share a single copy of it in the page cache.
+ *
+ * The sidecar records the size, modification time and a checksum of
+ * the SQLite header of the library it was written from and is ignored
+ * once the library has changed.
+ */
+
+#include <string>
+#include <vector>
+#include <deque>
+#include "MappedTextFile.h"
+#include "RefSpectrum.h"
+
+using namespace std;
+
+namespace BiblioSpec {
+
+/**
+ * Start of a sidecar file.  Every offset is in bytes from the start
+ * of the file and is a multiple of 8.
+ */
+struct MappedLibraryHeader {
+    char magic[8];          // MAPPED_LIBRARY_MAGIC
+    int version;            // MAPPED_LIBRARY_VERSION
+    int byteOrder;          // MAPPED_LIBRARY_BYTE_ORDER as written
+    int peakSize;           // sizeof(PEAK_T) as written
+    int numSpectra;
+    long long librarySize;  // of the library when the sidecar was written
+    long long libraryModTime;
+    long long libraryHeaderCrc; // of the SQLite header, which counts writes
+    long long fileSize;     // of the whole sidecar
+    long long peaksOffset;  // PEAK_T[numPeaks in all spectra]
+    long long mzOffset;     // double[numSpectra], sorted
+    long long idOffset;     // int[numSpectra]
+    long long chargeOffset; // int[numSpectra]
+    long long copiesOffset; // int[numSpectra]
+    long long numPeaksOffset;  // int[numSpectra], numPeaks column
+    long long peakStartOffset; // long long[numSpectra + 1], into peaks
+    long long textStartOffset; // long long[numSpectra + 1], into text
+    long long textOffset;   // "seq\0modSeq\0" for each spectrum
+};
+
+class MappedLibrary {
+ public:
+    MappedLibrary();
+    ~MappedLibrary();
+
+    /** \returns The name of the sidecar for the given library. */
+    static string getIndexName(const char* libName);
+
+    /**
+     * Write the sidecar for the given library, replacing any that is
+     * there.
+     */
+    static void write(const char* libName);
+
+    /**
+     * Map the sidecar of the given library.  \returns False if there
+     * is none or it does not match the library.
+     */
+    bool open(const char* libName);
+    void close();
+    bool isOpen() const { return header_ != NULL; }
+    int getNumSpectra() const { return header_ ? header_->numSpectra : 0; }
+
+    /**
+     * Add to returnedSpectra each spectrum with precursor m/z above
+     * minMz (or equal to it if includeMin) and no greater than maxMz
+     * that has more than minPeaks peaks and the given precursor
+     * charge, or any charge if charge is 0.  Spectra are added in
+     * order of precursor m/z, then id.  \returns The number added.
+     */
+    int getSpecInMzRange(double minMz, double maxMz, bool includeMin,
+                         int minPeaks, int charge,
+                         vector<RefSpectrum*>& returnedSpectra);
+    int getSpecInMzRange(double minMz, double maxMz, bool includeMin,
+                         int minPeaks, int charge,
+                         deque<RefSpectrum*>& returnedSpectra);
+
+ private:
+    MappedTextFile file_;
+    const MappedLibraryHeader* header_; // NULL if not open
+    const PEAK_T* peaks_;
+    const double* mzs_;
+    const int* ids_;
+    const int* charges_;
+    const int* copies_;
+    const int* numPeaks_;
+    const long long* peakStarts_;
+    const long long* textStarts_;
+    const char* text_;
+    long long maxPeaks_;    // room for this many peaks after peaks_
+    long long textSize_;    // bytes after text_
+
+    static long long getLibraryHeaderCrc(const char* libName);
+    bool checkHeader(const char* libName);
+    bool checkEntries() const;
+    template<class SPEC_CONTAINER>
+    int addSpectra(double minMz, double maxMz, bool includeMin, 
+                   int minPeaks, int charge, 
+                   SPEC_CONTAINER& returnedSpectra);
+
+    // not copyable
+    MappedLibrary(const MappedLibrary&);
+    MappedLibrary& operator=(const MappedLibrary&);
+};
+
+} // namespace
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
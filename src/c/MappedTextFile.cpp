@@ -0,0 +1,417 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+/*
+ * Implementation of the memory-mapped text reader and the line
+ * tokenizers that hand out slices of it.
+ */
+
+#include "MappedTextFile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#ifndef _MSC_VER
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace BiblioSpec {
+
+int TextSlice::find(const char* s, size_t from) const {
+    size_t len = strlen(s);
+    if( len == 0 ){
+        return (from <= length) ? (int)from : -1;
+    }
+    for(size_t i = from; i + len <= length; i++){
+        if( start[i] == s[0] && strncmp(start + i, s, len) == 0 ){
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+int TextSlice::find(char c, size_t from) const {
+    if( from >= length ){
+        return -1;
+    }
+    const char* found = (const char*)memchr(start + from, c, length - from);
+    return (found == NULL) ? -1 : (int)(found - start);
+}
+
+/**
+ * Remove blanks from either end of the slice.
+ */
+static TextSlice trimBlanks(const TextSlice& text){
+    const char* begin = text.start;
+    const char* end = text.end();
+    while( begin < end && (*begin == ' ' || *begin == '\t' || *begin == '\r')){
+        begin++;
+    }
+    while( end > begin && 
+           (*(end-1) == ' ' || *(end-1) == '\t' || *(end-1) == '\r') ){
+        end--;
+    }
+    return TextSlice(begin, end - begin);
+}
+
+bool parseInt(const TextSlice& text, int& value){
+    TextSlice trimmed = trimBlanks(text);
+    const char* cur = trimmed.start;
+    const char* end = trimmed.end();
+    if( cur == end ){
+        return false;
+    }
+
+    bool negative = false;
+    if( *cur == '-' || *cur == '+' ){
+        negative = (*cur == '-');
+        cur++;
+        if( cur == end ){
+            return false;
+        }
+    }
+
+    long long result = 0;
+    for(; cur < end; cur++){
+        if( *cur < '0' || *cur > '9' ){
+            return false;
+        }
+        result = result * 10 + (*cur - '0');
+        if( result > (long long)INT_MAX + 1 ){
+            return false;
+        }
+    }
+    if( negative ){
+        result = -result;
+    }
+    if( result > INT_MAX || result < INT_MIN ){
+        return false;
+    }
+    value = (int)result;
+    return true;
+}
+
+bool parseDouble(const TextSlice& text, double& value){
+    TextSlice trimmed = trimBlanks(text);
+    // the mapped text is not null-terminated, so copy the few
+    // characters of the number to the stack for strtod
+    char buffer[64];
+    if( trimmed.length == 0 || trimmed.length >= sizeof(buffer) ){
+        return false;
+    }
+    memcpy(buffer, trimmed.start, trimmed.length);
+    buffer[trimmed.length] = '\0';
+
+    char* parsedTo = NULL;
+    value = strtod(buffer, &parsedTo);
+    return parsedTo == buffer + trimmed.length;
+}
+
+MappedTextFile::MappedTextFile()
+  : data_(NULL), size_(0), pos_(0), lineNum_(0), isOpen_(false), 
+    buffer_(NULL)
+#ifdef _MSC_VER
+  , fileHandle_(INVALID_HANDLE_VALUE), mapHandle_(NULL)
+#else
+  , fd_(-1)
+#endif
+{
+}
+
+MappedTextFile::~MappedTextFile(){
+    close();
+}
+
+/**
+ * Map the whole file read-only.  Empty files have no mapping.  If
+ * the mapping cannot be made (e.g. not enough address space for a
+ * very large file on a 32-bit system) fall back to reading the file
+ * into a buffer.
+ */
+bool MappedTextFile::open(const char* filename, bool sequential){
+    close();
+
+#ifdef _MSC_VER
+    fileHandle_ = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, 
+                              sequential ? FILE_FLAG_SEQUENTIAL_SCAN 
+                                         : FILE_FLAG_RANDOM_ACCESS, 
+                              NULL);
+    if( fileHandle_ == INVALID_HANDLE_VALUE ){
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if( !GetFileSizeEx(fileHandle_, &fileSize) ){
+        close();
+        return false;
+    }
+    size_ = (size_t)fileSize.QuadPart;
+    if( size_ > 0 ){
+        mapHandle_ = CreateFileMapping(fileHandle_, NULL, PAGE_READONLY, 
+                                       0, 0, NULL);
+        if( mapHandle_ != NULL ){
+            data_ = (const char*)MapViewOfFile(mapHandle_, FILE_MAP_READ, 
+                                               0, 0, 0);
+        }
+    }
+#else
+    fd_ = ::open(filename, O_RDONLY);
+    if( fd_ < 0 ){
+        return false;
+    }
+    struct stat fileStat;
+    if( fstat(fd_, &fileStat) != 0 ){
+        close();
+        return false;
+    }
+    size_ = (size_t)fileStat.st_size;
+    if( size_ > 0 ){
+        void* mapped = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if( mapped != MAP_FAILED ){
+            data_ = (const char*)mapped;
+#ifdef MADV_SEQUENTIAL
+            if( sequential ){
+                madvise(mapped, size_, MADV_SEQUENTIAL);
+            }
+#endif
+        }
+    }
+#endif
+
+    if( size_ > 0 && data_ == NULL ){
+        if( !readWholeFile(filename) ){
+            close();
+            return false;
+        }
+    }
+
+    isOpen_ = true;
+    return true;
+}
+
+bool MappedTextFile::readWholeFile(const char* filename){
+    FILE* file = fopen(filename, "rb");
+    if( file == NULL ){
+        return false;
+    }
+    buffer_ = (char*)malloc(size_);
+    if( buffer_ == NULL ){
+        fclose(file);
+        return false;
+    }
+    size_ = fread(buffer_, 1, size_, file);
+    fclose(file);
+    data_ = buffer_;
+    return true;
+}
+
+void MappedTextFile::close(){
+    if( buffer_ != NULL ){
+        free(buffer_);
+        buffer_ = NULL;
+        data_ = NULL;
+    }
+#ifdef _MSC_VER
+    if( data_ != NULL ){
+        UnmapViewOfFile(data_);
+    }
+    if( mapHandle_ != NULL ){
+        CloseHandle(mapHandle_);
+        mapHandle_ = NULL;
+    }
+    if( fileHandle_ != INVALID_HANDLE_VALUE ){
+        CloseHandle(fileHandle_);
+        fileHandle_ = INVALID_HANDLE_VALUE;
+    }
+#else
+    if( data_ != NULL ){
+        munmap((void*)data_, size_);
+    }
+    if( fd_ >= 0 ){
+        ::close(fd_);
+        fd_ = -1;
+    }
+#endif
+    data_ = NULL;
+    size_ = 0;
+    pos_ = 0;
+    lineNum_ = 0;
+    isOpen_ = false;
+}
+
+bool MappedTextFile::nextLine(TextSlice& line){
+    if( pos_ >= size_ ){
+        return false;
+    }
+
+    const char* begin = data_ + pos_;
+    const char* newline = (const char*)memchr(begin, '\n', size_ - pos_);
+    size_t length = 0;
+    if( newline == NULL ){ // last line has no terminator
+        length = size_ - pos_;
+        pos_ = size_;
+    } else {
+        length = newline - begin;
+        pos_ += length + 1;
+    }
+    if( length > 0 && begin[length - 1] == '\r' ){
+        length--;
+    }
+
+    line.start = begin;
+    line.length = length;
+    lineNum_++;
+    return true;
+}
+
+FieldTokenizer::FieldTokenizer(const TextSlice& line, 
+                               const char* delims, 
+                               bool mergeDelims)
+  : pos_(line.start), end_(line.end()), delims_(delims), 
+    mergeDelims_(mergeDelims), done_(false)
+{
+}
+
+bool FieldTokenizer::next(TextSlice& field){
+    if( done_ ){
+        return false;
+    }
+    if( mergeDelims_ ){
+        while( pos_ < end_ && isDelim(*pos_) ){
+            pos_++;
+        }
+        if( pos_ == end_ ){
+            done_ = true;
+            return false;
+        }
+    }
+
+    const char* begin = pos_;
+    while( pos_ < end_ && !isDelim(*pos_) ){
+        pos_++;
+    }
+    field.start = begin;
+    field.length = pos_ - begin;
+
+    if( pos_ == end_ ){
+        done_ = true;
+    } else {
+        pos_++; // past the delimiter
+    }
+    return true;
+}
+
+int FieldTokenizer::nextFields(TextSlice* fields, int maxFields){
+    int count = 0;
+    while( count < maxFields && next(fields[count]) ){
+        count++;
+    }
+    return count;
+}
+
+CsvFieldTokenizer::CsvFieldTokenizer(const TextSlice& line)
+  : pos_(line.start), end_(line.end()), done_(false)
+{
+}
+
+bool CsvFieldTokenizer::next(TextSlice& field){
+    if( done_ ){
+        return false;
+    }
+
+    const char* begin = pos_;
+    bool copying = false; // true once the field needs unescaping
+    bool inQuote = false;
+    for(; pos_ < end_; pos_++){
+        char c = *pos_;
+        if( c == ',' && !inQuote ){
+            break;
+        }
+        if( c != '"' && c != '\\' ){
+            if( copying ){
+                unescaped_ += c;
+            }
+            continue;
+        }
+
+        // special character, switch to copying the field
+        if( !copying ){
+            unescaped_.assign(begin, pos_ - begin);
+            copying = true;
+        }
+        if( c == '"' ){
+            inQuote = !inQuote;
+        } else { // escape
+            pos_++;
+            if( pos_ == end_ ){
+                throw string("Unterminated escape sequence in csv field");
+            }
+            if( *pos_ == 'n' ){
+                unescaped_ += '\n';
+            } else if( *pos_ == '\\' || *pos_ == '"' ){
+                unescaped_ += *pos_;
+            } else {
+                throw string("Unknown escape sequence in csv field");
+            }
+        }
+    }
+    if( inQuote ){
+        throw string("Unterminated quote in csv field");
+    }
+
+    if( copying ){
+        field.start = unescaped_.data();
+        field.length = unescaped_.length();
+    } else {
+        field.start = begin;
+        field.length = pos_ - begin;
+    }
+
+    if( pos_ == end_ ){
+        done_ = true;
+    } else {
+        pos_++; // past the comma
+    }
+    return true;
+}
+
+} // namespace
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,209 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * A read-only view of a text file mapped into memory.  Lines and the
+ * fields within them are handed out as TextSlices that point directly
+ * into the mapping so that large result files can be tokenized
+ * without copying every line into a std::string.
+ */
+
+#include <string.h>
+#include <string>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#endif
+
+using namespace std;
+
+namespace BiblioSpec {
+
+/**
+ * A pointer and length into a buffer owned by someone else.  Not
+ * null-terminated.  Valid only as long as the owner of the buffer.
+ */
+struct TextSlice {
+    const char* start;
+    size_t length;
+
+    TextSlice() : start(NULL), length(0) {}
+    TextSlice(const char* s, size_t len) : start(s), length(len) {}
+
+    bool empty() const { return length == 0; }
+    const char* end() const { return start + length; }
+    char operator[](size_t i) const { return start[i]; }
+    string str() const { return string(start, length); }
+
+    /** \returns True if the slice holds exactly the given string. */
+    bool equals(const char* s) const {
+        return strlen(s) == length && strncmp(start, s, length) == 0;
+    }
+    bool startsWith(const char* s) const {
+        size_t len = strlen(s);
+        return len <= length && strncmp(start, s, len) == 0;
+    }
+    /** \returns Position of the first occurrence of s or -1. */
+    int find(const char* s, size_t from = 0) const;
+    int find(char c, size_t from = 0) const;
+
+    TextSlice substr(size_t from, size_t len = (size_t)-1) const {
+        if( from > length ){ from = length; }
+        if( len > length - from ){ len = length - from; }
+        return TextSlice(start + from, len);
+    }
+};
+
+/**
+ * Convert the whole slice to a number without allocating.  Leading
+ * and trailing blanks are ignored.  \returns False if the slice is
+ * empty or contains anything other than a single number.
+ */
+bool parseInt(const TextSlice& text, int& value);
+bool parseDouble(const TextSlice& text, double& value);
+
+class MappedTextFile {
+ public:
+    MappedTextFile();
+    ~MappedTextFile();
+
+    /**
+     * Map the file into memory.  Pass sequential=false if it will be
+     * read in random order rather than from start to end.  \returns
+     * False if it cannot be opened.
+     */
+    bool open(const char* filename, bool sequential = true);
+    void close();
+    bool isOpen() const { return isOpen_; }
+
+    /**
+     * Set line to the next line in the file, without its line
+     * terminator (\n or \r\n).  \returns False at end of file.
+     */
+    bool nextLine(TextSlice& line);
+
+    /**
+     * \returns The first character of the next line or '\0' at end
+     * of file.
+     */
+    char peek() const { return (pos_ < size_) ? data_[pos_] : '\0'; }
+    bool eof() const { return pos_ >= size_; }
+    /** \returns The 1-based number of the line last returned. */
+    int lineNumber() const { return lineNum_; }
+    size_t size() const { return size_; }
+    /** \returns The whole file, NULL if it is empty. */
+    const char* data() const { return data_; }
+
+ private:
+    const char* data_;
+    size_t size_;
+    size_t pos_;
+    int lineNum_;
+    bool isOpen_;
+    char* buffer_; // used instead of a mapping when mapping fails
+#ifdef _MSC_VER
+    HANDLE fileHandle_;
+    HANDLE mapHandle_;
+#else
+    int fd_;
+#endif
+
+    bool readWholeFile(const char* filename);
+
+    // not copyable
+    MappedTextFile(const MappedTextFile&);
+    MappedTextFile& operator=(const MappedTextFile&);
+};
+
+/**
+ * Splits a line into fields separated by any one of the given
+ * delimiter characters.  If mergeDelims is true, runs of delimiters
+ * are treated as one and leading delimiters are skipped, as with
+ * whitespace-separated formats.
+ */
+class FieldTokenizer {
+ public:
+    FieldTokenizer(const TextSlice& line, 
+                   const char* delims, 
+                   bool mergeDelims = false);
+
+    /** \returns False when there are no more fields. */
+    bool next(TextSlice& field);
+
+    /**
+     * Fill the array with up to maxFields of the remaining fields.
+     * \returns The number of fields found.
+     */
+    int nextFields(TextSlice* fields, int maxFields);
+
+ private:
+    const char* pos_;
+    const char* end_;
+    const char* delims_;
+    bool mergeDelims_;
+    bool done_;
+
+    bool isDelim(char c) const { return strchr(delims_, c) != NULL; }
+};
+
+/**
+ * Splits a comma-separated line in which fields may be quoted.
+ * Follows the rules of boost::escaped_list_separator: a field may be
+ * enclosed in double quotes, within which commas are literal, and a
+ * backslash escapes the following character.  Fields without escapes
+ * are returned as slices of the line; escaped fields are unescaped
+ * into a buffer held by the tokenizer and are valid until the next
+ * call to next().
+ */
+class CsvFieldTokenizer {
+ public:
+    CsvFieldTokenizer(const TextSlice& line);
+
+    /** \returns False when there are no more fields. */
+    bool next(TextSlice& field);
+
+ private:
+    const char* pos_;
+    const char* end_;
+    bool done_;
+    string unescaped_;
+};
+
+} // namespace
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -101,16 +101,13 @@ Match& Match::operator= (const Match& right)
 }
 */
 //setters
-/*
 void Match::setExpSpec(Spectrum* exp) {
-    localSpec= exp;
-    
+    localSpec_ = exp;
 }
 void Match::setRefSpec(RefSpectrum* ref)
 {
-    localRef = ref;
+    localRef_ = ref;
 }
-*/
 void Match::setScore(SCORE_TYPE type, double score){
     scores_[type] = score;
 }
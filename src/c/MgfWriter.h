@@ -0,0 +1,103 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * The MgfWriter is a class for printing spectra in Mascot generic
+ * format (.mgf).
+ */
+
+#include "SpecWriter.h"
+
+namespace BiblioSpec {
+
+class MgfWriter : public SpecWriter {
+ public:
+    MgfWriter(const ops::variables_map& options_table) :
+    SpecWriter(options_table)
+    {
+        Verbosity::comment(V_DETAIL, "Creating MgfWriter.");
+    };
+
+    /**
+     * Append one BEGIN IONS/END IONS block for the given spectrum.
+     */
+    virtual void formatSpectrum(const RefSpectrum& spec, bool, string& out){
+        string modSeq = spec.getMods();
+
+        out += "BEGIN IONS\nTITLE=";
+        out += modSeq;
+        out += '/';
+        appendInt(out, spec.getCharge());
+        out += " LibID=";
+        appendInt(out, spec.getLibSpecID());
+        out += "\nPEPMASS=";
+        appendFixed(out, spec.getMz(), PRECURSOR_PRECISION);
+        if( spec.getCharge() > 0 ){
+            out += "\nCHARGE=";
+            appendInt(out, spec.getCharge());
+            out += '+';
+        }
+        out += "\nSCANS=";
+        appendInt(out, spec.getLibSpecID());
+        out += "\nSEQ=";
+        out += spec.getSeq();
+        out += '\n';
+
+        const vector<PEAK_T>& peaks = spec.getRawPeaks(); 
+        for(int i = 0; i < (int)peaks.size(); i++){
+            appendFixed(out, peaks[i].mz, mzPrecision_);
+            out += ' ';
+            appendFixed(out, peaks[i].intensity, intensityPrecision_);
+            out += '\n';
+        }
+        out += "END IONS\n\n";
+    };
+
+ protected:
+    static const int PRECURSOR_PRECISION = 4;
+
+    virtual void formatLibName(const char* libName, string& out){
+        out += "# Library ";
+        out += libName;
+        out += "\n\n";
+    };
+};
+
+} // namespace BiblioSpec
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -35,111 +35,113 @@
  *  The Ms2Writer is a class for printing spectra in the .ms2 format
  */
 
-#include "Verbosity.h"
-#include "BlibUtils.h"
-#include "SpecFileReader.h"
-#include "RefSpectrum.h"
+#include "SpecWriter.h"
 #include "AminoAcidMasses.h"
-#include "boost/program_options.hpp"
-
-namespace ops = boost::program_options;
+#include <time.h>
 
 namespace BiblioSpec {
 
-class Ms2Writer {
+class Ms2Writer : public SpecWriter {
  public:
     Ms2Writer(const ops::variables_map& options_table) :
-    mzPrecision_(options_table["mz-precision"].as<int>()),
-    intensityPrecision_(options_table["intensity-precision"].as<int>())
+    SpecWriter(options_table),
+    peaksWritten_(false)
     {
         Verbosity::comment(BiblioSpec::V_DETAIL, 
                                        "Creating Ms2Writer.");
         AminoAcidMasses::initializeMass(masses_, 0);// average isotopic mass
     };
 
-    ~Ms2Writer(){
-        if( file_.is_open() ){
-            file_.close();
-        }
-    };
-
-    /** 
-     * Open the filename given and prepare to write to the file.
-     * Throw error if can't be opened.  Currently no check for file
-     * type or overwriting.
-     */ 
-    void openFile(const char* filename){
-        Verbosity::comment(BiblioSpec::V_DETAIL, 
-                           "Ms2Writer preparing file '%s'.",
-                           filename);
-        filename_ = filename;
-
-        file_.open(filename);
-
-        if( ! file_.is_open() ){
-            Verbosity::error("Cannot open ms2 file %s.", filename);
-        }
-
-        // write header
-        time_t t = time(NULL);
-        char* date = ctime(&t);
-        file_ << "H\tCreationDate\t" << date 
-              << "H\tExtractor\tBlibToMs2" << endl;
-    };
-    
     /**
-     * Write the name of the library to the file.
+     * \returns True if the S and Z line numbers of this spectrum are
+     * printed in fixed notation.  They were printed that way, with the
+     * intensity precision, once any peak was written because the
+     * precision was left set on the stream.  The format is kept for
+     * files that depend on it.
      */
-    void writeLibName(const char* libName){
-        if( ! file_.is_open() ){
-            Verbosity::error("Cannot write library name to un-open ms2 file.");
+    virtual bool startSpectrum(const RefSpectrum& spec){
+        bool fixedNumbers = peaksWritten_;
+        if( !spec.getRawPeaks().empty() ){
+            peaksWritten_ = true;
         }
+        return fixedNumbers;
+    };
 
-        file_ << "H\tComment\tLibrary\t" << libName << endl;
+    // assume that the spectra written before had peaks
+    virtual void continueFile(){
+        peaksWritten_ = true;
     };
 
     /**
-     * Write the given spectrum to file.
+     * Append the S, Z, D and peak lines for the given spectrum to out.
      */
-    bool writeSpectrum(const RefSpectrum& spec){
-
+    virtual void formatSpectrum(const RefSpectrum& spec, bool fixedNumbers,
+                                string& out){
         int id = spec.getLibSpecID();
         string modSeq = spec.getMods();
 
         // write S line
-        file_ << "S\t" << id
-              << "\t" << id
-              << "\t" << spec.getMz()
-              << endl;
+        out += "S\t";
+        appendInt(out, id);
+        out += '\t';
+        appendInt(out, id);
+        out += '\t';
+        appendHeaderNumber(out, spec.getMz(), fixedNumbers);
+        out += '\n';
 
         // write Z line
-        file_ << "Z\t" << spec.getCharge()
-              << "\t" << getPeptideMass(modSeq, masses_ )
-              << endl;
+        out += "Z\t";
+        appendInt(out, spec.getCharge());
+        out += '\t';
+        appendHeaderNumber(out, getPeptideMass(modSeq, masses_), 
+                           fixedNumbers);
+        out += '\n';
 
         // write D line (seq)
-        file_ << "D\tseq\t" << spec.getSeq() << endl;
-        file_ << "D\tmodified seq\t" << modSeq << endl;
+        out += "D\tseq\t";
+        out += spec.getSeq();
+        out += "\nD\tmodified seq\t";
+        out += modSeq;
+        out += '\n';
 
         // write peaks
         const vector<PEAK_T>& peaks = spec.getRawPeaks(); 
         for(int i = 0; i < (int)peaks.size(); i++){
-            file_.precision(mzPrecision_);
-            file_ << fixed << peaks[i].mz << "\t";
-            file_.precision(intensityPrecision_);
-            file_ << peaks[i].intensity << endl;
+            appendFixed(out, peaks[i].mz, mzPrecision_);
+            out += '\t';
+            appendFixed(out, peaks[i].intensity, intensityPrecision_);
+            out += '\n';
         }
+    };
 
-        return true;
+ protected:
+    virtual void formatHeader(string& out){
+        time_t t = time(NULL);
+        char* date = ctime(&t);
+        out += "H\tCreationDate\t";
+        out += date;
+        out += "H\tExtractor\tBlibToMs2\n";
+    };
+
+    virtual void formatLibName(const char* libName, string& out){
+        out += "H\tComment\tLibrary\t";
+        out += libName;
+        out += '\n';
     };
 
  private:
-    ofstream file_;
-    string filename_;
     double masses_[128];
-    int mzPrecision_;
-    int intensityPrecision_;
-
+    bool peaksWritten_; // true once a spectrum with peaks was started
+
+    void appendHeaderNumber(string& out, double value, bool fixedNumbers){
+        if( fixedNumbers ){
+            appendFixed(out, value, intensityPrecision_);
+        } else {
+            char number[64];
+            sprintf(number, "%g", value);
+            out += number;
+        }
+    };
 };
 
 } // namespace BiblioSpec
@@ -38,8 +38,6 @@
 #include <iostream>
 
 using namespace std;
-using namespace pwiz;
-using namespace mziddata;
 
 namespace BiblioSpec {
 
@@ -47,17 +45,21 @@ MzIdentMLReader::MzIdentMLReader
     (BlibBuilder& maker,
      const char* mzidFileName,
      const ProgressIndicator* const parent_progress)
-    : BuildParser(maker, mzidFileName, parent_progress)
+    : BuildParser(maker, mzidFileName, parent_progress),
+      state_(ROOT_STATE), curRank_(0), curIsDecoy_(false), 
+      curHasEvidence_(false)
 {
-    pwizReader_ = new pwiz::mziddata::MzIdentMLFile(mzidFileName);
-    list_iter_ = pwizReader_->dataCollection.analysisData.spectrumIdentificationList.begin();
-    list_end_ = pwizReader_->dataCollection.analysisData.spectrumIdentificationList.end();
-
+    this->setFileName(mzidFileName); // this is for the saxhandler
     lookUpBy_ = NAME_ID;
     scoreThreshold_ = getScoreThreshold(SCAFFOLD);
 }
 
-MzIdentMLReader::~MzIdentMLReader(){}
+MzIdentMLReader::~MzIdentMLReader(){
+    if( curPSM_ != NULL ){
+        delete curPSM_;
+        curPSM_ = NULL;
+    }
+}
     
 /**
  * Implementation of BuildParser virtual method.  Reads the .mzid file,
@@ -65,7 +67,13 @@ MzIdentMLReader::~MzIdentMLReader(){}
  */
 bool MzIdentMLReader::parseFile(){
     Verbosity::debug("Reading psms from the file.");
-    collectPsms();
+    if( ! parse() ){
+        return false;
+    }
+
+    // peptides are no longer needed
+    peptides_.clear();
+    decoyEvidence_.clear();
     
     // for each file
     if( fileMap_.size() > 1 ){
@@ -79,6 +87,7 @@ bool MzIdentMLReader::parseFile(){
 
         // move from map to psms_
         psms_ = fileIterator->second;
+        fileIterator->second.clear();
         buildTables(SCAFFOLD_SOMETHING);
     }
 
@@ -86,71 +95,249 @@ bool MzIdentMLReader::parseFile(){
 }
 
 /**
- *  Read through the whole file to find all PSMs.  Save those that
- *  pass the score threshold and are not decoys.  Nested data
- *  structure is
- *  SpectrumIdentificationList -- lists of spectra, one list per file
- *     SpectrumIdentificationResult -- the spectra in each list
- *         SpectrumIdenficiationItem -- specific peptide match to the spec
- *             PeptideEvidence -- one for each prot in which pep is found
+ * Save the parts of the document needed for PSMs.  The nesting is
+ * SequenceCollection
+ *     Peptide -- sequence and Modifications, referenced by items
+ *     PeptideEvidence -- (1.1) referenced by items, may be a decoy
+ * DataCollection
+ *   Inputs
+ *     SpectraData -- location of a spectrum file
+ *   AnalysisData
+ *     SpectrumIdentificationList -- lists of spectra
+ *       SpectrumIdentificationResult -- one spectrum in one file
+ *         SpectrumIdentificationItem -- specific peptide match to the spec
+ *           PeptideEvidence(Ref) -- one for each prot in which pep is found
  */
-void MzIdentMLReader::collectPsms(){
-    // 1 SpectrumIdentificationList = 1 .MGF file
-    for(; list_iter_ != list_end_; ++list_iter_){
-        
-        // 1 SpectrumIdentifiationResult = 1 spectrum
-        for(result_iter_ = (**list_iter_).spectrumIdentificationResult.begin(); 
-            result_iter_ != (**list_iter_).spectrumIdentificationResult.end();
-            ++result_iter_)
-        {
-            SpectrumIdentificationResult& result = **result_iter_;
-            string idStr = result.spectrumID;
-            string filename = result.spectraDataPtr->location;
-            
-            // 1 SpectrumIdentificationItem = 1 psm
-            for(item_iter_ = result.spectrumIdentificationItem.begin(); 
-                item_iter_ != result.spectrumIdentificationItem.end();
-                ++item_iter_)
-            {
-                SpectrumIdentificationItem& item = **item_iter_;
-
-                // only include top-ranked PSMs, skip decoys
-                if( item.rank != 1 || item.peptideEvidence.front()->isDecoy ){ 
-                    continue; 
-                }
+void MzIdentMLReader::startElement(const XML_Char* name, 
+                                   const XML_Char** attr){
+    switch(state_){
+    case ROOT_STATE:
+        if( isElement("Peptide", name) ){
+            parsePeptide(attr);
+        } else if( isElement("PeptideEvidence", name) ){
+            if( isTrue(getAttrValue("isDecoy", attr)) ){
+                decoyEvidence_.insert(getRequiredAttrValue("id", attr));
+            }
+        } else if( isElement("SpectraData", name) ){
+            spectraDataFiles_[getRequiredAttrValue("id", attr)] = 
+                getRequiredAttrValue("location", attr);
+        } else if( isElement("SpectrumIdentificationResult", name) ){
+            parseResult(attr);
+        }
+        break;
 
-                // skip if it doesn't pass score threshold
-                double score = getScore(item);
-                if( score < scoreThreshold_ ){
-                    continue;
-                }
+    case PEPTIDE_STATE:
+        if( isElement("PeptideSequence", name) || 
+            isElement("peptideSequence", name) ){
+            state_ = PEPTIDE_SEQ_STATE;
+        } else if( isElement("Modification", name) ){
+            parsePeptideMod(attr);
+        }
+        break;
 
-                // now get the psm info
-                curPSM_ = new PSM();
-                curPSM_->specName = idStr;
-                curPSM_->score = score;
-                curPSM_->charge = item.chargeState;
-                extractModifications(item.peptidePtr->id, curPSM_);
-                
-                // add the psm to the map
-                Verbosity::comment(V_DETAIL, "For file %s adding PSM: "
-                                   "scan '%s', charge %d, sequence '%s'.",
-                                   filename.c_str(), curPSM_->specName.c_str(),
-                                   curPSM_->charge, curPSM_->unmodSeq.c_str());
-                map<string, vector<PSM*> >::iterator mapAccess = 
-                    fileMap_.find(filename);
-                if( mapAccess == fileMap_.end() ){ // not found, add the file
-                    vector<PSM*> tmpPsms(1, curPSM_);
-                    fileMap_[filename] = tmpPsms;
-                } else {  // add this psm to existing file entry
-                    (mapAccess->second).push_back(curPSM_);
+    case RESULT_STATE:
+        if( isElement("SpectrumIdentificationItem", name) ){
+            parseItem(attr);
+        }
+        break;
+
+    case ITEM_STATE:
+        if( isElement("PeptideEvidence", name) ){ // version 1.0
+            state_ = ITEM_EVIDENCE_STATE;
+            parseItemEvidence(isTrue(getAttrValue("isDecoy", attr)));
+        } else if( isElement("PeptideEvidenceRef", name) ){ // version 1.1
+            string ref = getRequiredAttrValue("peptideEvidence_ref", attr);
+            parseItemEvidence(decoyEvidence_.find(ref) 
+                              != decoyEvidence_.end());
+        } else if( isElement("cvParam", name) ){
+            parseItemCvParam(attr);
+        }
+        break;
+
+    case PEPTIDE_SEQ_STATE:
+    case ITEM_EVIDENCE_STATE:
+        break;
+    }
+}
+
+void MzIdentMLReader::endElement(const XML_Char* name){
+    switch(state_){
+    case PEPTIDE_SEQ_STATE:
+        if( isElement("PeptideSequence", name) || 
+            isElement("peptideSequence", name) ){
+            state_ = PEPTIDE_STATE;
+        }
+        break;
+
+    case PEPTIDE_STATE:
+        if( isElement("Peptide", name) ){
+            int lastResidue = (int)curPeptide_.unmodSeq.size();
+            for(size_t i = 0; i < curPeptide_.mods.size(); i++){
+                if( curPeptide_.mods[i].position > lastResidue ){
+                    curPeptide_.mods[i].position = lastResidue;
                 }
-                curPSM_ = NULL;
-            } // next item (PSM)
-        } // next result (spectrum)
-    } // next list (file)
+            }
+            peptides_[curPeptideId_] = curPeptide_;
+            state_ = ROOT_STATE;
+        }
+        break;
+
+    case ITEM_EVIDENCE_STATE:
+        if( isElement("PeptideEvidence", name) ){
+            state_ = ITEM_STATE;
+        }
+        break;
+
+    case ITEM_STATE:
+        if( isElement("SpectrumIdentificationItem", name) ){
+            saveItem();
+            state_ = RESULT_STATE;
+        }
+        break;
+
+    case RESULT_STATE:
+        if( isElement("SpectrumIdentificationResult", name) ){
+            state_ = ROOT_STATE;
+        }
+        break;
+
+    case ROOT_STATE:
+        break;
+    }
+}
+
+void MzIdentMLReader::characters(const XML_Char *s, int len){
+    if( state_ == PEPTIDE_SEQ_STATE ){
+        for(int i = 0; i < len; i++){
+            if( s[i] >= 'A' && s[i] <= 'Z' ){
+                curPeptide_.unmodSeq += s[i];
+            }
+        }
+    }
+}
+
+/**
+ * \returns True if the value is an xsd:boolean true, "true" or "1".
+ */
+bool MzIdentMLReader::isTrue(const char* value){
+    return strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+}
+
+/**
+ * Version 1.0 capitalizes the first letter of reference attributes
+ * (e.g. Peptide_ref), version 1.1 does not (peptide_ref).  Return the
+ * value of either form.
+ */
+const char* MzIdentMLReader::getRefAttrValue(const char* name, 
+                                             const XML_Char** attr){
+    const char* value = getAttrValue(name, attr);
+    if( strcmp(value, "") != 0 ){
+        return value;
+    }
+    string upperName = name;
+    upperName[0] = toupper(upperName[0]);
+    return getRequiredAttrValue(upperName.c_str(), attr);
+}
+
+void MzIdentMLReader::parsePeptide(const XML_Char** attr){
+    state_ = PEPTIDE_STATE;
+    curPeptideId_ = getRequiredAttrValue("id", attr);
+    curPeptide_.unmodSeq.clear();
+    curPeptide_.mods.clear();
+}
+
+/**
+ * Add a modification to the current peptide.  Locations are 1-based
+ * with 0 being the n-terminus, the same as a SeqMod position.  A
+ * modification without a location is put on the n-terminus.
+ * C-terminal ones (length + 1) are moved to the last residue when the
+ * peptide ends.
+ */
+void MzIdentMLReader::parsePeptideMod(const XML_Char** attr){
+    int location = 0;
+    if( strcmp(getAttrValue("location", attr), "") != 0 ){
+        location = getIntRequiredAttrValue("location", attr);
+    }
+    const char* massStr = getAttrValue("monoisotopicMassDelta", attr);
+    if( strcmp(massStr, "") == 0 ){
+        massStr = getRequiredAttrValue("avgMassDelta", attr);
+    }
+    curPeptide_.mods.push_back(SeqMod(location, atof(massStr)));
+}
+
+void MzIdentMLReader::parseResult(const XML_Char** attr){
+    state_ = RESULT_STATE;
+    curSpecId_ = getRequiredAttrValue("spectrumID", attr);
+    string dataRef = getRefAttrValue("spectraData_ref", attr);
+    map<string, string>::iterator found = spectraDataFiles_.find(dataRef);
+    if( found == spectraDataFiles_.end() ){
+        throw BlibException(false, "The spectrum '%s' references unknown "
+                            "SpectraData '%s'.", curSpecId_.c_str(), 
+                            dataRef.c_str());
+    }
+    curFile_ = found->second;
+}
+
+void MzIdentMLReader::parseItem(const XML_Char** attr){
+    state_ = ITEM_STATE;
+    curRank_ = getIntRequiredAttrValue("rank", attr);
+    curIsDecoy_ = false;
+    curHasEvidence_ = false;
+    curPeptideRef_ = getRefAttrValue("peptide_ref", attr);
+
+    curPSM_ = new PSM();
+    curPSM_->specName = curSpecId_;
+    curPSM_->charge = getIntRequiredAttrValue("chargeState", attr);
+}
+
+void MzIdentMLReader::parseItemEvidence(bool isDecoy){
+    if( ! curHasEvidence_ ){
+        curIsDecoy_ = isDecoy;
+        curHasEvidence_ = true;
+    }
 }
 
+/**
+ * Look for the peptide probability among the CVParams of the item.
+ */
+void MzIdentMLReader::parseItemCvParam(const XML_Char** attr){
+    const char* accession = getAttrValue("accession", attr);
+    const char* name = getAttrValue("name", attr);
+    if( strcmp(accession, "MS:1001568") == 0 ||
+        strcmp(name, "Scaffold: Peptide Probability") == 0 ||
+        strcmp(name, "Scaffold:Peptide Probability") == 0 ){
+        curPSM_->score = atof(getRequiredAttrValue("value", attr));
+    }
+}
+
+/**
+ * At the end of an item, keep the PSM if it is top-ranked, not a
+ * decoy and passes the score threshold.
+ */
+void MzIdentMLReader::saveItem(){
+    if( curRank_ != 1 || curIsDecoy_ || curPSM_->score < scoreThreshold_ ){
+        delete curPSM_;
+        curPSM_ = NULL;
+        return;
+    }
+
+    map<string, PeptideInfo>::iterator peptide = peptides_.find(curPeptideRef_);
+    if( peptide != peptides_.end() && !peptide->second.unmodSeq.empty() ){
+        curPSM_->unmodSeq = peptide->second.unmodSeq;
+        curPSM_->mods = peptide->second.mods;
+    } else {
+        // Scaffold ids are the sequence with the mod masses
+        extractModifications(curPeptideRef_, curPSM_);
+    }
+
+    // add the psm to the map
+    Verbosity::comment(V_DETAIL, "For file %s adding PSM: "
+                       "scan '%s', charge %d, sequence '%s'.",
+                       curFile_.c_str(), curPSM_->specName.c_str(),
+                       curPSM_->charge, curPSM_->unmodSeq.c_str());
+    fileMap_[curFile_].push_back(curPSM_);
+    curPSM_ = NULL;
+}
 
 /**
  * Using the modified peptide sequence, with modifications of the form
@@ -175,25 +362,6 @@ void MzIdentMLReader::extractModifications(string modPepSeq, PSM* psm){
     psm->unmodSeq = modPepSeq;
 }
 
-/**
- * Look through the CVParams of the item and return the score for the
- * peptide probability.
- */
-double MzIdentMLReader::getScore(const SpectrumIdentificationItem& item){
-    // get parameters for this item
-    ParamContainer pc = item.paramGroup;
-    // look through all to find the probability
-    for (vector<CVParam>::const_iterator it=pc.cvParams.begin(); 
-         it!=pc.cvParams.end(); ++it){
-        string name = cvTermInfo((*it).cvid).name;
-        if( name == "Scaffold: Peptide Probability" ){
-            return boost::lexical_cast<double>(it->value);
-        }
-    }
-
-    return 0; // shouldn't get to here, warning?
-}
-
 } // namespace
 
 
@@ -33,12 +33,15 @@
 
 #include "BuildParser.h"
 #include "Verbosity.h"
-#include "pwiz/data/mziddata/MzIdentMLFile.hpp"
+#include <set>
 
 namespace BiblioSpec{
     
     /**
-     * Class for parsing mzIdentML files.
+     * Class for parsing mzIdentML files.  The file is read with the
+     * SAX handler so that only the peptides, the spectra data
+     * locations and the identification items that pass the score
+     * threshold are held in memory.
      */
     class MzIdentMLReader : public BuildParser {
         
@@ -49,22 +52,50 @@ namespace BiblioSpec{
         ~MzIdentMLReader();
         
         bool parseFile();
+        virtual void startElement(const XML_Char* name, const XML_Char** attr);
+        virtual void endElement(const XML_Char* name);
+        virtual void characters(const XML_Char *s, int len);
         
     private:
-        pwiz::mziddata::MzIdentMLFile* pwizReader_;
+        enum STATE { ROOT_STATE, 
+                     PEPTIDE_STATE,        // in a Peptide element
+                     PEPTIDE_SEQ_STATE,    // in its PeptideSequence
+                     RESULT_STATE,         // SpectrumIdentificationResult
+                     ITEM_STATE,           // SpectrumIdentificationItem
+                     ITEM_EVIDENCE_STATE   // PeptideEvidence within an item
+        };
+
+        struct PeptideInfo {
+            string unmodSeq;
+            vector<SeqMod> mods;
+        };
+
         map< string, vector<PSM*> > fileMap_; // vector of PSMs for each file
         double scoreThreshold_;
+        STATE state_;
 
-        // name some file accessors to make the code more readable
-        vector<pwiz::mziddata::SpectrumIdentificationListPtr>::const_iterator list_iter_;
-        vector<pwiz::mziddata::SpectrumIdentificationListPtr>::const_iterator list_end_;
-        vector<pwiz::mziddata::SpectrumIdentificationResultPtr>::const_iterator result_iter_;
-        vector<pwiz::mziddata::SpectrumIdentificationItemPtr>::const_iterator item_iter_;
-
+        map<string, PeptideInfo> peptides_;   // key = Peptide id
+        map<string, string> spectraDataFiles_; // SpectraData id to location
+        set<string> decoyEvidence_;           // ids of decoy PeptideEvidence
+        string curPeptideId_;
+        PeptideInfo curPeptide_;
+        string curSpecId_;    // spectrumID of the current result
+        string curFile_;      // spectrum file of the current result
+        int curRank_;
+        bool curIsDecoy_;
+        bool curHasEvidence_; // only the first evidence decides decoy status
+        string curPeptideRef_;
 
-        void collectPsms();
+        void parsePeptide(const XML_Char** attr);
+        void parsePeptideMod(const XML_Char** attr);
+        void parseResult(const XML_Char** attr);
+        void parseItem(const XML_Char** attr);
+        void parseItemEvidence(bool isDecoy);
+        void parseItemCvParam(const XML_Char** attr);
+        void saveItem();
         void extractModifications(string modPepSeq, PSM* psm);
-        double getScore(const pwiz::mziddata::SpectrumIdentificationItem& item);
+        const char* getRefAttrValue(const char* name, const XML_Char** attr);
+        static bool isTrue(const char* value);
     };
 } // namespace
 
@@ -0,0 +1,549 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+/**
+ * Peak array codecs for library storage.  See PeakCodec.h for how a
+ * blob's codec is recognized.
+ *
+ * Delta codec blobs are laid out as
+ *   tag, flags, codec parameters, payload
+ * where the payload is one varint per peak.  When FLAG_DEFLATED is set
+ * the payload is preceded by its uncompressed length and compressed
+ * with zlib.
+ */
+
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "zlib.h"
+#include "PeakCodec.h"
+#include "Verbosity.h"
+
+namespace BiblioSpec {
+
+static const unsigned char FLAG_LOSSLESS = 0x01;
+static const unsigned char FLAG_DEFLATED = 0x02;
+
+// the deflate stage is skipped for payloads too small to gain from it
+// and kept only if it saves an eighth, since it slows decoding down
+static const size_t MIN_DEFLATE_PAYLOAD = 64;
+
+// intensities more than 2^MAX_INTENSITY_LOG2 below the most intense
+// peak are stored as that and read back as zero
+static const int MAX_INTENSITY_LOG2 = 2000;
+
+/**
+ * 2^(-i / 2^INTENSITY_LOG_BITS) for the fractional part of each
+ * intensity code and 2^-i for the integer part, filled in before
+ * main().
+ */
+static const int MAX_TABLE_EXPONENT = 64;
+static struct IntensityScaleTable {
+    double scale[1 << INTENSITY_LOG_BITS];
+    double power[MAX_TABLE_EXPONENT];
+    IntensityScaleTable(){
+        for(int i = 0; i < (1 << INTENSITY_LOG_BITS); i++){
+            scale[i] = pow(2.0, -(double)i / (1 << INTENSITY_LOG_BITS));
+        }
+        for(int i = 0; i < MAX_TABLE_EXPONENT; i++){
+            power[i] = ldexp(1.0, -i);
+        }
+    }
+} intensityScales;
+
+/**
+ * Set the codec from its command-line name: zlib, delta or
+ * delta-lossless.
+ * \returns False if the name is not recognized.
+ */
+bool stringToPeakCodec(const char* name, PEAK_CODEC& codec){
+    if( strcmp(name, "zlib") == 0 ){
+        codec = ZLIB_PEAK_CODEC;
+    } else if( strcmp(name, "delta") == 0 ){
+        codec = DELTA_PEAK_CODEC;
+    } else if( strcmp(name, "delta-lossless") == 0 ){
+        codec = DELTA_LOSSLESS_PEAK_CODEC;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void putVarint(vector<unsigned char>& out, unsigned long long value){
+    while( value >= 0x80 ){
+        out.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((unsigned char)value);
+}
+
+static unsigned long long zigzag(long long value){
+    return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+static long long unzigzag(unsigned long long value){
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+/**
+ * Read one varint, advancing pos.
+ * \returns False if the varint runs past end.
+ */
+static inline bool getVarint(const unsigned char*& pos, 
+                             const unsigned char* end,
+                             unsigned long long& value){
+    value = 0;
+    for(int shift = 0; pos < end && shift < 64; shift += 7){
+        unsigned char byte = *pos++;
+        value |= (unsigned long long)(byte & 0x7F) << shift;
+        if( (byte & 0x80) == 0 ){
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Store the raw array in the blob, compressed with zlib if
+ * levelCompress is above zero and compression makes it smaller.  As
+ * always for this codec, any level above zero uses zlib's default.
+ */
+static void encodeZlib(int levelCompress, const void* values, uLong size,
+                       vector<unsigned char>& blob){
+    const Bytef* raw = (const Bytef*)values;
+    if( levelCompress > 0 && size > 0 ){
+        uLong comprLen = compressBound(size);
+        blob.resize(comprLen);
+        int err = compress(&blob[0], &comprLen, raw, size);
+        if( err == Z_OK && comprLen < size ){
+            blob.resize(comprLen);
+            return;
+        }
+    }
+    blob.assign(raw, raw + size);
+}
+
+/**
+ * Finish a delta codec blob that holds the header so far by appending
+ * the payload, deflated if that helps.  Falls back to the raw array
+ * when the result would not be smaller, which also keeps its length
+ * from being mistaken for a raw array.
+ */
+static void finishDeltaBlob(int levelCompress, 
+                            const vector<unsigned char>& payload,
+                            const void* values, uLong rawSize,
+                            vector<unsigned char>& blob){
+    if( levelCompress > 0 && payload.size() >= MIN_DEFLATE_PAYLOAD ){
+        vector<unsigned char> deflated(compressBound(payload.size()));
+        uLong deflatedLen = deflated.size();
+        int err = compress2(&deflated[0], &deflatedLen, &payload[0], 
+                            payload.size(), levelCompress);
+        if( err == Z_OK && deflatedLen < payload.size() - payload.size()/8 ){
+            blob[1] |= FLAG_DEFLATED;
+            putVarint(blob, payload.size());
+            blob.insert(blob.end(), deflated.begin(), 
+                        deflated.begin() + deflatedLen);
+        }
+    }
+    if( (blob[1] & FLAG_DEFLATED) == 0 ){
+        blob.insert(blob.end(), payload.begin(), payload.end());
+    }
+
+    if( blob.size() >= rawSize ){
+        const unsigned char* raw = (const unsigned char*)values;
+        blob.assign(raw, raw + rawSize);
+    }
+}
+
+void encodePeakMzs(PEAK_CODEC codec, int levelCompress, int numPeaks,
+                   const double* mzs, vector<unsigned char>& blob){
+    uLong rawSize = (uLong)numPeaks * sizeof(double);
+    blob.clear();
+    if( codec == ZLIB_PEAK_CODEC ){
+        encodeZlib(levelCompress, mzs, rawSize, blob);
+        return;
+    }
+
+    bool lossless = (codec == DELTA_LOSSLESS_PEAK_CODEC);
+    blob.push_back(PEAK_CODEC_TAG);
+    blob.push_back(lossless ? FLAG_LOSSLESS : 0);
+    if( !lossless ){
+        int scale = MZ_FIXED_POINT_SCALE;
+        unsigned char scaleBytes[sizeof(int)];
+        memcpy(scaleBytes, &scale, sizeof(int));
+        blob.insert(blob.end(), scaleBytes, scaleBytes + sizeof(int));
+    }
+
+    vector<unsigned char> payload;
+    payload.reserve(numPeaks * 3);
+    long long last = 0;
+    for(int i = 0; i < numPeaks; i++){
+        long long value;
+        if( lossless ){
+            memcpy(&value, mzs + i, sizeof(value));
+        } else {
+            value = (long long)floor(mzs[i] * MZ_FIXED_POINT_SCALE + 0.5);
+        }
+        // wraps for the bit patterns of values of different signs
+        putVarint(payload, 
+                  zigzag((long long)((unsigned long long)value - last)));
+        last = value;
+    }
+    finishDeltaBlob(levelCompress, payload, mzs, rawSize, blob);
+}
+
+void encodePeakIntensities(PEAK_CODEC codec, int levelCompress, 
+                           int numPeaks, const float* intensities,
+                           vector<unsigned char>& blob){
+    uLong rawSize = (uLong)numPeaks * sizeof(float);
+    blob.clear();
+    if( codec == ZLIB_PEAK_CODEC ){
+        encodeZlib(levelCompress, intensities, rawSize, blob);
+        return;
+    }
+
+    // the log scale holds only finite, non-negative intensities
+    bool lossless = (codec == DELTA_LOSSLESS_PEAK_CODEC);
+    for(int i = 0; i < numPeaks && ! lossless; i++){
+        if( ! (intensities[i] >= 0 && intensities[i] <= FLT_MAX) ){
+            Verbosity::warn("Storing a spectrum's peak intensities "
+                            "losslessly because intensity %g cannot be "
+                            "log-scaled.", intensities[i]);
+            lossless = true;
+        }
+    }
+    blob.push_back(PEAK_CODEC_TAG);
+    blob.push_back(lossless ? FLAG_LOSSLESS : 0);
+
+    vector<unsigned char> payload;
+    payload.reserve(numPeaks * 2);
+    if( lossless ){
+        int last = 0;
+        for(int i = 0; i < numPeaks; i++){
+            int value;
+            memcpy(&value, intensities + i, sizeof(value));
+            int delta = (int)((unsigned int)value - (unsigned int)last);
+            putVarint(payload, zigzag(delta));
+            last = value;
+        }
+    } else {
+        // intensities are stored relative to the most intense peak, 
+        // code 0 for zero and 1 + n for max * 2^(-n / 2^bits)
+        float maxIntensity = 0;
+        for(int i = 0; i < numPeaks; i++){
+            if( intensities[i] > maxIntensity ){
+                maxIntensity = intensities[i];
+            }
+        }
+        unsigned char maxBytes[sizeof(float)];
+        memcpy(maxBytes, &maxIntensity, sizeof(float));
+        blob.insert(blob.end(), maxBytes, maxBytes + sizeof(float));
+        blob.push_back((unsigned char)INTENSITY_LOG_BITS);
+
+        double steps = 1 << INTENSITY_LOG_BITS;
+        for(int i = 0; i < numPeaks; i++){
+            unsigned long long code = 0;
+            if( intensities[i] > 0 ){
+                double log2Ratio = log((double)maxIntensity / intensities[i])
+                    / log(2.0);
+                if( log2Ratio > MAX_INTENSITY_LOG2 ){
+                    log2Ratio = MAX_INTENSITY_LOG2;
+                }
+                code = 1 + (unsigned long long)floor(log2Ratio * steps + 0.5);
+            }
+            putVarint(payload, code);
+        }
+    }
+    finishDeltaBlob(levelCompress, payload, intensities, rawSize, blob);
+}
+
+/**
+ * Read the header of a delta codec blob and find its payload,
+ * inflating it into the given buffer if it was deflated.  params is
+ * left pointing at the codec parameters.
+ * \returns False if the blob is not a valid delta codec blob.
+ */
+static bool openDeltaBlob(const unsigned char* blob, int blobLen,
+                          size_t paramsLen, unsigned char& flags, 
+                          const unsigned char*& params,
+                          const unsigned char*& payload, 
+                          const unsigned char*& payloadEnd,
+                          vector<unsigned char>& inflated){
+    if( blobLen < 2 || blob[0] != PEAK_CODEC_TAG ){
+        return false;
+    }
+    flags = blob[1];
+    const unsigned char* pos = blob + 2;
+    const unsigned char* end = blob + blobLen;
+    params = pos;
+    if( (size_t)(end - pos) < paramsLen ){
+        return false;
+    }
+    pos += paramsLen;
+
+    if( flags & FLAG_DEFLATED ){
+        unsigned long long inflatedLen;
+        if( !getVarint(pos, end, inflatedLen) ){
+            return false;
+        }
+        inflated.resize((size_t)inflatedLen);
+        uLongf destLen = (uLongf)inflatedLen;
+        if( inflatedLen == 0 ||
+            uncompress(&inflated[0], &destLen, pos, end - pos) != Z_OK ||
+            destLen != inflatedLen ){
+            return false;
+        }
+        payload = &inflated[0];
+        payloadEnd = payload + destLen;
+    } else {
+        payload = pos;
+        payloadEnd = end;
+    }
+    return true;
+}
+
+/**
+ * Read a raw or zlib-compressed array of the given size.
+ */
+static bool decodeZlib(const unsigned char* blob, int blobLen,
+                       void* values, uLong size){
+    if( (uLong)blobLen == size ){
+        memcpy(values, blob, size);
+        return true;
+    }
+    uLongf destLen = size;
+    return uncompress((Bytef*)values, &destLen, blob, blobLen) == Z_OK &&
+        destLen == size;
+}
+
+/**
+ * Decode the m/z blob of a spectrum with numPeaks peaks into mzs,
+ * whatever codec wrote it.
+ * \returns False if the blob could not be decoded.
+ */
+bool decodePeakMzs(int numPeaks, const unsigned char* blob, int blobLen,
+                   double* mzs){
+    uLong rawSize = (uLong)numPeaks * sizeof(double);
+    if( (uLong)blobLen == rawSize || blobLen < 1 || 
+        blob[0] != PEAK_CODEC_TAG ){
+        return decodeZlib(blob, blobLen, mzs, rawSize);
+    }
+
+    unsigned char flags = (blobLen > 1) ? blob[1] : 0;
+    size_t paramsLen = (flags & FLAG_LOSSLESS) ? 0 : sizeof(int);
+    const unsigned char *params, *pos, *end;
+    vector<unsigned char> inflated;
+    if( !openDeltaBlob(blob, blobLen, paramsLen, flags, params, pos, end, 
+                       inflated) ){
+        return false;
+    }
+    int scale = 1;
+    if( !(flags & FLAG_LOSSLESS) ){
+        memcpy(&scale, params, sizeof(int));
+        if( scale <= 0 ){
+            return false;
+        }
+    }
+
+    long long last = 0;
+    for(int i = 0; i < numPeaks; i++){
+        unsigned long long code;
+        if( !getVarint(pos, end, code) ){
+            return false;
+        }
+        last = (long long)((unsigned long long)last + 
+                           (unsigned long long)unzigzag(code));
+        if( flags & FLAG_LOSSLESS ){
+            memcpy(mzs + i, &last, sizeof(double));
+        } else {
+            mzs[i] = (double)last / scale;
+        }
+    }
+    return true;
+}
+
+/**
+ * Decode the intensity blob of a spectrum with numPeaks peaks into
+ * intensities, whatever codec wrote it.
+ * \returns False if the blob could not be decoded.
+ */
+bool decodePeakIntensities(int numPeaks, const unsigned char* blob, 
+                           int blobLen, float* intensities){
+    uLong rawSize = (uLong)numPeaks * sizeof(float);
+    if( (uLong)blobLen == rawSize || blobLen < 1 || 
+        blob[0] != PEAK_CODEC_TAG ){
+        return decodeZlib(blob, blobLen, intensities, rawSize);
+    }
+
+    unsigned char flags = (blobLen > 1) ? blob[1] : 0;
+    size_t paramsLen = (flags & FLAG_LOSSLESS) ? 0 : sizeof(float) + 1;
+    const unsigned char *params, *pos, *end;
+    vector<unsigned char> inflated;
+    if( !openDeltaBlob(blob, blobLen, paramsLen, flags, params, pos, end, 
+                       inflated) ){
+        return false;
+    }
+
+    if( flags & FLAG_LOSSLESS ){
+        int last = 0;
+        for(int i = 0; i < numPeaks; i++){
+            unsigned long long code;
+            if( !getVarint(pos, end, code) ){
+                return false;
+            }
+            last = (int)((unsigned int)last + (unsigned int)unzigzag(code));
+            memcpy(intensities + i, &last, sizeof(float));
+        }
+        return true;
+    }
+
+    float maxIntensity;
+    memcpy(&maxIntensity, params, sizeof(float));
+    int bits = params[sizeof(float)];
+    if( bits > 30 ){
+        return false;
+    }
+    for(int i = 0; i < numPeaks; i++){
+        unsigned long long code;
+        if( !getVarint(pos, end, code) ){
+            return false;
+        }
+        if( code == 0 ){
+            intensities[i] = 0;
+            continue;
+        }
+        unsigned long long n = code - 1;
+        unsigned long long exponent = n >> bits;
+        double scale;
+        if( bits == INTENSITY_LOG_BITS ){
+            scale = intensityScales.scale[n & ((1 << bits) - 1)];
+        } else {
+            scale = pow(2.0, -(double)(n & ((1 << bits) - 1)) / (1 << bits));
+        }
+        if( exponent < (unsigned long long)MAX_TABLE_EXPONENT ){
+            scale *= intensityScales.power[exponent];
+        } else {
+            scale = ldexp(scale, 
+                          exponent > (unsigned long long)MAX_INTENSITY_LOG2 ?
+                          -MAX_INTENSITY_LOG2 : -(int)exponent);
+        }
+        intensities[i] = (float)(maxIntensity * scale);
+    }
+    return true;
+}
+
+PeakDecoder::PeakDecoder()
+: numPeaks_(0), mzs_(NULL), intensities_(NULL)
+{
+}
+
+/**
+ * Decode the m/z and intensity blobs of a spectrum with numPeaks
+ * peaks.  With checkPeaks, also reject peaks with values that are not
+ * numbers, negative or m/z values above 100000, as a library with
+ * corrupted peaks might have.
+ * \returns False if the blobs could not be decoded or failed the
+ * check, leaving no peaks.
+ */
+bool PeakDecoder::decode(int numPeaks, const void* mzBlob, int mzLen,
+                         const void* intensityBlob, int intensityLen,
+                         bool checkPeaks){
+    numPeaks_ = 0;
+    mzs_ = NULL;
+    intensities_ = NULL;
+    if( numPeaks <= 0 ){
+        return numPeaks == 0;
+    }
+
+    // the raw arrays can be used in place if suitably aligned
+    if( mzLen == (int)(numPeaks * sizeof(double)) && 
+        (size_t)mzBlob % sizeof(double) == 0 ){
+        mzs_ = (const double*)mzBlob;
+    } else {
+        if( (int)mzBuffer_.size() < numPeaks ){
+            mzBuffer_.resize(numPeaks);
+        }
+        if( !decodePeakMzs(numPeaks, (const unsigned char*)mzBlob, mzLen, 
+                           &mzBuffer_[0]) ){
+            return false;
+        }
+        mzs_ = &mzBuffer_[0];
+    }
+
+    if( intensityLen == (int)(numPeaks * sizeof(float)) && 
+        (size_t)intensityBlob % sizeof(float) == 0 ){
+        intensities_ = (const float*)intensityBlob;
+    } else {
+        if( (int)intensityBuffer_.size() < numPeaks ){
+            intensityBuffer_.resize(numPeaks);
+        }
+        if( !decodePeakIntensities(numPeaks, 
+                                   (const unsigned char*)intensityBlob,
+                                   intensityLen, &intensityBuffer_[0]) ){
+            return false;
+        }
+        intensities_ = &intensityBuffer_[0];
+    }
+
+    if( checkPeaks ){
+        for(int i = 0; i < numPeaks; i++){
+            double mz = mzs_[i];
+            float intensity = intensities_[i];
+            if( mz != mz || mz < 0 || mz > 100000 ||
+                intensity != intensity || intensity < 0 ){
+                return false;
+            }
+        }
+    }
+
+    numPeaks_ = numPeaks;
+    return true;
+}
+
+/**
+ * Copy the decoded peaks into the given vector, reusing its storage.
+ */
+void PeakDecoder::getPeaks(vector<PEAK_T>& peaks) const {
+    peaks.resize(numPeaks_);
+    for(int i = 0; i < numPeaks_; i++){
+        peaks[i].mz = mzs_[i];
+        peaks[i].intensity = intensities_[i];
+    }
+}
+
+} // namespace
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,120 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * Encoding and decoding of the peak m/z and intensity arrays stored in
+ * the RefSpectraPeaks table.  Each blob identifies its own codec so
+ * that libraries may mix rows written with different codecs and old
+ * libraries stay readable.
+ *
+ * A blob whose length is exactly numPeaks * sizeof(double) (or
+ * sizeof(float) for intensities) holds the raw array.  Otherwise, a
+ * blob starting with PEAK_CODEC_TAG was written by one of the delta
+ * codecs below and anything else is a zlib stream.
+ */
+
+#include <vector>
+#include "Spectrum.h"
+
+using namespace std;
+
+namespace BiblioSpec {
+
+enum PEAK_CODEC {
+    ZLIB_PEAK_CODEC,          // raw arrays compressed with zlib
+    DELTA_PEAK_CODEC,         // fixed-point m/z, log-scaled intensity
+    DELTA_LOSSLESS_PEAK_CODEC // delta-encoded bits of the raw values
+};
+
+/**
+ * First byte of a blob written by a delta codec.  Its low four bits
+ * are never 8, the compression method every zlib stream starts with.
+ */
+const unsigned char PEAK_CODEC_TAG = 0xB1;
+
+/** m/z values are stored as multiples of 1/MZ_FIXED_POINT_SCALE. */
+const int MZ_FIXED_POINT_SCALE = 100000;
+
+/** 
+ * Intensities are stored as the log2 of their ratio to the most
+ * intense peak, in steps of 2^-INTENSITY_LOG_BITS.
+ */
+const int INTENSITY_LOG_BITS = 8;
+
+bool stringToPeakCodec(const char* name, PEAK_CODEC& codec);
+
+void encodePeakMzs(PEAK_CODEC codec, int levelCompress, int numPeaks,
+                   const double* mzs, vector<unsigned char>& blob);
+void encodePeakIntensities(PEAK_CODEC codec, int levelCompress, 
+                           int numPeaks, const float* intensities,
+                           vector<unsigned char>& blob);
+
+bool decodePeakMzs(int numPeaks, const unsigned char* blob, int blobLen,
+                   double* mzs);
+bool decodePeakIntensities(int numPeaks, const unsigned char* blob, 
+                           int blobLen, float* intensities);
+
+/**
+ * Decodes the peak blobs of one spectrum at a time into buffers that
+ * are kept from one spectrum to the next.  A blob holding the raw
+ * array is used in place, so the decoded arrays are only valid until
+ * the next decode() and as long as the blobs passed to it.
+ */
+class PeakDecoder {
+ public:
+    PeakDecoder();
+
+    bool decode(int numPeaks, const void* mzBlob, int mzLen,
+                const void* intensityBlob, int intensityLen,
+                bool checkPeaks = false);
+    int getNumPeaks() const { return numPeaks_; }
+    const double* getMzs() const { return mzs_; }
+    const float* getIntensities() const { return intensities_; }
+    void getPeaks(vector<PEAK_T>& peaks) const;
+
+ private:
+    int numPeaks_;
+    const double* mzs_;         // points into mzBuffer_ or the blob
+    const float* intensities_;  // points into intensityBuffer_ or the blob
+    vector<double> mzBuffer_;
+    vector<float> intensityBuffer_;
+};
+
+} // namespace
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
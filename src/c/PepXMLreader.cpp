@@ -35,6 +35,8 @@
 
 #include "PepXMLreader.h"
 #include "BlibMaker.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 
 using namespace std;
 
@@ -61,6 +63,27 @@ PepXMLreader::PepXMLreader(BlibBuilder& maker,
     dirs.push_back("../../");  // look in grandparent dir in addition to cwd
     extensions.push_back(".mzML"); // look for spec in mzXML files
     extensions.push_back(".mzXML"); // look for spec in mzXML files
+    deferBuild_ = false;
+}
+
+/**
+ * Create a reader for one msms_run_summary of the parent's file.  It
+ * starts with the analysis found in the parent's header and collects
+ * psms without adding them to the library.
+ */
+PepXMLreader::PepXMLreader(PepXMLreader& parent)
+: BuildParser(parent.getBlibBuilder(), parent.getFileName().c_str(), NULL),
+  analysisType_(parent.analysisType_),
+  scoreType_(parent.scoreType_),
+  state(STATE_ROOT)
+{
+    this->setFileName(parent.getFileName().c_str()); // for the saxhandler
+    numFiles = 0;
+    pepProb = 0;
+    probCutOff = parent.probCutOff;
+    dirs = parent.dirs;
+    extensions = parent.extensions;
+    deferBuild_ = true;
 }
 
 PepXMLreader::~PepXMLreader() {
@@ -194,12 +217,10 @@ void PepXMLreader::endElement(const XML_Char* name)
                                 "the recognized sources (PeptideProphet, "
                                 "SpectrumMill, OMSSA).");
         }
-        // if we are using pep.xml from Spectrum mill, we still don't have
-        // scan numbers/indexes, here's a hack to get them
-        if( analysisType_ == SPECTRUM_MILL_ANALYSIS ) {
-            findScanIndexFromName();
+        // when runs are read in parallel, tables are built afterwards
+        if( !deferBuild_ ){
+            buildRunTables();
         }
-        buildTables(scoreType_);
         
         // reset values for next 
         mzXMLFile[0]='\0';
@@ -250,10 +271,183 @@ void PepXMLreader::endElement(const XML_Char* name)
     }
 }
 
+/**
+ * Add the psms collected for the current msms_run_summary to the
+ * library.
+ */
+void PepXMLreader::buildRunTables()
+{
+    // if we are using pep.xml from Spectrum mill, we still don't have
+    // scan numbers/indexes, here's a hack to get them
+    if( analysisType_ == SPECTRUM_MILL_ANALYSIS ) {
+        findScanIndexFromName();
+    }
+    buildTables(scoreType_);
+}
+
+/**
+ * Read the file in one pass unless it has more than one
+ * msms_run_summary, in which case the runs are parsed concurrently.
+ */
 bool PepXMLreader::parseFile()
 {
-   
-   return parse();
+    vector< pair<long long, long long> > runRanges;
+    int numThreads = (int)boost::thread::hardware_concurrency();
+    if( numThreads > 1 ){
+        findRunSummaries(runRanges);
+    }
+
+    if( runRanges.size() < 2 ){
+        return parse();
+    }
+    return parseRunsInParallel(runRanges, numThreads);
+}
+
+/**
+ * Scan the file for the byte ranges of each msms_run_summary element,
+ * from the start of its opening tag to the end of its closing tag.
+ * Leaves runRanges empty if the elements are not found or not
+ * properly paired.
+ */
+void PepXMLreader::findRunSummaries(vector< pair<long long, long long> >& 
+                                    runRanges)
+{
+    const string startTag = "<msms_run_summary";
+    const string endTag = "</msms_run_summary>";
+    const size_t keepBytes = max(startTag.length() + 1, endTag.length());
+
+    FILE* file = fopen(getFileName().c_str(), "rb");
+    if( file == NULL ){
+        return; // parse() will report the error
+    }
+
+    vector<char> buffer(1 << 20);
+    string window;            // bytes not yet searched
+    long long windowStart = 0; // file position of window[0]
+    bool inRun = false;
+    size_t readBytes = 0;
+    while( (readBytes = fread(&buffer[0], 1, buffer.size(), file)) > 0 ){
+        window.append(&buffer[0], readBytes);
+
+        size_t pos = 0;
+        while( true ){
+            const string& tag = inRun ? endTag : startTag;
+            size_t found = window.find(tag, pos);
+            if( found == string::npos ){
+                break;
+            }
+            if( !inRun ){
+                // make sure it isn't a longer element name
+                size_t nextIdx = found + tag.length();
+                if( nextIdx >= window.length() ){
+                    break; // wait for the next read
+                }
+                char next = window[nextIdx];
+                if( next != '>' && !isspace(next) ){
+                    pos = found + 1;
+                    continue;
+                }
+                runRanges.push_back(make_pair(windowStart + found, -1LL));
+            } else {
+                runRanges.back().second = windowStart + found + tag.length();
+            }
+            inRun = !inRun;
+            pos = found + tag.length();
+        }
+
+        // keep the end of the window in case a tag spans two reads
+        size_t discard = window.length() - min(window.length(), keepBytes);
+        discard = max(discard, pos);
+        window.erase(0, discard);
+        windowStart += discard;
+    }
+    fclose(file);
+
+    if( inRun ){
+        runRanges.clear();
+    }
+}
+
+/**
+ * Parse the header of the file (everything before the first
+ * msms_run_summary) and then parse up to numThreads runs at a time,
+ * each with its own reader.  The psms from each batch of runs are
+ * added to the library in the order the runs appear in the file.
+ */
+bool PepXMLreader::parseRunsInParallel(
+    const vector< pair<long long, long long> >& runRanges,
+    int numThreads)
+{
+    // the analysis summaries at the top of the file apply to all runs
+    parseRange(0, runRanges.front().first, 
+               NULL, "</msms_pipeline_analysis>");
+
+    Verbosity::debug("Reading %d runs from %s using %d threads.",
+                     runRanges.size(), getFileName().c_str(), numThreads);
+
+    for(size_t first = 0; first < runRanges.size(); first += numThreads){
+        size_t last = min(runRanges.size(), first + numThreads);
+
+        vector<PepXMLreader*> runReaders;
+        vector<string> errors(last - first);
+        boost::thread_group threads;
+        for(size_t i = first; i < last; i++){
+            PepXMLreader* runReader = new PepXMLreader(*this);
+            runReaders.push_back(runReader);
+            threads.create_thread(boost::bind(&PepXMLreader::parseRun, 
+                                              runReader, runRanges.at(i),
+                                              &errors.at(i - first)));
+        }
+        threads.join_all();
+
+        try{
+            for(size_t i = 0; i < runReaders.size(); i++){
+                if( !errors.at(i).empty() ){
+                    throw BlibException(true, "%s", errors.at(i).c_str());
+                }
+
+                PepXMLreader* run = runReaders.at(i);
+                psms_.swap(run->psms_);
+                setSpecFileName(run->getSpecFileName().c_str(), false);
+                analysisType_ = run->analysisType_;
+                scoreType_ = run->scoreType_;
+                lookUpBy_ = run->lookUpBy_;
+                specReader_->setIdType(lookUpBy_);
+
+                buildRunTables();
+            }
+        } catch(...){
+            clearVector(runReaders);
+            throw;
+        }
+        clearVector(runReaders);
+    }
+
+    return true;
+}
+
+/**
+ * Thread function for parsing one msms_run_summary.  Errors are
+ * returned in errorMessage rather than thrown.
+ */
+void PepXMLreader::parseRun(PepXMLreader* runReader,
+                            pair<long long, long long> range,
+                            string* errorMessage)
+{
+    try{
+        runReader->parseRange(range.first, range.second, 
+                              "<msms_pipeline_analysis>",
+                              "</msms_pipeline_analysis>");
+    } catch(BlibException& e){
+        *errorMessage = e.what();
+    } catch(std::exception& e){
+        *errorMessage = e.what();
+    } catch(string s){
+        *errorMessage = s;
+    } catch(...){
+        *errorMessage = "Unknown error reading ";
+        *errorMessage += runReader->getFileName();
+    }
 }
 
 /**
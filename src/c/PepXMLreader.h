@@ -68,6 +68,8 @@ class PepXMLreader : public BuildParser{
   bool parseFile();
  
  private:
+  PepXMLreader(PepXMLreader& parent); // for reading one run of parent
+
   enum ANALYSIS { UNKNOWN_ANALYSIS, // none of the following
                   PEPTIDE_PROPHET_ANALYSIS, 
                   SPECTRUM_MILL_ANALYSIS,
@@ -100,7 +102,16 @@ class PepXMLreader : public BuildParser{
   int numFiles;
 
 
+  bool deferBuild_;  ///< collect psms for each run but don't add them
+
   bool scorePasses(double score);
+  void buildRunTables();
+  void findRunSummaries(vector< pair<long long, long long> >& runRanges);
+  bool parseRunsInParallel(const vector< pair<long long, long long> >& 
+                           runRanges, int numThreads);
+  static void parseRun(PepXMLreader* runReader, 
+                       pair<long long, long long> range,
+                       string* errorMessage);
 
 
 };
@@ -49,7 +49,8 @@ ProteinPilotReader::ProteinPilotReader(
   expectedNumPeaks_(0),
   curSpecMz_(0),
   probCutOff_(getScoreThreshold(PROT_PILOT)),
-  skipMods_(true)
+  skipMods_(true),
+  spectra_(string(maker.getLibName()) + ".spectra.tmp")
 {
     this->setFileName(xmlFileName); // this is done for the saxhandler
     curPSM_ = NULL;
@@ -66,12 +67,6 @@ ProteinPilotReader::~ProteinPilotReader()
     specReader_ = NULL; // so parent class doesn't try to delete
                         // itself
     delete curSpec_;
-    // free all spec in map
-    map<string, SpecData*>::iterator it;
-    for(it = spectrumMap_.begin(); it != spectrumMap_.end(); ++it){
-        delete it->second;
-        it->second = NULL;
-    }
 }
         
 bool ProteinPilotReader::parseFile()
@@ -323,19 +318,19 @@ void ProteinPilotReader::saveSpectrum()
 
     // this is the end of the msmspeaks element
     // create a new spectrum and fill in the data
-    SpecData* specD = new SpecData();
-    specD->retentionTime = retentionTime_;
-    specD->mz = curSpecMz_;
-    specD->numPeaks = curPeaks_.size();
-    specD->mzs = new double[specD->numPeaks];
-    specD->intensities = new float [specD->numPeaks];
-    for(int i=0; i < specD->numPeaks; i++){
-        specD->mzs[i] = curPeaks_[i].mz;
-        specD->intensities[i] = curPeaks_[i].intensity;
+    SpecData specD;
+    specD.retentionTime = retentionTime_;
+    specD.mz = curSpecMz_;
+    specD.numPeaks = curPeaks_.size();
+    specD.mzs = new double[specD.numPeaks];
+    specD.intensities = new float [specD.numPeaks];
+    for(int i=0; i < specD.numPeaks; i++){
+        specD.mzs[i] = curPeaks_[i].mz;
+        specD.intensities[i] = curPeaks_[i].intensity;
     }
 
-    // save it in the hash, keyed by spec name
-    spectrumMap_[curPSM_->specName] = specD;
+    // store it, keyed by spec name; peaks may be moved out of memory
+    spectrumMap_[curPSM_->specName] = spectra_.add(specD);
 }
 
 void ProteinPilotReader::getElementName(){
@@ -431,15 +426,12 @@ bool ProteinPilotReader::getSpectrum(string scanName,
                                      bool getPeaks){
     Verbosity::comment(V_DETAIL, "Looking for spectrum %s", scanName.c_str());
 
-    map<string,SpecData*>::iterator found = spectrumMap_.find(scanName);
+    map<string,size_t>::iterator found = spectrumMap_.find(scanName);
     if( found == spectrumMap_.end() ){
         return false;
     }
 
-    if( ! getPeaks ){
-        returnData.numPeaks = 0; // so that they don't get copied
-    }
-    returnData = *(found->second);
+    spectra_.get(found->second, returnData, getPeaks);
     return true;
 
 }
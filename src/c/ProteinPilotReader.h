@@ -41,6 +41,7 @@
 #include <algorithm>
 #include "BuildParser.h"
 #include "PeakProcess.h"
+#include "SpecDataStore.h"
 
 namespace BiblioSpec {
 
@@ -89,7 +90,8 @@ namespace BiblioSpec {
         double curSpecMz_;
         double probCutOff_;
         bool skipMods_;
-        map<string, SpecData*> spectrumMap_;
+        SpecDataStore spectra_; // peaks, bounded in memory
+        map<string, size_t> spectrumMap_; // spec name to spectra_ handle
         string nextWord_;  // tmp holder for element values
         map<string, double> elementTable_;
         map<string, double> modTable_;
@@ -55,9 +55,8 @@ PsmFile::PsmFile(const char* filename,
         Verbosity::error("Filename '%s' does not end with .psm.", filename);
     }
 
-    sqlite3_open(filename, &db_);
-    
-    if(db_ == 0) {
+    if( sqlite3_open(filename, &db_) != SQLITE_OK ){
+        sqlite3_close(db_);
         Verbosity::error("Couldn't open .psm results file %s.", filename);
     }
     SqliteRoutine::SQL_STMT("PRAGMA synchronous=OFF", db_);
@@ -71,6 +70,49 @@ PsmFile::PsmFile(const char* filename,
 }
 
 
+/**
+ * Open a .psm file written by an earlier, interrupted search to add
+ * more results.  Remove any results after lastResultID, as returned
+ * by checkpoint().
+ */
+PsmFile::PsmFile(const char* filename,
+                 const ops::variables_map& options_table,
+                 int lastResultID)
+: blibRunSearchID_(0),
+    reportMatches_(options_table["report-matches"].as<int>())
+{
+    if( sqlite3_open(filename, &db_) != SQLITE_OK ){
+        sqlite3_close(db_);
+        Verbosity::error("Couldn't open .psm results file %s.", filename);
+    }
+    SqliteRoutine::SQL_STMT("PRAGMA synchronous=OFF", db_);
+    SqliteRoutine::SQL_STMT("PRAGMA cache_size=750000", db_);
+    SqliteRoutine::SQL_STMT("PRAGMA temp_store=MEMORY", db_);
+
+    // find the results of the earlier search
+    char zSql[2048];
+    int iRow, iCol;
+    char** result;
+    strcpy(zSql, "select msRunSearch.id from msRunSearch, msSearch "
+           "where msRunSearch.searchID = msSearch.id "
+           "and msSearch.analysisProgramName='BlibSearch'");
+    int rc = sqlite3_get_table(db_, zSql, &result, &iRow, &iCol, 0);
+    if( rc != SQLITE_OK || iRow < 1 ){
+        Verbosity::error("No BlibSearch results to resume in %s.", filename);
+    }
+    blibRunSearchID_ = atoi(result[1]);
+    sqlite3_free_table(result);
+
+    SqliteRoutine::SQL_STMT("BEGIN", db_);
+
+    sprintf(zSql, "delete from BiblioSpecSearchResult where resultID > %d",
+            lastResultID);
+    SqliteRoutine::SQL_STMT(zSql, db_);
+    sprintf(zSql, "delete from msRunSearchResult where id > %d",
+            lastResultID);
+    SqliteRoutine::SQL_STMT(zSql, db_);
+}
+
 PsmFile::~PsmFile(){}
 
 // NOTE these functions were taken as is from BlibSearch.cpp and have
@@ -418,7 +460,7 @@ void PsmFile::insertMatches(const vector<Match>& matches){
     char zSql[2048];
     double pValue = -1;
 
-    for(int i = 0; i < reportMatches_; i++) {
+    for(int i = 0; i < reportMatches_ && i < (int)matches.size(); i++) {
         Match tmpMatch = matches.at(i);
         const RefSpectrum* tmpRefSpec = tmpMatch.getRefSpec();
         //        const Spectrum* s = tmpMatch.getExpSpec();
@@ -462,6 +504,30 @@ void PsmFile::commit(){
     SqliteRoutine::SQL_STMT("COMMIT", db_);
 }
 
+/**
+ * Commit the results inserted so far and start a new transaction for
+ * the rest.
+ * \returns The id of the last result committed, zero if none.
+ */
+int PsmFile::checkpoint(){
+    commit();
+
+    char zSql[2048];
+    int iRow, iCol;
+    char** result;
+    sprintf(zSql, "select max(id) from msRunSearchResult "
+            "where runSearchID=%d", blibRunSearchID_);
+    int rc = sqlite3_get_table(db_, zSql, &result, &iRow, &iCol, 0);
+    if( rc != SQLITE_OK ){
+        Verbosity::error("Can't get the last result id from msRunSearchResult.");
+    }
+    int lastResultID = (result[1] == NULL) ? 0 : atoi(result[1]);
+    sqlite3_free_table(result);
+
+    SqliteRoutine::SQL_STMT("BEGIN", db_);
+    return lastResultID;
+}
+
 } // namespace
 
 /*
@@ -62,6 +62,9 @@ class PsmFile {
  public:
     PsmFile(const char* filename, 
             const ops::variables_map& options_table);
+    PsmFile(const char* filename, 
+            const ops::variables_map& options_table,
+            int lastResultID);
   ~PsmFile();
 
   void insertSpecData(Spectrum& s, 
@@ -70,6 +73,7 @@ class PsmFile {
 
   void insertMatches(const vector<Match>& matches);
   void commit();
+  int checkpoint();
 
 };
 
@@ -330,6 +330,24 @@ bool PwizReader::getNextSpectrum(BiblioSpec::Spectrum& spectrum){
     return success;
 }
 
+size_t PwizReader::getNextPosition(){
+    return curPositionInIndexMzPairs_;
+}
+
+/**
+ * Skip ahead (or back) so that the next spectrum returned by
+ * getNextSpectrum() is the one at the given position, as returned by
+ * getNextPosition() for the same file opened in the same order.
+ */
+void PwizReader::setNextPosition(size_t position){
+    if( position > indexMzPairs_.size() ){
+        BiblioSpec::Verbosity::error("Cannot read from position %d of %s, "
+                                     "which has %d spectra.", position,
+                                     fileName_.c_str(), indexMzPairs_.size());
+    }
+    curPositionInIndexMzPairs_ = position;
+}
+
 /**
  * Return the index of the next spectrum (as indexed in the file)
  * to fetch and update the current position in the list of
@@ -107,6 +107,14 @@ class PwizReader : public BiblioSpec::SpecFileReader {
 
     bool getNextSpectrum(BiblioSpec::Spectrum& spectrum);
 
+    /**
+     * The position of the next spectrum getNextSpectrum() will
+     * return, in the order the file was opened with.  Can be used to
+     * continue reading a file from the same place later.
+     */
+    size_t getNextPosition();
+    void setNextPosition(size_t position);
+
  private:
     string fileName_;
     #ifdef _MSC_VER
@@ -32,6 +32,7 @@
 //class definition for RefSpectrum
 
 #include "RefSpectrum.h"
+#include "PeakCodec.h"
 
 using namespace std;
 
@@ -43,7 +44,10 @@ RefSpectrum::RefSpectrum() :
   copies(0),
   libID(-1), // 0 means decoy spec
   libSpecID(-1),
-  circShift_(0)
+  circShift_(0),
+  hasStoredPeaks_(false),
+  numStoredPeaks_(0),
+  peaksPending_(false)
 { 
     type_ = REFERENCE;
 }
@@ -58,10 +62,16 @@ RefSpectrum::RefSpectrum(const RefSpectrum& rs) : Spectrum(rs)
     pepSeq = rs.pepSeq;
     modsPepSeq = rs.modsPepSeq;
     circShift_ = rs.circShift_;
+    hasStoredPeaks_ = rs.hasStoredPeaks_;
+    numStoredPeaks_ = rs.numStoredPeaks_;
+    storedMzs_ = rs.storedMzs_;
+    storedIntensities_ = rs.storedIntensities_;
+    peaksPending_ = rs.peaksPending_;
 }
 
 RefSpectrum::RefSpectrum(const Spectrum& s) : Spectrum(s),
-      copies(0), libID(-1), libSpecID(-1), circShift_(0)
+      copies(0), libID(-1), libSpecID(-1), circShift_(0),
+      hasStoredPeaks_(false), numStoredPeaks_(0), peaksPending_(false)
 {
     // set charge of Spectrum, if more than one, set to 0
     if( possibleCharges_.size() == 1 ){
@@ -110,6 +120,11 @@ RefSpectrum& RefSpectrum::operator=(const RefSpectrum& s)
     libID = s.getLibID();
     libSpecID = s.getLibSpecID();
     circShift_ = s.circShift_;
+    hasStoredPeaks_ = s.hasStoredPeaks_;
+    numStoredPeaks_ = s.numStoredPeaks_;
+    storedMzs_ = s.storedMzs_;
+    storedIntensities_ = s.storedIntensities_;
+    peaksPending_ = s.peaksPending_;
     
     Spectrum::operator=(s);
     return *this;
@@ -132,6 +147,11 @@ RefSpectrum& RefSpectrum::operator=(const Spectrum& s)
     circShift_ = 0;
     pepSeq.clear();
     modsPepSeq.clear();
+    hasStoredPeaks_ = false;
+    numStoredPeaks_ = 0;
+    storedMzs_.clear();
+    storedIntensities_.clear();
+    peaksPending_ = false;
     
     return *this;
 }
@@ -152,6 +172,11 @@ void RefSpectrum::clear()
     libSpecID = 0;
     pepSeq.clear();
     modsPepSeq.clear();
+    hasStoredPeaks_ = false;
+    numStoredPeaks_ = 0;
+    storedMzs_.clear();
+    storedIntensities_.clear();
+    peaksPending_ = false;
 }
 
 void RefSpectrum::setCharge(int newCharge)
@@ -246,6 +271,71 @@ double RefSpectrum::getCircShift() const
     return circShift_;
 }
 
+/**
+ * Keep a copy of the peak blobs as stored in the library instead of
+ * decoding them now.  The spectrum has no raw peaks until
+ * decodeStoredPeaks() is called.
+ */
+void RefSpectrum::setStoredPeaks(int numPeaks, 
+                                 const void* mzBlob, int mzLen,
+                                 const void* intensityBlob, int intensityLen)
+{
+    const unsigned char* mzBytes = (const unsigned char*)mzBlob;
+    const unsigned char* intensityBytes = 
+        (const unsigned char*)intensityBlob;
+    hasStoredPeaks_ = true;
+    numStoredPeaks_ = numPeaks;
+    storedMzs_.assign(mzBytes, mzBytes + mzLen);
+    storedIntensities_.assign(intensityBytes, intensityBytes + intensityLen);
+    rawPeaks_.clear();
+}
+
+/**
+ * Replace the raw peaks with the decoded stored peaks, if there are
+ * any, and release the blobs.  \returns False if they could not be
+ * decoded, leaving no raw peaks.
+ */
+bool RefSpectrum::decodeStoredPeaks(PeakDecoder& decoder)
+{
+    if( !hasStoredPeaks_ ){
+        return true;
+    }
+    bool decoded = decoder.decode(numStoredPeaks_, 
+                                  storedMzs_.empty() ? NULL : &storedMzs_[0],
+                                  (int)storedMzs_.size(),
+                                  storedIntensities_.empty() ? NULL 
+                                                 : &storedIntensities_[0],
+                                  (int)storedIntensities_.size());
+    rawPeaks_.clear();
+    if( decoded ){
+        decoder.getPeaks(rawPeaks_);
+    }
+    hasStoredPeaks_ = false;
+    numStoredPeaks_ = 0;
+    vector<unsigned char>().swap(storedMzs_);
+    vector<unsigned char>().swap(storedIntensities_);
+    return decoded;
+}
+
+bool RefSpectrum::hasStoredPeaks() const
+{
+    return hasStoredPeaks_;
+}
+
+/**
+ * Mark the peaks as still to be processed, for a searcher that
+ * processes candidates only when it first compares them.
+ */
+void RefSpectrum::setPeaksPending(bool pending)
+{
+    peaksPending_ = pending;
+}
+
+bool RefSpectrum::hasPendingPeaks() const
+{
+    return peaksPending_;
+}
+
 void printFirstLastPeaks(vector<PEAK_T>* peaks, int num){
     cerr << "First " << num << " peaks are" << endl;
     for(int i = 0; i < num; i++){
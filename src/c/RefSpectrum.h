@@ -72,6 +72,8 @@ using namespace std;
 
 namespace BiblioSpec {
 
+class PeakDecoder;
+
 class RefSpectrum : public Spectrum
 {
 
@@ -86,6 +88,12 @@ class RefSpectrum : public Spectrum
   string nextAA;
   double circShift_; // amount by which peaks have been circularly shifted
                      // 0 if observed spectrum
+  // peak blobs as stored in the library, kept until decodeStoredPeaks()
+  bool hasStoredPeaks_;
+  int numStoredPeaks_;
+  vector<unsigned char> storedMzs_;
+  vector<unsigned char> storedIntensities_;
+  bool peaksPending_; // peaks still to be processed before comparing
   
 
  public:
@@ -111,6 +119,10 @@ class RefSpectrum : public Spectrum
   void setCopies(int dups);
   void setPrevAA(string pAA);
   void setNextAA(string nAA);
+  void setStoredPeaks(int numPeaks, const void* mzBlob, int mzLen,
+                      const void* intensityBlob, int intensityLen);
+  bool decodeStoredPeaks(PeakDecoder& decoder);
+  void setPeaksPending(bool pending);
 
   //getters
   int getCharge() const;
@@ -122,6 +134,8 @@ class RefSpectrum : public Spectrum
   string getPrevAA() const;
   string getNextAA() const;
   double getCircShift() const;
+  bool hasStoredPeaks() const;
+  bool hasPendingPeaks() const;
   
   // make this private and only allow decoys as copy of refs?
   // create null spectrum by doing a circular shift of peaks
@@ -32,6 +32,7 @@
 //class definition for LogFile
 
 #include "Reportfile.h"
+#include "BlibUtils.h"
 #include <time.h>
 
 using namespace std;
@@ -39,14 +40,16 @@ using namespace std;
 namespace BiblioSpec {
 
 /**
- * Create a Reportfile object with no associated file.  Creater can
- * later call open() to associate with a named file.
+ * Create a Reportfile object with no associated file for the results
+ * of searching queryFileName.  Creater can later call open() to
+ * associate with a named file.
  */
-Reportfile::Reportfile(const ops::variables_map& options_table)
+Reportfile::Reportfile(const ops::variables_map& options_table,
+                       const string& queryFileName)
 : topMatches_(options_table["report-matches"].as<int>())
 {
     // extract values for header
-    optionsString_ = optionsHeaderString(options_table); 
+    optionsString_ = optionsHeaderString(options_table, queryFileName); 
 
     // translate topMatches==-1 to print all
     if( topMatches_ == -1 ){
@@ -66,6 +69,36 @@ void Reportfile::open(const char* filename) {
     writeHeader();
 }
 
+/**
+ * Open a file written by an earlier, interrupted search for more
+ * matches.  Discard anything after its first size bytes, as returned
+ * by flush(), and do not write the header again.
+ */
+void Reportfile::reopen(const char* filename, long size) {
+    
+    if( ! truncateFile(filename, size) ){
+        Verbosity::error("Could not truncate report file %s to resume "
+                         "the search.", filename);
+    }
+    file_.open(filename, ios::out | ios::app);
+    if( ! file_.is_open() ) {
+        Verbosity::error("Could not open report file %s.", filename);
+    }
+}
+
+/**
+ * Make sure all matches written so far are in the file.
+ * \returns The length of the file, zero if it is not open.
+ */
+long Reportfile::flush() {
+    if( ! file_.is_open() ){
+        return 0;
+    }
+    file_.flush();
+    file_.seekp(0, ios::end); // in case nothing written since reopen()
+    return (long)file_.tellp();
+}
+
 Reportfile::~Reportfile()
 {
     if( file_.is_open() )
@@ -117,20 +150,33 @@ void Reportfile::writeHeader()
  * Convert the options values to a string that can be printed to the
  * header file.
  */
-string Reportfile::optionsHeaderString(const ops::variables_map& options_table){
+string Reportfile::optionsHeaderString(const ops::variables_map& options_table,
+                                       const string& queryFileName){
     ostringstream strBuilder; // write to here
 
     time_t t=time(NULL);
     char* date=ctime(&t);
-    string queryFileName = options_table["spectrum-file"].as<string>();    
-    const vector<string>& libfiles = 
-        options_table["library"].as< vector<string> >();    
 
     // Start with date, filenames 
     strBuilder << "# Search results from BilbSearch" << endl //version?
          << "# " << date << endl
-         << "# query file: " << queryFileName << endl;
-    
+         << "# query file: " << queryFileName << endl
+         << searchOptionsString(options_table);
+
+    return strBuilder.str();
+}
+
+/**
+ * Convert the libraries and the options values relevant to the search
+ * to a string for the header, without anything that depends on the
+ * query file or the time.
+ */
+string Reportfile::searchOptionsString(const ops::variables_map& options_table){
+    ostringstream strBuilder; // write to here
+
+    const vector<string>& libfiles = 
+        options_table["library"].as< vector<string> >();    
+
     strBuilder << "# Library file list:"<<endl;
     for(size_t i = 0; i < libfiles.size(); i++) {
         strBuilder << "# libID" << i+1 << "\t" << libfiles.at(i) << endl;
@@ -145,6 +191,18 @@ string Reportfile::optionsHeaderString(const ops::variables_map& options_table){
                << options_table["topPeaksForSearch"].as<int>() << endl;
     strBuilder << "# mz-window = " << options_table["mz-window"].as<double>()
                << endl;
+    if( options_table["precursor-tolerance-ppm"].as<double>() > 0 ){
+        strBuilder << "# precursor-tolerance-ppm = " 
+                   << options_table["precursor-tolerance-ppm"].as<double>()
+                   << endl;
+    }
+    if( options_table.count("cluster-queries") ){
+        strBuilder << "# cluster-mz-tolerance = " 
+                   << options_table["cluster-mz-tolerance"].as<double>()
+                   << endl;
+        strBuilder << "# cluster-min-dotp = " 
+                   << options_table["cluster-min-dotp"].as<double>() << endl;
+    }
     strBuilder << "# low-charge = " << options_table["low-charge"].as<int>()
                << endl;
     strBuilder << "# high-charge = " << options_table["high-charge"].as<int>() 
@@ -67,13 +67,18 @@ class Reportfile
   string optionsString_;
 
   void writeHeader();
-  string optionsHeaderString(const ops::variables_map& options_table);
+  string optionsHeaderString(const ops::variables_map& options_table,
+                             const string& queryFileName);
  
  public:
-  Reportfile(const ops::variables_map& options_table);
+  Reportfile(const ops::variables_map& options_table,
+             const string& queryFileName);
   ~Reportfile();
   void open(const char* filename);
+  void reopen(const char* filename, long size);
+  long flush();
   void writeMatches(const vector<Match>& results);
+  static string searchOptionsString(const ops::variables_map& options_table);
   
 };
 
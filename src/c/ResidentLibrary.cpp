@@ -0,0 +1,166 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+/**
+ * Implementation of the ResidentLibrary, all spectra from a set of
+ * libraries held in memory for searching.
+ */
+
+#include "ResidentLibrary.h"
+#include "LibReader.h"
+#include "BlibUtils.h"
+#include "Verbosity.h"
+#include <algorithm>
+
+namespace BiblioSpec {
+
+// library spectra must have more peaks than this to be searched, as
+// in SearchLibrary::getLibrarySpec()
+static const int MIN_LIBRARY_PEAKS = 5;
+
+// precursor m/z range that includes every library spectrum
+static const double MIN_LIBRARY_MZ = 0;
+static const double MAX_LIBRARY_MZ = 1e9;
+
+/**
+ * Read all spectra with enough peaks from each library and process
+ * their peaks as SearchLibrary would with the given options.  Library
+ * indexes start at 1, in the order the libraries are given.
+ */
+ResidentLibrary::ResidentLibrary(const vector<string>& libfilenames,
+                                 const ops::variables_map& options_table) :
+    memoryUsed_(0)
+{
+    PeakProcessor peakProcessor(options_table);
+
+    spectra_.resize(libfilenames.size());
+    for(size_t i = 0; i < libfilenames.size(); i++){
+        loadLibrary(libfilenames.at(i).c_str(), i + 1, peakProcessor);
+    }
+}
+
+ResidentLibrary::~ResidentLibrary(){
+    for(size_t i = 0; i < spectra_.size(); i++){
+        clearVector(spectra_.at(i));
+    }
+}
+
+/**
+ * Read and process the spectra from the named library into the given
+ * position.
+ */
+void ResidentLibrary::loadLibrary(const char* libName, int libIndex,
+                                  PeakProcessor& peakProcessor){
+    Verbosity::status("Loading library %s.", libName);
+
+    vector<RefSpectrum*>& spectra = spectra_.at(libIndex - 1);
+    LibReader library(libName);
+    library.getSpecInMzRange(MIN_LIBRARY_MZ, MAX_LIBRARY_MZ, 
+                             MIN_LIBRARY_PEAKS, spectra);
+
+    for(size_t i = 0; i < spectra.size(); i++){
+        RefSpectrum* curSpec = spectra.at(i);
+        curSpec->setLibID(libIndex);
+        peakProcessor.processPeaks(curSpec);
+
+        memoryUsed_ += sizeof(RefSpectrum) + 
+            (curSpec->getRawPeaks().capacity() + 
+             curSpec->getProcessedPeaks().capacity()) * sizeof(PEAK_T) +
+            curSpec->getSeq().size() + curSpec->getMods().size();
+    }
+    stable_sort(spectra.begin(), spectra.end(), compSpecPtrMz());
+
+    Verbosity::debug("Loaded %d spectra from %s.", spectra.size(), libName);
+}
+
+/**
+ * Add to returnedSpectra the spectra from the library at libIndex
+ * (starting at 0) with precursor m/z greater than minMz and no
+ * greater than maxMz, the same range as
+ * LibReader::getSpecInMzRange().  Only those with the given precursor
+ * charge are added unless charge is 0.  The spectra still belong to
+ * the ResidentLibrary and must not be deleted or changed.
+ */
+void ResidentLibrary::getSpecInMzRange(size_t libIndex, 
+                                       double minMz, double maxMz,
+                                       int charge,
+                                       deque<RefSpectrum*>& returnedSpectra
+                                       ) const {
+    const vector<RefSpectrum*>& spectra = spectra_.at(libIndex);
+
+    // first spectrum with m/z above minMz
+    size_t first = 0;
+    size_t last = spectra.size();
+    while( first < last ){
+        size_t middle = first + (last - first) / 2;
+        if( spectra[middle]->getMz() > minMz ){
+            last = middle;
+        } else {
+            first = middle + 1;
+        }
+    }
+
+    for(size_t i = first; 
+        i < spectra.size() && spectra[i]->getMz() <= maxMz; i++){
+        if( charge > 0 && spectra[i]->getCharge() != charge ){
+            continue;
+        }
+        returnedSpectra.push_back(spectra[i]);
+    }
+}
+
+size_t ResidentLibrary::getNumLibraries() const {
+    return spectra_.size();
+}
+
+size_t ResidentLibrary::getNumSpectra() const {
+    size_t numSpectra = 0;
+    for(size_t i = 0; i < spectra_.size(); i++){
+        numSpectra += spectra_.at(i).size();
+    }
+    return numSpectra;
+}
+
+/**
+ * \returns An estimate of the bytes of memory used by the spectra.
+ */
+size_t ResidentLibrary::getMemoryUsed() const {
+    return memoryUsed_;
+}
+
+} // namespace BiblioSpec
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,83 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * The ResidentLibrary holds every spectrum from a set of libraries
+ * in memory with its peaks already processed, so that any number of
+ * SearchLibrary objects can search the libraries without reading or
+ * processing library spectra again.  Spectra are sorted by precursor
+ * m/z and are not changed once loaded, so the ResidentLibrary can be
+ * shared by searches running in different threads.
+ */
+
+#include <vector>
+#include <deque>
+#include <string>
+#include "RefSpectrum.h"
+#include "PeakProcess.h"
+#include "boost/program_options.hpp"
+
+using namespace std;
+namespace ops = boost::program_options;
+
+namespace BiblioSpec {
+
+class ResidentLibrary {
+ public:
+    ResidentLibrary(const vector<string>& libfilenames,
+                    const ops::variables_map& options_table);
+    ~ResidentLibrary();
+
+    void getSpecInMzRange(size_t libIndex, double minMz, double maxMz,
+                          int charge, 
+                          deque<RefSpectrum*>& returnedSpectra) const;
+    size_t getNumLibraries() const;
+    size_t getNumSpectra() const;
+    size_t getMemoryUsed() const;
+
+ private:
+    vector< vector<RefSpectrum*> > spectra_; // for each library, by m/z
+    size_t memoryUsed_; // estimated bytes held by the spectra
+
+    void loadLibrary(const char* libName, int libIndex, 
+                     PeakProcessor& peakProcessor);
+};
+
+} // namespace BiblioSpec
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -54,55 +54,54 @@ SQTreader::SQTreader(BlibBuilder& maker,
 
 SQTreader::~SQTreader()
 {
-    if(file.is_open())
-        file.close();
+    file.close();
 }
 
 
 /**
- * Open sqt file for reading.  Read in header and leave filepointer at
- * beginning of first record.
+ * Open sqt file for reading.  Read in header and leave the file
+ * positioned at the beginning of the first record.
  */
 void SQTreader::openRead()
 {
-    if(file.is_open())
-        file.close();
-
-    file.open(getFileName().c_str());
-
-    if(!file.is_open()) {
+    if( !file.open(getFileName().c_str()) ) {
         throw BlibException(true, "Couldn't open '%s'.", getFileName().c_str());
     }
 
     //read through header to get the modifications
-    string buffer;
-    char thisLine[1024];
-    char mods[512];
+    TextSlice line;
+    TextSlice fields[3];
     bool percolated = false;
     while(file.peek() == 'H') {
 
-        getline(file,buffer);
-        if(buffer.find("StaticMod") != string::npos) {
-            strcpy(thisLine, buffer.c_str());
-            sscanf(thisLine, "%*c %*s %s", mods);
-            float modValue;
-            char modLetter;
-            sscanf(mods, "%c%*c%f", &modLetter, &modValue);
-      
-            staticMods[(int)modLetter]=modValue;
+        file.nextLine(line);
+        if( line.find("StaticMod") != -1 ) {
+            // H StaticMod C=57.021464
+            FieldTokenizer tokenizer(line, " \t", true);
+            if( tokenizer.nextFields(fields, 3) == 3 && fields[2].length > 2 ){
+                char modLetter = fields[2][0];
+                double modValue = 0;
+                parseDouble(fields[2].substr(2), modValue);
+                staticMods[(int)modLetter]=modValue;
+            }
         }
     
-        if( buffer.find(" DiffMod") != string::npos || 
-            buffer.find("	DiffMod") != string::npos) {
-            size_t posEquals = buffer.find("=");
-            if( posEquals == string::npos ){ cerr << "Blah" << endl; }
-            char modSymbol = buffer[posEquals - 1];
-            double modValue = atof(buffer.c_str() + posEquals +1);
+        if( line.find(" DiffMod") != -1 || line.find("\tDiffMod") != -1 ) {
+            // H DiffMod M*=+15.994915
+            int posEquals = line.find('=');
+            if( posEquals < 1 ){
+                throw BlibException(true, "DiffMod on line %d of '%s' has "
+                                    "no '='.", file.lineNumber(), 
+                                    getFileName().c_str());
+            }
+            char modSymbol = line[posEquals - 1];
+            double modValue = 0;
+            parseDouble(line.substr(posEquals + 1), modValue);
 
             diffMods[(int)modSymbol] = modValue;
         }
 
-        if(buffer.find("Percolator") != string::npos) {
+        if( line.find("Percolator") != -1 ) {
             percolated = true;
         }
     }// next line
@@ -131,75 +130,79 @@ bool SQTreader::parseFile() {
     string fileroot = getFileRoot(getFileName());
     setSpecFileName(fileroot.c_str(), extensions);
 
-    //  parseFile_mine();
     extractPSMs();
 
-    // close file
-    if( file.is_open() ) {
-        file.close();
-    }
+    file.close();
     return true;
 }
 
 /**
  * Read an sqt file beginning with the first S line. collect a
  * list of PSMs that pass score cutoff, populate the library tables
- * with spectrum information.
+ * with spectrum information.  Only the first M line following each S
+ * line is used.
  */
 void SQTreader::extractPSMs()
 {
-    string buffer;
     double scoreThreshold = getScoreThreshold(SQT);
     Verbosity::debug("Using Percolator q-value threshold %f",
                      scoreThreshold);
+
+    // S low_scan high_scan charge time server observed_mass ...
+    const int S_FIELDS = 7;
+    // M rank sp_rank mass deltaCn xcorr q-value matched expected seq ...
+    const int M_FIELDS = 10;
+    TextSlice fields[M_FIELDS];
+    TextSlice line;
   
-    while(!file.eof()) {
-        if(!buffer.empty())
-            buffer.clear();
-        
-        curPSM_ = new PSM();
-        
-        getline(file,buffer); //the S line
-        
-        wholePepSeq[0]='\0';
+    while( file.nextLine(line) ) {
+        if( line.empty() || line[0] != 'S' ){
+            continue; // skip remaining M and L lines of the last record
+        }
+
         // read the S line to get spectrum scan number, charge, mass
-        if(buffer[0] == 'S') {
-            sscanf(buffer.c_str(), "%*c %d %*d %d %*d %*s %lf %*f %*f %*d", 
-                   &scanNumber,&charge, &precursorMH);
-            curPSM_->charge = charge;
-            curPSM_->specKey = scanNumber;
+        FieldTokenizer sTokenizer(line, " \t", true);
+        if( sTokenizer.nextFields(fields, S_FIELDS) < S_FIELDS ||
+            !parseInt(fields[1], scanNumber) ||
+            !parseInt(fields[3], charge) ||
+            !parseDouble(fields[6], precursorMH) ){
+            throw BlibException(true, "Could not parse S line %d of '%s'.",
+                                file.lineNumber(), getFileName().c_str());
         }
-        
-        buffer.clear();
-        getline(file,buffer); //the first M line
+
         // read the first M line to get score and sequence
-        if(buffer[0] == 'M') {
-            sscanf(buffer.c_str(), "%*c %*d %*d %*f %*f %*f %lf %*d %*d %s %*c",
-                   &qvalue, wholePepSeq);
-            curPSM_->score = -1 * qvalue; // q-values negatated by percolator
+        if( file.peek() != 'M' ){
+            continue; // no matches for this spectrum
         }
-        
-        if( curPSM_->score > scoreThreshold ) {// good matches score 0 to threshold
-            delete curPSM_;
-            curPSM_ = NULL;
-        } else {
-            // get the unmodified seq and mods from the file's version of seq
-            parseModifiedSeq(wholePepSeq, curPSM_->unmodSeq, curPSM_->mods);
-            psms_.push_back(curPSM_);
-            Verbosity::comment(V_DETAIL, "Saving PSM: scan %i, charge %i, "
-                               "qvalue %.3g, seq %s.", curPSM_->specKey,
-                               curPSM_->charge, curPSM_->score, 
-                               curPSM_->unmodSeq.c_str());
-            curPSM_ = NULL;
+        file.nextLine(line);
+        FieldTokenizer mTokenizer(line, " \t", true);
+        if( mTokenizer.nextFields(fields, M_FIELDS) < M_FIELDS ||
+            !parseDouble(fields[6], qvalue) ){
+            throw BlibException(true, "Could not parse M line %d of '%s'.",
+                                file.lineNumber(), getFileName().c_str());
         }
-        
-        while(file.peek() != 'S') {
-            if(!file.eof())
-                getline(file,buffer);
-            else
-                break;
+
+        // good matches score 0 to threshold
+        if( -1 * qvalue > scoreThreshold ) {// q-values negated by percolator
+            continue;
         }
-        
+
+        curPSM_ = new PSM();
+        curPSM_->charge = charge;
+        curPSM_->specKey = scanNumber;
+        curPSM_->score = -1 * qvalue;
+
+        // get the unmodified seq and mods from the file's version of seq
+        size_t seqLength = min(fields[9].length, sizeof(wholePepSeq) - 1);
+        memcpy(wholePepSeq, fields[9].start, seqLength);
+        wholePepSeq[seqLength] = '\0';
+        parseModifiedSeq(wholePepSeq, curPSM_->unmodSeq, curPSM_->mods);
+        psms_.push_back(curPSM_);
+        Verbosity::comment(V_DETAIL, "Saving PSM: scan %i, charge %i, "
+                           "qvalue %.3g, seq %s.", curPSM_->specKey,
+                           curPSM_->charge, curPSM_->score, 
+                           curPSM_->unmodSeq.c_str());
+        curPSM_ = NULL;
     }
     
     buildTables(PERCOLATOR_QVALUE);
@@ -42,6 +42,7 @@
 #define SQT_READER_H
 
 #include "BuildParser.h"
+#include "MappedTextFile.h"
 
 #define MAX_MODS 128
 
@@ -68,7 +69,7 @@ class SQTreader : public BuildParser {
                         bool hasFlankingAA = true);
 
  private:
-  ifstream file;
+  MappedTextFile file;
   double staticMods[MAX_MODS];
   double diffMods[MAX_MODS];
 
@@ -0,0 +1,174 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * Implementation of the SearchCheckpoint class, which saves and
+ * restores the progress of a search.  The checkpoint is a text file
+ * with a header line, the order spectra are searched in, the
+ * libraries and options of the search as "# name = value" lines, and a
+ * line for each spectrum file:
+ * <next position> <report size> <decoy report size> <last psm id> <name>
+ * separated by tabs.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include "SearchCheckpoint.h"
+#include "Verbosity.h"
+
+namespace BiblioSpec {
+
+const static char* CHECKPOINT_HEADER = "# BlibSearch checkpoint";
+
+SearchCheckpoint::SearchCheckpoint(const string& filename, 
+                                   bool preserveOrder,
+                                   const string& options) :
+    filename_(filename), preserveOrder_(preserveOrder), options_(options)
+{
+}
+
+/**
+ * Read the spectrum files and positions from the checkpoint file,
+ * if there is one.  Die if it was written for a search in a different
+ * order, with different libraries or options, or cannot be parsed.
+ * \returns False if there is no checkpoint file.
+ */
+bool SearchCheckpoint::read(){
+    ifstream file(filename_.c_str());
+    if( ! file.is_open() ){
+        return false;
+    }
+
+    string line;
+    getline(file, line);
+    if( line != CHECKPOINT_HEADER ){
+        Verbosity::error("'%s' is not a BlibSearch checkpoint file.",
+                         filename_.c_str());
+    }
+    getline(file, line);
+    string order = preserveOrder_ ? "order\tfile" : "order\tmz";
+    if( line != order ){
+        Verbosity::error("Checkpoint '%s' is for a search %s "
+                         "--preserve-order.", filename_.c_str(), 
+                         preserveOrder_ ? "without" : "with");
+    }
+
+    string options;
+    while( file.peek() == '#' && getline(file, line) ){
+        options += line + "\n";
+    }
+    if( options != options_ ){
+        Verbosity::debug("Checkpoint options:\n%sSearch options:\n%s",
+                         options.c_str(), options_.c_str());
+        Verbosity::error("Checkpoint '%s' is for a search with different "
+                         "libraries or options.", filename_.c_str());
+    }
+
+    files_.clear();
+    while( getline(file, line) ){
+        istringstream fields(line);
+        CheckpointFile curFile;
+        fields >> curFile.nextPosition >> curFile.reportSize 
+               >> curFile.decoyReportSize >> curFile.lastResultID;
+        fields.ignore(1); // tab before the name
+        getline(fields, curFile.specFileName);
+        if( fields.fail() || curFile.specFileName.empty() ){
+            Verbosity::error("Could not parse line '%s' of checkpoint '%s'.",
+                             line.c_str(), filename_.c_str());
+        }
+        files_.push_back(curFile);
+    }
+    return true;
+}
+
+/**
+ * Replace the checkpoint file with the given state of each spectrum
+ * file.  The new checkpoint is written under a temporary name first
+ * so an interruption leaves the previous one in place.
+ */
+void SearchCheckpoint::write(const vector<CheckpointFile>& files){
+    string tmpName = filename_ + ".tmp";
+    ofstream file(tmpName.c_str());
+    if( ! file.is_open() ){
+        Verbosity::error("Could not write checkpoint file '%s'.",
+                         tmpName.c_str());
+    }
+
+    file << CHECKPOINT_HEADER << endl
+         << "order\t" << (preserveOrder_ ? "file" : "mz") << endl
+         << options_;
+    for(size_t i = 0; i < files.size(); i++){
+        const CheckpointFile& curFile = files.at(i);
+        file << curFile.nextPosition << "\t" << curFile.reportSize << "\t"
+             << curFile.decoyReportSize << "\t" << curFile.lastResultID 
+             << "\t" << curFile.specFileName << endl;
+    }
+    file.close();
+    if( file.fail() ){
+        Verbosity::error("Could not write checkpoint file '%s'.",
+                         tmpName.c_str());
+    }
+
+#ifdef _MSC_VER
+    ::remove(filename_.c_str()); // rename won't replace it
+#endif
+    if( ::rename(tmpName.c_str(), filename_.c_str()) != 0 ){
+        Verbosity::error("Could not replace checkpoint file '%s'.",
+                         filename_.c_str());
+    }
+    files_ = files;
+}
+
+/**
+ * Delete the checkpoint file once the search is complete.
+ */
+void SearchCheckpoint::discard(){
+    ::remove(filename_.c_str());
+    files_.clear();
+}
+
+/**
+ * \returns The state of each spectrum file at the last checkpoint.
+ */
+const vector<CheckpointFile>& SearchCheckpoint::getFiles() const {
+    return files_;
+}
+
+} // namespace BiblioSpec
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,86 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * The SearchCheckpoint records how far a BlibSearch run has got
+ * through each of its spectrum files and how long each output file
+ * was at that point, so that an interrupted search can start again
+ * from there instead of from the beginning.
+ */
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+namespace BiblioSpec {
+
+/**
+ * The state of one spectrum file and its outputs at a checkpoint.
+ */
+struct CheckpointFile {
+    string specFileName;
+    size_t nextPosition;  // in the order the spectra are read
+    long reportSize;      // bytes of matches written, with header
+    long decoyReportSize; // zero if no decoys
+    int lastResultID;     // in the .psm file, zero if none
+
+    CheckpointFile() : nextPosition(0), reportSize(0), decoyReportSize(0),
+        lastResultID(0) {}
+};
+
+class SearchCheckpoint {
+ public:
+    SearchCheckpoint(const string& filename, bool preserveOrder,
+                     const string& options);
+
+    bool read();
+    void write(const vector<CheckpointFile>& files);
+    void discard();
+    const vector<CheckpointFile>& getFiles() const;
+
+ private:
+    string filename_;
+    bool preserveOrder_;  // spectra in file order rather than m/z
+    string options_;      // "# name = value" lines describing the search
+    vector<CheckpointFile> files_;
+};
+
+} // namespace BiblioSpec
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
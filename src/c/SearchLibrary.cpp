@@ -42,24 +42,64 @@ SearchLibrary::SearchLibrary(vector<string>& libfilenames,
                              const ops::variables_map& options_table) :
   peakProcessor_(options_table), 
   weibullEstimator_(options_table),
-  mzWindow_(options_table["mz-window"].as<double>()),
-  minSpecCharge_(options_table["low-charge"].as<int>()),
-  maxSpecCharge_(options_table["high-charge"].as<int>()),
-  compute_pvalues_(options_table["compute-p-values"].as<bool>()),
-  minWeibullScores_(options_table["min-weibull-scores"].as<int>()),
-  decoysPerTarget_(options_table["decoys-per-target"].as<int>()),
-  decoyMzShift_(options_table["circ-shift"].as<double>()),
-  shiftRawSpectra_(options_table["shift-raw-spectrum"].as<bool>()),
-  querySorted_(options_table.count("mz-sort") != 0),
-  printAll_(options_table["print-all-params"].as<bool>())
+  pvalueModel_(&weibullEstimator_),
+  residentLibrary_(NULL)
 {
+    initOptions(options_table);
 
     // create a list of LibReaders from the filenames
     for(size_t i = 0; i < libfilenames.size(); i++){
         Verbosity::debug("Creating reader for library %s.", 
                          libfilenames.at(i).c_str());
         libraries_.push_back(new LibReader(libfilenames.at(i).c_str()));
+        libraries_.back()->setDecodePeaks(false); // see preparePeaks()
     }
+} 
+
+/**
+ * Search spectra already loaded and processed by a ResidentLibrary
+ * rather than reading them from the library files.  The
+ * ResidentLibrary must have been loaded with the same peak processing
+ * options and must outlive this SearchLibrary.
+ */
+SearchLibrary::SearchLibrary(const ResidentLibrary& residentLibrary,
+                             const ops::variables_map& options_table) :
+  peakProcessor_(options_table), 
+  weibullEstimator_(options_table),
+  pvalueModel_(&weibullEstimator_),
+  residentLibrary_(&residentLibrary)
+{
+    initOptions(options_table);
+}
+
+void SearchLibrary::initOptions(const ops::variables_map& options_table){
+    mzWindow_ = options_table["mz-window"].as<double>();
+    tolerancePpm_ = options_table["precursor-tolerance-ppm"].as<double>();
+    minSpecCharge_ = options_table["low-charge"].as<int>();
+    maxSpecCharge_ = options_table["high-charge"].as<int>();
+    compute_pvalues_ = options_table["compute-p-values"].as<bool>();
+    pooledPvalues_ = options_table["pooled-p-values"].as<bool>();
+    poolBinWidth_ = options_table["pool-bin-width"].as<double>();
+    poolWarmupQueries_ = options_table["pool-warmup"].as<int>();
+    if( pooledPvalues_ && (poolBinWidth_ <= 0 || poolWarmupQueries_ < 1) ){
+        Verbosity::error("pool-bin-width and pool-warmup must be positive "
+                         "for pooled-p-values.");
+    }
+    minWeibullScores_ = options_table["min-weibull-scores"].as<int>();
+    decoysPerTarget_ = options_table["decoys-per-target"].as<int>();
+    decoyMzShift_ = options_table["circ-shift"].as<double>();
+    shiftRawSpectra_ = options_table["shift-raw-spectrum"].as<bool>();
+    querySorted_ = (options_table.count("preserve-order") == 0);
+    clusterQueries_ = (options_table.count("cluster-queries") > 0);
+    clusterMzTolerance_ = options_table["cluster-mz-tolerance"].as<double>();
+    clusterMinScore_ = options_table["cluster-min-dotp"].as<double>();
+    reportMatches_ = options_table["report-matches"].as<int>();
+    numClusteredQueries_ = 0;
+    if( clusterQueries_ && ! querySorted_ ){
+        Verbosity::error("Cannot cluster queries with preserve-order.  "
+                         "Queries must be searched in order of m/z.");
+    }
+    printAll_ = options_table["print-all-params"].as<bool>();
   
     // open file for printing weibull parameters, if requested
     // throws exception if no value, so check first
@@ -75,22 +115,23 @@ SearchLibrary::SearchLibrary(vector<string>& libfilenames,
                           << endl;
         weibullParamFile_.precision(4);
     }
-} 
+}
 
 SearchLibrary::~SearchLibrary()
 {
-    for(size_t i = 0; i < cachedDecoySpectra_.size(); i++){
-        delete cachedDecoySpectra_.at(i);
-        cachedDecoySpectra_.at(i) = NULL;
-    }
-    for(size_t i = 0; i < cachedSpectra_.size(); i++){
-        delete cachedSpectra_.at(i);
-        cachedSpectra_.at(i) = NULL;
+    for(map<int, SpectrumCache>::iterator it = spectrumCaches_.begin();
+        it != spectrumCaches_.end(); ++it){
+        clearSpectrumCache(it->second);
     }
     for(size_t i = 0; i < libraries_.size(); i++){
         delete libraries_.at(i);
         libraries_.at(i) = NULL;
     }
+    clearDeque(queryClusters_);
+    if( clusterQueries_ ){
+        Verbosity::status("Used the matches of an earlier query for %d "
+                          "near-duplicate queries.", numClusteredQueries_);
+    }
     if( weibullParamFile_.is_open() ){
         weibullParamFile_.close();
     }
@@ -115,74 +156,237 @@ void SearchLibrary::searchSpectrum(BiblioSpec::Spectrum& querySpec){
         return;
     }
     
-    // clear out previous results and get new lib spec
-    updateSpectrumCache(querySpec.getMz());
+    // near-duplicates of a query already searched get its matches
+    if( clusterQueries_ ){
+        peakProcessor_.processPeaks(&querySpec);
+        QueryCluster* cluster = findQueryCluster(querySpec);
+        if( cluster ){
+            useClusterMatches(querySpec, *cluster);
+            numClusteredQueries_++;
+            return;
+        }
+    }
+
+    // clear out previous results and get new lib spec, only at the
+    // charges this query could have
+    vector<int> searchCharges;
+    getSearchCharges(querySpec, searchCharges);
+    size_t numCached = 0;
+    for(size_t i = 0; i < searchCharges.size(); i++){
+        updateSpectrumCache(querySpec.getMz(), searchCharges[i]);
+        numCached += spectrumCaches_[searchCharges[i]].spectra.size();
+    }
     targetMatches_.clear();
     decoyMatches_.clear();
 
-    if(cachedSpectra_.size() == 0 ){
+    if( numCached == 0 ){
         Verbosity::warn("No library spectra found for query %d "
                         "(precursor m/z %.2f).", querySpec.getScanNumber(), 
                         querySpec.getMz());
         return;
     }
 
-    // process query spectrum
-    peakProcessor_.processPeaks(&querySpec);
+    // process query spectrum, unless done for clustering
+    if( ! clusterQueries_ ){
+        peakProcessor_.processPeaks(&querySpec);
+    }
+
+    runSearch(querySpec, searchCharges);
 
-    runSearch(querySpec);
+    if( clusterQueries_ ){
+        addQueryCluster(querySpec);
+    }
 }
 
 /**
- * Update the contents of the spectrum cache for the next query
- * spectrum.  If query are NOT sorted, empties cache and fetches all
- * spectra in search window.  If query are sorted, removes spectra
- * with mz lower than current search window and adds  
- * spectra up to the max mz of the search window.  Add spec of all
- * charge states and do the charge state filtering at the spectrum
- * comparison. 
+ * Drop the clusters too far below the query's precursor m/z to hold
+ * it and find the one closest to it of the rest.  A query belongs to
+ * a cluster if it has the same charges and its processed peaks score
+ * at least clusterMinScore_ against the cluster's.
+ * \returns The cluster for the query or NULL if there is none.
  */
-void SearchLibrary::updateSpectrumCache(double queryMz){
+SearchLibrary::QueryCluster* 
+SearchLibrary::findQueryCluster(const Spectrum& querySpec){
+    double queryMz = querySpec.getMz();
+    if( ! queryClusters_.empty() && queryMz < queryClusters_.back()->mz ){
+        clearDeque(queryClusters_); // queries not in m/z order
+    }
+    while( ! queryClusters_.empty() && 
+           queryClusters_.front()->mz < queryMz - clusterMzTolerance_ ){
+        delete queryClusters_.front();
+        queryClusters_.pop_front();
+    }
+
+    vector<int> charges;
+    getSearchCharges(querySpec, charges);
+    QueryCluster* bestCluster = NULL;
+    double bestScore = clusterMinScore_;
+    for(size_t i = 0; i < queryClusters_.size(); i++){
+        QueryCluster* cluster = queryClusters_[i];
+        if( cluster->charges != charges ){
+            continue;
+        }
+        double score = DotProduct::comparePeaks(querySpec.getProcessedPeaks(),
+                                                cluster->peaks);
+        if( score >= bestScore ){
+            bestScore = score;
+            bestCluster = cluster;
+        }
+    }
+    return bestCluster;
+}
+
+/**
+ * Start a cluster with the query just searched and a copy of its
+ * matches.
+ */
+void SearchLibrary::addQueryCluster(const Spectrum& querySpec){
+    QueryCluster* cluster = new QueryCluster();
+    cluster->mz = querySpec.getMz();
+    getSearchCharges(querySpec, cluster->charges);
+    cluster->peaks = querySpec.getProcessedPeaks();
+    copyClusterMatches(targetMatches_, cluster->targetMatches, *cluster);
+    copyClusterMatches(decoyMatches_, cluster->decoyMatches, *cluster);
+    queryClusters_.push_back(cluster);
+}
+
+/**
+ * Copy the matches for the cluster.  The library spectra in the cache
+ * may be deleted before the cluster is, so those of the matches that
+ * will be written out (the first reportMatches_ and any tied with
+ * them) are copied too.
+ */
+void SearchLibrary::copyClusterMatches(const vector<Match>& matches,
+                                       vector<Match>& copies,
+                                       QueryCluster& cluster){
+    copies = matches;
+    for(size_t i = 0; i < copies.size(); i++){
+        copies[i].setExpSpec(NULL);
+        if( reportMatches_ < 0 || (int)i < reportMatches_ ||
+            copies[i].getRank() <= reportMatches_ ){
+            RefSpectrum* refCopy = new RefSpectrum(*matches[i].getRefSpec());
+            cluster.refSpectra.push_back(refCopy);
+            copies[i].setRefSpec(refCopy);
+        } else {
+            copies[i].setRefSpec(NULL);
+        }
+    }
+}
+
+/**
+ * Set this query's matches to those of the cluster's query.
+ */
+void SearchLibrary::useClusterMatches(Spectrum& querySpec,
+                                      const QueryCluster& cluster){
+    targetMatches_ = cluster.targetMatches;
+    decoyMatches_ = cluster.decoyMatches;
+    for(size_t i = 0; i < targetMatches_.size(); i++){
+        targetMatches_[i].setExpSpec(&querySpec);
+    }
+    for(size_t i = 0; i < decoyMatches_.size(); i++){
+        decoyMatches_[i].setExpSpec(&querySpec);
+    }
+}
+
+SearchLibrary::QueryCluster::~QueryCluster(){
+    clearVector(refSpectra);
+}
+
+/**
+ * The width of the precursor m/z window on either side of the given
+ * query m/z: mz-window, or precursor-tolerance-ppm of the m/z if that
+ * was given.
+ */
+double SearchLibrary::getMzTolerance(double queryMz){
+    if( tolerancePpm_ > 0 ){
+        return queryMz * tolerancePpm_ / 1000000;
+    }
+    return mzWindow_;
+}
+
+/**
+ * Get the precursor charges to fetch library spectra for, each once.
+ * If the query has no charges, use 0 to fetch spectra of all charges.
+ */
+void SearchLibrary::getSearchCharges(const Spectrum& querySpec, 
+                                     vector<int>& charges){
+    charges = querySpec.getPossibleCharges();
+    sort(charges.begin(), charges.end());
+    charges.erase(unique(charges.begin(), charges.end()), charges.end());
+    if( charges.empty() ){
+        charges.push_back(0);
+    }
+}
+
+/**
+ * Update the contents of the spectrum cache for the given charge for
+ * the next query spectrum.  If query are NOT sorted, or this one has
+ * a lower m/z than the last with this charge, empties the cache and
+ * fetches all spectra in search window.  If query are sorted,
+ * removes spectra with mz lower than current search window and adds
+ * spectra up to the max mz of the search window so that each library
+ * spectrum is read and processed once.  Spectra at other charges are
+ * not read at all, except by the cache for charge 0 which holds all
+ * charge states.
+ */
+void SearchLibrary::updateSpectrumCache(double queryMz, int charge){
+
+    SpectrumCache& cache = spectrumCaches_[charge];
 
     // mz range for the current query spectrum
-    double searchMinMz = queryMz - mzWindow_;
-    double searchMaxMz = queryMz + mzWindow_;
+    double mzTolerance = getMzTolerance(queryMz);
+    double searchMinMz = queryMz - mzTolerance;
+    double searchMaxMz = queryMz + mzTolerance;
 
     // if query are not sorted, empty cache
-    if( ! querySorted_ ){
-        clearDeque(cachedSpectra_); 
-        clearDeque(cachedDecoySpectra_); 
+    if( ! querySorted_ || queryMz < cache.lastQueryMz ){
+        clearSpectrumCache(cache);
     }
-
-    // remove low mz values from cache
-    //cerr << "Query has mz " << queryMz << ". Removing mz's less than " << searchMinMz << endl;
-    deque<RefSpectrum*>::iterator it = cachedSpectra_.begin();
-    while( it != cachedSpectra_.end() && (*it)->getMz() < searchMinMz ){
-        //cerr << "Deleteing mz " << (*it)->getMz() << endl;
-        it++;
-        cachedSpectra_.pop_front(); 
+    cache.lastQueryMz = queryMz;
+
+    // remove low mz values from cache, keeping the same (min, max]
+    // range as fetching the window from the library
+    while( ! cache.spectra.empty() && 
+           cache.spectra.front()->getMz() <= searchMinMz ){
+        if( residentLibrary_ == NULL ){
+            delete cache.spectra.front();
+        }
+        cache.spectra.pop_front(); 
     }
-    it = cachedDecoySpectra_.begin();
-    while( it != cachedDecoySpectra_.end() && (*it)->getMz() < searchMinMz ){
-        it++;
-        cachedDecoySpectra_.pop_front(); 
+    while( ! cache.decoySpectra.empty() && 
+           cache.decoySpectra.front()->getMz() <= searchMinMz ){
+        delete cache.decoySpectra.front();
+        cache.decoySpectra.pop_front(); 
     }
 
     // find the lower bound of new spec to get, min search range if cache empty
     double addMinMz = searchMinMz;
-    if( ! cachedSpectra_.empty() ){ 
-        addMinMz = cachedSpectra_.back()->getMz(); 
+    if( ! cache.spectra.empty() ){ 
+        addMinMz = cache.spectra.back()->getMz(); 
     }
 
     // get spec from all libs
-    getLibrarySpec(addMinMz, searchMaxMz);
+    getLibrarySpec(addMinMz, searchMaxMz, charge, cache);
 
     // sort the cache
-    sort(cachedSpectra_.begin(), cachedSpectra_.end(), compSpecPtrMz());
-    sort(cachedDecoySpectra_.begin(), cachedDecoySpectra_.end(), 
+    sort(cache.spectra.begin(), cache.spectra.end(), compSpecPtrMz());
+    sort(cache.decoySpectra.begin(), cache.decoySpectra.end(), 
          compSpecPtrMz());
 }
 
+/**
+ * Remove all spectra from the cache, deleting those that belong to
+ * it.  Spectra from a ResidentLibrary belong to the ResidentLibrary.
+ */
+void SearchLibrary::clearSpectrumCache(SpectrumCache& cache){
+    if( residentLibrary_ ){
+        cache.spectra.clear();
+    } else {
+        clearDeque(cache.spectra); 
+    }
+    clearDeque(cache.decoySpectra); 
+}
+
 /**
  * Before searching each spectrum, set the appropriate precursor m/z
  * range and charge states.
@@ -191,8 +395,8 @@ void SearchLibrary::initLibraries(Spectrum& querySpec){
     // TODO: for cache, set min as max(cacheMax, searchMin)
     //       max is still searchMax. charge is all charges
     // set the precursor m/z range  and charge states in each library
-    double minMZ = querySpec.getMz() - mzWindow_;
-    double maxMZ = querySpec.getMz() + mzWindow_;
+    double minMZ = querySpec.getMz() - getMzTolerance(querySpec.getMz());
+    double maxMZ = querySpec.getMz() + getMzTolerance(querySpec.getMz());
     for(size_t i = 0; i < libraries_.size(); i++){
         LibReader* curLibrary = libraries_.at(i);
 
@@ -229,43 +433,65 @@ void SearchLibrary::initLibraries(Spectrum& querySpec){
 }
 
 /**
- * Fill cachedSpectra_ with reference spectra from the libraries.
- * Also fills cachedDecoySpectra_ if decoysPerTarget_ is non-zero.
- * Spectra will have precursor m/z between minMz and maxMz and be at
- * all charge states.
+ * Fill the cache with reference spectra from the libraries.
+ * Also fills its decoy spectra if decoysPerTarget_ is non-zero.
+ * Spectra will have precursor m/z between minMz and maxMz and the
+ * given charge, or be at all charge states if charge is 0.  Their
+ * peaks are decoded and processed by preparePeaks() when they are
+ * first compared, except that targets for decoys are prepared now.
  * Generates randomized spectra if shiftMz is greater than 0.  Can
  * either process peaks and then shift or shift then process.
  */
-void SearchLibrary::getLibrarySpec(double minMz, double maxMz){
+void SearchLibrary::getLibrarySpec(double minMz, double maxMz, int charge,
+                                   SpectrumCache& cache){
     
+    size_t numLibraries = residentLibrary_ ? 
+        residentLibrary_->getNumLibraries() : libraries_.size();
+    deque<RefSpectrum*>& cachedSpectra = cache.spectra;
+    deque<RefSpectrum*>& cachedDecoySpectra = cache.decoySpectra;
+
     // for each library being searched
-    for(size_t lib_i = 0; lib_i < libraries_.size(); lib_i++){
+    for(size_t lib_i = 0; lib_i < numLibraries; lib_i++){
         // library index is 0 for decoy spectra
         int libIndex = lib_i + 1;
 
         // after adding, preprocess starting with this index
-        size_t startIdx = cachedSpectra_.size(); 
-        // TODO add a min-peaks optin and use here for 5
-        libraries_.at(lib_i)->getSpecInMzRange(minMz, maxMz, 5, cachedSpectra_);
+        size_t startIdx = cachedSpectra.size(); 
+        if( residentLibrary_ ){
+            // already processed, with lib ids set
+            residentLibrary_->getSpecInMzRange(lib_i, minMz, maxMz, charge,
+                                               cachedSpectra);
+        } else {
+            // TODO add a min-peaks optin and use here for 5
+            libraries_.at(lib_i)->getSpecInMzRange(minMz, maxMz, 5, charge,
+                                                   cachedSpectra);
+        }
         Verbosity::comment(V_DETAIL, "Found %d spec between %.2f and %.2f.",
-                           cachedSpectra_.size() - startIdx, minMz, maxMz);
+                           cachedSpectra.size() - startIdx, minMz, maxMz);
 
-        // process each spectrum and set the lib id
-        for(size_t spec_i = startIdx; spec_i < cachedSpectra_.size(); spec_i++){
-            RefSpectrum* curSpec = cachedSpectra_.at(spec_i);
+        // set the lib id and leave peaks for when they are compared
+        for(size_t spec_i = startIdx; 
+            residentLibrary_ == NULL && spec_i < cachedSpectra.size(); 
+            spec_i++){
+            RefSpectrum* curSpec = cachedSpectra.at(spec_i);
             curSpec->setLibID(libIndex); 
-            peakProcessor_.processPeaks(curSpec);
+            curSpec->setPeaksPending(true);
         }
 
         // generate decoys
         if( decoysPerTarget_ > 0 ){
             Verbosity::debug("Generating decoy spectra.");
-            generateDecoySpectra(startIdx);
+            for(size_t spec_i = startIdx; spec_i < cachedSpectra.size(); 
+                spec_i++){
+                preparePeaks(cachedSpectra.at(spec_i));
+            }
+            size_t decoyStartIdx = cachedDecoySpectra.size();
+            generateDecoySpectra(startIdx, cache);
             if( shiftRawSpectra_ ){ // decoys haven't been processed
-                for(size_t spec_i = startIdx; 
-                    spec_i < cachedDecoySpectra_.size(); 
+                for(size_t spec_i = decoyStartIdx; 
+                    spec_i < cachedDecoySpectra.size(); 
                     spec_i++){
-                    peakProcessor_.processPeaks(cachedDecoySpectra_.at(spec_i));
+                    peakProcessor_.processPeaks(cachedDecoySpectra.at(spec_i));
                 }
             }
         }
@@ -274,18 +500,19 @@ void SearchLibrary::getLibrarySpec(double minMz, double maxMz){
 }
 
 /**
- * Fill the cachedDecoySpectra with shifted copies of those in
- * cachedSpectra_.  Copies all spectra from startIndex to end.
+ * Fill the cache's decoy spectra with shifted copies of its spectra.
+ * Copies all spectra from startIndex to end.
  */
-void SearchLibrary::generateDecoySpectra(int startIndex){
+void SearchLibrary::generateDecoySpectra(int startIndex, 
+                                         SpectrumCache& cache){
     double shiftMz = decoyMzShift_;
     for(int i = 0; i < decoysPerTarget_; i++){
-        for(int spec_i=startIndex; spec_i<(int)cachedSpectra_.size(); spec_i++){
+        for(int spec_i=startIndex; spec_i<(int)cache.spectra.size(); spec_i++){
             RefSpectrum* decoy = 
-                cachedSpectra_.at(spec_i)->newDecoy(shiftMz, 
-                                                    shiftRawSpectra_);
+                cache.spectra.at(spec_i)->newDecoy(shiftMz, 
+                                                   shiftRawSpectra_);
             if( decoy ){ // only add if we could make a decoy from this target
-                cachedDecoySpectra_.push_back(decoy);
+                cache.decoySpectra.push_back(decoy);
             }
         }
 
@@ -293,6 +520,22 @@ void SearchLibrary::generateDecoySpectra(int startIndex){
     } // next set of decoys
 }
 
+/**
+ * Decode and process the peaks of a library spectrum the first time
+ * it is needed.  Does nothing for spectra already prepared.
+ */
+void SearchLibrary::preparePeaks(RefSpectrum* spec){
+    if( ! spec->hasPendingPeaks() ){
+        return;
+    }
+    if( ! spec->decodeStoredPeaks(peakDecoder_) ){
+        Verbosity::warn("Unable to read peaks of library spectrum %d.",
+                        spec->getLibSpecID());
+    }
+    peakProcessor_.processPeaks(spec);
+    spec->setPeaksPending(false);
+}
+
 /**
  * Compare the given query spectrum to all library spectra.  Create a
  * match for each and add to matches.
@@ -305,6 +548,12 @@ void SearchLibrary::scoreMatches(Spectrum& s, deque<RefSpectrum*>& spectra,
     
     // compare all ref spec to query, create match for each
     for(size_t i=0; i< spectra.size(); i++) {
+        if( ! checkCharge(charges, spectra.at(i)->getCharge()) ){
+            continue;
+        }
+
+        preparePeaks(spectra.at(i));
+
         // is there a better place to check this?
         if(spectra.at(i)->getNumProcessedPeaks() == 0 ){ 
             Verbosity::debug("Skipping library spectrum %d.  No peaks.", 
@@ -312,10 +561,6 @@ void SearchLibrary::scoreMatches(Spectrum& s, deque<RefSpectrum*>& spectra,
             continue;
         }
         
-        if( ! checkCharge(charges, spectra.at(i)->getCharge()) ){
-            continue;
-        }
-        
         Match thisMatch(&s, spectra.at(i));  
         
         thisMatch.setMatchLibID(spectra.at(i)->getLibID());
@@ -330,11 +575,14 @@ void SearchLibrary::scoreMatches(Spectrum& s, deque<RefSpectrum*>& spectra,
     }  
 }
     
-// assumes at least one spectrum in allRefs
-void SearchLibrary::runSearch(Spectrum& s)
+// assumes at least one spectrum cached for searchCharges
+void SearchLibrary::runSearch(Spectrum& s, const vector<int>& searchCharges)
 {
-    scoreMatches(s, cachedSpectra_, targetMatches_);
-    scoreMatches(s, cachedDecoySpectra_, decoyMatches_);
+    for(size_t i = 0; i < searchCharges.size(); i++){
+        SpectrumCache& cache = spectrumCaches_[searchCharges[i]];
+        scoreMatches(s, cache.spectra, targetMatches_);
+        scoreMatches(s, cache.decoySpectra, decoyMatches_);
+    }
 
     // keep scores from all target psms for estimating Weibull parameters
     vector<double> allScores;
@@ -345,14 +593,20 @@ void SearchLibrary::runSearch(Spectrum& s)
         }
     }
 
-    // there may have been spectra in cachedSpectra_ but none at the
-    // correct charge state.  Check again
+    // there may have been spectra in the cache but none with peaks.
+    // Check again
     if( targetMatches_.size() == 0 ){
         Verbosity::warn("No library spectra found for query %d "
                         "(precursor m/z %.2f).", s.getScanNumber(), s.getMz());
         return;
     }
-    if( compute_pvalues_ ){
+    // with a fitted pool, no null scores or per-query fit are needed
+    NullPool* pool = NULL;
+    if( compute_pvalues_ && pooledPvalues_ ){
+        pool = &getNullPool(s);
+    }
+    bool usePool = (pool != NULL && pool->fitted);
+    if( compute_pvalues_ && ! usePool ){
         addNullScores(s, allScores);
     }
 
@@ -367,20 +621,90 @@ void SearchLibrary::runSearch(Spectrum& s)
     }
 
     if( compute_pvalues_ ){
-        weibullEstimator_.estimateParams(allScores);
+        // correct for as many tests as a per-query fit would have
+        int numTests = allScores.size();
+        if( usePool ){
+            pvalueModel_ = &pool->model;
+            numTests = max((int)targetMatches_.size(), minWeibullScores_);
+        } else {
+            weibullEstimator_.estimateParams(allScores);
+            pvalueModel_ = &weibullEstimator_;
+            if( pool != NULL ){
+                addToNullPool(*pool, allScores);
+            }
+        }
         
         // print params to file
         if( weibullParamFile_.is_open() ){
             weibullParamFile_ << s.getScanNumber() << "\t"
-                              << weibullEstimator_.getEta() << "\t"
-                              << weibullEstimator_.getBeta() << "\t"
-                              << weibullEstimator_.getShift() << "\t"
-                              << weibullEstimator_.getCorrelation() << "\t"
-                              << weibullEstimator_.getNumPointsFit() 
+                              << pvalueModel_->getEta() << "\t"
+                              << pvalueModel_->getBeta() << "\t"
+                              << pvalueModel_->getShift() << "\t"
+                              << pvalueModel_->getCorrelation() << "\t"
+                              << pvalueModel_->getNumPointsFit() 
                 //(int)(allScores.size() * fraction_to_fit_)
                               << endl;
         }
-        setMatchesPvalues(allScores.size());
+        setMatchesPvalues(*pvalueModel_, numTests);
+    }
+}
+
+/**
+ * Get the pool for the query's precursor m/z bin and charge.  Queries
+ * with more than one possible charge share a pool with charge 0.
+ */
+SearchLibrary::NullPool& SearchLibrary::getNullPool(const Spectrum& s){
+    const vector<int>& charges = s.getPossibleCharges();
+    int charge = (charges.size() == 1) ? charges.front() : 0;
+    int bin = (int)(s.getMz() / poolBinWidth_);
+    pair<int, int> key(bin, charge);
+
+    map< pair<int, int>, NullPool >::iterator found = nullPools_.find(key);
+    if( found == nullPools_.end() ){
+        found = nullPools_.insert(make_pair(key, 
+                                            NullPool(weibullEstimator_))).first;
+    }
+    return found->second;
+}
+
+/**
+ * Add the scores of one query, all but its best which is likely a
+ * true match, to the pool.  After every poolWarmupQueries_ queries,
+ * try to fit the pool's model if it has at least min-weibull-scores.
+ * Once it fits, the scores are no longer needed.  After
+ * MAX_FAILED_POOL_FITS failures the pool is abandoned and its queries
+ * are fit one at a time.
+ */
+void SearchLibrary::addToNullPool(NullPool& pool, 
+                                  const vector<double>& scores){
+    if( scores.empty() || pool.abandoned ){
+        return;
+    }
+    size_t best = max_element(scores.begin(), scores.end()) - scores.begin();
+    for(size_t i = 0; i < scores.size(); i++){
+        if( i != best ){
+            pool.scores.push_back(scores[i]);
+        }
+    }
+    pool.numQueries++;
+
+    if( pool.numQueries % poolWarmupQueries_ != 0 ||
+        (int)pool.scores.size() < minWeibullScores_ ){
+        return;
+    }
+    if( pool.model.estimateParams(pool.scores) ){
+        Verbosity::debug("Fit pooled Weibull to %d scores from %d queries.",
+                         pool.scores.size(), pool.numQueries);
+        pool.fitted = true;
+        vector<double>().swap(pool.scores);
+    } else {
+        Verbosity::debug("Could not fit pooled Weibull to %d scores.",
+                         pool.scores.size());
+        pool.failedFits++;
+        if( pool.failedFits >= MAX_FAILED_POOL_FITS ){
+            pool.abandoned = true;
+            vector<double>().swap(pool.scores);
+        }
     }
 }
 
@@ -409,14 +733,14 @@ void SearchLibrary::setRank(){
  * Update each Match with its p_value.  Assumes parameters have been
  * estimated and that matches are sorted in descending order by score/p-value.
  */
-void SearchLibrary::setMatchesPvalues(int numScoresForEstimation)
+void SearchLibrary::setMatchesPvalues(const WeibullPvalue& model, 
+                                      int numTests)
 {
     for(int i=0; i<(int)targetMatches_.size();i++) {
 
         double dotp = targetMatches_.at(i).getScore(DOTP);
-        double pval = weibullEstimator_.computePvalue(dotp);
-        double correctedPval = 
-            weibullEstimator_.bonferroniCorrectPvalue(pval);
+        double pval = model.computePvalue(dotp);
+        double correctedPval = model.bonferroniCorrectPvalue(pval, numTests);
         
         targetMatches_.at(i).setScore(RAW_PVAL, pval);
         targetMatches_.at(i).setScore(BONF_PVAL, correctedPval);
@@ -443,17 +767,17 @@ const vector<Match>& SearchLibrary::getDecoyMatches()
 // get weibull parameters
 float SearchLibrary::getShape()
 {
-    return (float)weibullEstimator_.getBeta();
+    return (float)pvalueModel_->getBeta();
 }
 
 float SearchLibrary::getScale()
 {
-    return (float)weibullEstimator_.getEta();
+    return (float)pvalueModel_->getEta();
 }
 
 float SearchLibrary::getFraction2Fit()
 {
-    return (float)weibullEstimator_.getFractionFit();
+    return (float)pvalueModel_->getFractionFit();
 }
 //get weibullHistogram
 void SearchLibrary::getWeibullHistogram(int hist[], int numElements)
@@ -482,7 +806,7 @@ bool SearchLibrary::compMatchDotScore(Match m1, Match m2)
  *  Generate more scores by creating decoy spectra and comparing them
  *  to query.  Create one decoy for each target until there are the
  *  minimum number of scores.  Do not save decoy spectrum or its
- *  Match.  Makes no changes to cachedSpectra_.
+ *  Match.  Makes no changes to the spectrum caches.
  */
 void SearchLibrary::addNullScores(Spectrum s, vector<double>& allScores){
     int shiftAmount = 5;
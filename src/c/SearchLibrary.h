@@ -48,11 +48,13 @@
 #include <vector>
 #include <string>
 #include <deque>
+#include <map>
 #include "DotProduct.h"
 #include "Match.h"
 #include "PeakProcess.h"
 #include "Verbosity.h"
 #include "LibReader.h"
+#include "ResidentLibrary.h"
 #include "WeibullPvalue.h"
 #include "Spectrum.h"
 #include "boost/program_options.hpp"
@@ -69,8 +71,11 @@ class SearchLibrary{
 
  private:
   PeakProcessor peakProcessor_;
+  PeakDecoder peakDecoder_; // for candidates' stored peaks
   WeibullPvalue weibullEstimator_;
+  const WeibullPvalue* pvalueModel_; // estimator used for the last query
   double mzWindow_;
+  double tolerancePpm_;  // if > 0, use instead of mzWindow_
   int minSpecCharge_;
   int maxSpecCharge_;
   bool compute_pvalues_;
@@ -80,10 +85,66 @@ class SearchLibrary{
   bool shiftRawSpectra_;
   bool querySorted_;
   vector<LibReader*> libraries_;
+  const ResidentLibrary* residentLibrary_; // used instead of libraries_
   vector<Match> targetMatches_;          // target matches for a single spectrum
   vector<Match> decoyMatches_;           // decoy matches for a single spectrum
-  deque<RefSpectrum*> cachedSpectra_;    // store spectra here for searching
-  deque<RefSpectrum*> cachedDecoySpectra_;// store decoy spectra for searching
+
+  /**
+   * Library spectra at one precursor charge in the search window of
+   * the last query with that charge, and their decoys.
+   */
+  struct SpectrumCache {
+      deque<RefSpectrum*> spectra;
+      deque<RefSpectrum*> decoySpectra;
+      double lastQueryMz; // precursor m/z of the last query it was used for
+      SpectrumCache() : lastQueryMz(0) {}
+  };
+  map<int, SpectrumCache> spectrumCaches_; // by charge, 0 for any charge
+
+  /**
+   * Scores collected from the queries in one precursor m/z bin at one
+   * charge and the Weibull fit to them once there are enough.
+   */
+  struct NullPool {
+      vector<double> scores;
+      int numQueries;     // queries whose scores were added
+      int failedFits;     // refits that did not converge
+      bool fitted;        // model holds parameters for the bin
+      bool abandoned;     // too many failed fits, no longer collected
+      WeibullPvalue model;
+      NullPool(const WeibullPvalue& settings) : 
+          numQueries(0), failedFits(0), fitted(false), abandoned(false),
+          model(settings) {}
+  };
+  bool pooledPvalues_;    // use a NullPool per bin once fitted
+  double poolBinWidth_;
+  int poolWarmupQueries_; // queries to collect before fitting a pool
+  const static int MAX_FAILED_POOL_FITS = 3;
+  map< pair<int, int>, NullPool > nullPools_; // by m/z bin and charge
+
+  /**
+   * A query that was searched and the matches it found, kept for the
+   * queries after it that are near-duplicates of it.  Matches that
+   * are written out refer to copies of their library spectra owned
+   * by the cluster; the rest are kept only to be counted and have no
+   * library spectrum.
+   */
+  struct QueryCluster {
+      double mz;
+      vector<int> charges;
+      vector<PEAK_T> peaks;        // processed peaks of the query
+      vector<Match> targetMatches;
+      vector<Match> decoyMatches;
+      vector<RefSpectrum*> refSpectra;
+      QueryCluster() : mz(0) {}
+      ~QueryCluster();
+  };
+  bool clusterQueries_;        // reuse results for near-duplicate queries
+  double clusterMzTolerance_;
+  double clusterMinScore_;     // dot product of the queries' peaks
+  int reportMatches_;          // matches written out per query
+  int numClusteredQueries_;    // that reused another query's matches
+  deque<QueryCluster*> queryClusters_; // by precursor m/z
    
   ofstream weibullParamFile_;
   bool printAll_;
@@ -92,12 +153,12 @@ class SearchLibrary{
   
   SearchLibrary(vector<string>& libfilenames,
                 const ops::variables_map& options_table);
+  SearchLibrary(const ResidentLibrary& residentLibrary,
+                const ops::variables_map& options_table);
   ~SearchLibrary();
 
   void searchSpectrum(BiblioSpec::Spectrum& querySpec);
-  void getLibrarySpec(double minMz, double maxMz);
-  void generateDecoySpectra(int startIdx);
-  void runSearch(Spectrum& s);
+  void runSearch(Spectrum& s, const vector<int>& searchCharges);
   const vector<Match>& getTargetMatches();
   const vector<Match>& getDecoyMatches();
 
@@ -108,12 +169,28 @@ class SearchLibrary{
   void getWeibullHistogram(int hist[], int numElements);
   
  private:
+  void initOptions(const ops::variables_map& options_table);
   void initLibraries(Spectrum& spec);
+  double getMzTolerance(double queryMz);
+  void getSearchCharges(const Spectrum& querySpec, vector<int>& charges);
+  void clearSpectrumCache(SpectrumCache& cache);
   bool checkCharge(const vector<int>& queryCharges, int libCharge);
   void scoreMatches(Spectrum& s, deque<RefSpectrum*>& spectra, 
                     vector<Match>& matches);
-  void setMatchesPvalues(int numScores);
-  void updateSpectrumCache(double queryMz);
+  void setMatchesPvalues(const WeibullPvalue& model, int numTests);
+  NullPool& getNullPool(const Spectrum& s);
+  void addToNullPool(NullPool& pool, const vector<double>& scores);
+  void updateSpectrumCache(double queryMz, int charge);
+  void getLibrarySpec(double minMz, double maxMz, int charge, 
+                      SpectrumCache& cache);
+  void generateDecoySpectra(int startIdx, SpectrumCache& cache);
+  void preparePeaks(RefSpectrum* spec);
+  QueryCluster* findQueryCluster(const Spectrum& querySpec);
+  void addQueryCluster(const Spectrum& querySpec);
+  void copyClusterMatches(const vector<Match>& matches,
+                          vector<Match>& copies, QueryCluster& cluster);
+  void useClusterMatches(Spectrum& querySpec, 
+                         const QueryCluster& cluster);
   void addNullScores(Spectrum s, vector<double>& scores);
   void setRank();
 
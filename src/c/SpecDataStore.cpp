@@ -0,0 +1,167 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+/*
+ * Implementation of SpecDataStore, bounded-memory storage of spectra
+ * waiting to be inserted into a library.
+ */
+
+#include "stdafx.h"
+#include "SpecDataStore.h"
+#include <string.h>
+
+namespace BiblioSpec {
+
+SpecDataStore::SpecDataStore(const std::string& spillName,
+                             size_t maxMemoryBytes)
+  : maxMemoryBytes_(maxMemoryBytes), memoryBytes_(0), 
+    spillName_(spillName), spillFile_(NULL), spillSize_(0)
+{
+}
+
+SpecDataStore::~SpecDataStore(){
+    for(size_t i = 0; i < entries_.size(); i++){
+        delete [] entries_[i].mzs;
+        delete [] entries_[i].intensities;
+    }
+    if( spillFile_ != NULL ){
+        fclose(spillFile_);
+        ::remove(spillName_.c_str());
+    }
+}
+
+size_t SpecDataStore::add(SpecData& spec){
+    Entry entry;
+    entry.id = spec.id;
+    entry.retentionTime = spec.retentionTime;
+    entry.mz = spec.mz;
+    entry.numPeaks = spec.numPeaks;
+    entry.mzs = spec.mzs;
+    entry.intensities = spec.intensities;
+    entry.offset = -1;
+    spec.mzs = NULL;
+    spec.intensities = NULL;
+
+    // stored before spilling so the arrays are freed if that fails
+    entries_.push_back(entry);
+
+    size_t peakBytes = 0;
+    if( entry.numPeaks > 0 ){
+        peakBytes = entry.numPeaks * (sizeof(double) + sizeof(float));
+    }
+    if( memoryBytes_ + peakBytes > maxMemoryBytes_ ){
+        spill(entries_.back());
+    } else {
+        memoryBytes_ += peakBytes;
+    }
+
+    return entries_.size() - 1;
+}
+
+/**
+ * Write the entry's peaks to the end of the temporary file and free
+ * the arrays.
+ */
+void SpecDataStore::spill(Entry& entry){
+    if( spillFile_ == NULL ){
+        spillFile_ = fopen(spillName_.c_str(), "w+b");
+        if( spillFile_ == NULL ){
+            throw BlibException(false, "Could not create temporary file "
+                                "'%s' for storing spectra.", 
+                                spillName_.c_str());
+        }
+    }
+
+    entry.offset = spillSize_;
+    if( entry.numPeaks > 0 ){
+        if( fseeko(spillFile_, spillSize_, SEEK_SET) != 0 ||
+            fwrite(entry.mzs, sizeof(double), entry.numPeaks, spillFile_)
+            != (size_t)entry.numPeaks ||
+            fwrite(entry.intensities, sizeof(float), entry.numPeaks, 
+                   spillFile_) != (size_t)entry.numPeaks ){
+            throw BlibException(false, "Could not write spectrum %d to "
+                                "temporary file '%s'.", entry.id,
+                                spillName_.c_str());
+        }
+        spillSize_ += entry.numPeaks * (sizeof(double) + sizeof(float));
+    }
+
+    delete [] entry.mzs;
+    delete [] entry.intensities;
+    entry.mzs = NULL;
+    entry.intensities = NULL;
+}
+
+void SpecDataStore::get(size_t handle, SpecData& returnData, bool getPeaks){
+    Entry& entry = entries_.at(handle);
+
+    returnData.id = entry.id;
+    returnData.retentionTime = entry.retentionTime;
+    returnData.mz = entry.mz;
+    returnData.numPeaks = entry.numPeaks;
+
+    delete [] returnData.mzs;
+    delete [] returnData.intensities;
+    returnData.mzs = NULL;
+    returnData.intensities = NULL;
+
+    if( !getPeaks || entry.numPeaks <= 0 ){
+        return;
+    }
+
+    returnData.mzs = new double[entry.numPeaks];
+    returnData.intensities = new float[entry.numPeaks];
+    if( entry.offset < 0 ){ // still in memory
+        memcpy(returnData.mzs, entry.mzs, entry.numPeaks * sizeof(double));
+        memcpy(returnData.intensities, entry.intensities, 
+               entry.numPeaks * sizeof(float));
+        return;
+    }
+
+    if( fseeko(spillFile_, entry.offset, SEEK_SET) != 0 ||
+        fread(returnData.mzs, sizeof(double), entry.numPeaks, spillFile_)
+        != (size_t)entry.numPeaks ||
+        fread(returnData.intensities, sizeof(float), entry.numPeaks, 
+              spillFile_) != (size_t)entry.numPeaks ){
+        throw BlibException(false, "Could not read spectrum %d from "
+                            "temporary file '%s'.", entry.id, 
+                            spillName_.c_str());
+    }
+}
+
+} // namespace
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
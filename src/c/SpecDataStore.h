@@ -0,0 +1,107 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * Holds the spectra read from a results file that also contains the
+ * peaks (e.g. X! Tandem, Protein Pilot) until they are inserted into
+ * the library.  Peak arrays are kept in memory until their total size
+ * reaches a limit, after which they are written to a temporary file
+ * and read back when requested.  Precursor information is always kept
+ * in memory.  The temporary file is given a name by the caller, so it
+ * can be put somewhere writable such as next to the library being
+ * built, and is removed when the store is destroyed.
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "BlibUtils.h"
+#include "SpecFileReader.h"
+
+namespace BiblioSpec {
+
+class SpecDataStore {
+ public:
+    SpecDataStore(const std::string& spillName,
+                  size_t maxMemoryBytes = DEFAULT_MAX_MEMORY);
+    ~SpecDataStore();
+
+    /**
+     * Store the spectrum, taking ownership of its peak arrays (they
+     * are set to NULL in spec).  \returns A handle for retrieving it.
+     */
+    size_t add(SpecData& spec);
+
+    /**
+     * Copy the stored spectrum into returnData, allocating new peak
+     * arrays if getPeaks is true.
+     */
+    void get(size_t handle, SpecData& returnData, bool getPeaks = true);
+
+    size_t size() const { return entries_.size(); }
+
+    static const size_t DEFAULT_MAX_MEMORY = 256 * 1024 * 1024;
+
+ private:
+    struct Entry {
+        int id;
+        double retentionTime;
+        double mz;
+        int numPeaks;
+        double* mzs;        // NULL if spilled
+        float* intensities; // NULL if spilled
+        long long offset;   // position in spillFile_ if spilled
+    };
+
+    std::vector<Entry> entries_;
+    size_t maxMemoryBytes_;
+    size_t memoryBytes_;   // size of peaks held in memory
+    std::string spillName_;
+    FILE* spillFile_;
+    long long spillSize_;  // bytes written to spillFile_
+
+    void spill(Entry& entry);
+
+    // not copyable
+    SpecDataStore(const SpecDataStore&);
+    SpecDataStore& operator=(const SpecDataStore&);
+};
+
+} // namespace
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
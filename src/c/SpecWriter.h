@@ -0,0 +1,257 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * The SpecWriter is the base class for writing library spectra to a
+ * file in some format.  Spectra are formatted into a buffer that is
+ * written to the file when it fills.  Formatting a spectrum does not
+ * change the writer so that several threads can format spectra for
+ * one writer, as long as the text is written in order.
+ */
+
+#include "Verbosity.h"
+#include "BlibUtils.h"
+#include "RefSpectrum.h"
+#include "boost/program_options.hpp"
+#include <fstream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace ops = boost::program_options;
+
+namespace BiblioSpec {
+
+class SpecWriter {
+ public:
+    SpecWriter(const ops::variables_map& options_table) :
+    mzPrecision_(options_table["mz-precision"].as<int>()),
+    intensityPrecision_(options_table["intensity-precision"].as<int>())
+    {
+        buffer_.reserve(BUFFER_SIZE + BUFFER_SIZE / 4);
+    };
+
+    virtual ~SpecWriter(){
+        close();
+    };
+
+    /** 
+     * Open the filename given and prepare to write to the file.  Write
+     * the format's file header unless writing a part of a file that
+     * will be appended to another.  Exits if the file can't be opened.
+     */ 
+    void openFile(const char* filename, bool writeHeader = true){
+        Verbosity::comment(V_DETAIL, "Opening '%s' for writing spectra.",
+                           filename);
+        filename_ = filename;
+        ios_base::openmode mode = ios_base::out;
+        if( isBinary() ){
+            mode |= ios_base::binary;
+        }
+        file_.open(filename, mode);
+
+        if( ! file_.is_open() ){
+            Verbosity::error("Cannot open %s for writing spectra.", filename);
+        }
+        if( writeHeader ){
+            formatHeader(buffer_);
+        }
+    };
+
+    /**
+     * Write the name of the library to the file, if the format has a
+     * place for it.
+     */
+    void writeLibName(const char* libName){
+        if( ! file_.is_open() ){
+            Verbosity::error("Cannot write library name to un-open file.");
+        }
+        formatLibName(libName, buffer_);
+    };
+
+    /**
+     * Write the given spectrum to file.
+     */
+    bool writeSpectrum(const RefSpectrum& spec){
+        formatSpectrum(spec, startSpectrum(spec), buffer_);
+        if( buffer_.size() >= BUFFER_SIZE ){
+            flush();
+        }
+        return true;
+    };
+
+    /**
+     * Note that the given spectrum is the next one in the file.  Must
+     * be called for every spectrum, in order, before formatting it.
+     * \returns A format flag to pass to formatSpectrum().
+     */
+    virtual bool startSpectrum(const RefSpectrum& spec){
+        return false;
+    };
+
+    /**
+     * Note that this writer's spectra follow some already written by
+     * another writer, as when parts of a file are written separately.
+     */
+    virtual void continueFile(){};
+
+    /**
+     * Append the given spectrum, in this format, to out.
+     */
+    virtual void formatSpectrum(const RefSpectrum& spec, bool formatFlag,
+                                string& out) = 0;
+
+    /**
+     * Write text formatted by formatSpectrum() to the file.
+     */
+    void writeFormatted(const string& text){
+        flush();
+        file_.write(text.data(), text.size());
+    };
+
+    /**
+     * Copy the contents of the given file, as written by another
+     * writer without a header, to the end of this one.
+     */
+    void appendFile(const char* filename){
+        flush();
+        ifstream part(filename, ios_base::in | ios_base::binary);
+        if( ! part.is_open() ){
+            Verbosity::error("Cannot read %s to append it to %s.", 
+                             filename, filename_.c_str());
+        }
+        vector<char> block(BUFFER_SIZE);
+        while( part ){
+            part.read(&block[0], block.size());
+            file_.write(&block[0], part.gcount());
+        }
+    };
+
+    void close(){
+        if( file_.is_open() ){
+            flush();
+            file_.close();
+        }
+    };
+
+ protected:
+    static const size_t BUFFER_SIZE = 4 * 1024 * 1024;
+
+    int mzPrecision_;
+    int intensityPrecision_;
+
+    /** \returns True if the file must be opened in binary mode. */
+    virtual bool isBinary(){ return false; };
+    virtual void formatHeader(string& out){};
+    virtual void formatLibName(const char* libName, string& out){};
+
+    static void appendInt(string& out, int value){
+        char digits[16];
+        char* pos = digits + sizeof(digits);
+        unsigned int magnitude = (value < 0) ? 0u - value : value;
+        do {
+            *--pos = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        } while( magnitude > 0 );
+        if( value < 0 ){
+            *--pos = '-';
+        }
+        out.append(pos, digits + sizeof(digits) - pos);
+    };
+
+    /**
+     * Append the value as printf's %.*f would, without going through
+     * printf unless the value is close enough to halfway between two
+     * printed values that the rounding could differ.
+     */
+    static void appendFixed(string& out, double value, int precision){
+        static const double scales[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+                                         1e7, 1e8, 1e9 };
+        if( value > 0 && precision >= 0 && precision <= 9 ){
+            double scaled = value * scales[precision];
+            double whole = floor(scaled);
+            double fraction = scaled - whole;
+            if( scaled < 1e9 && fabs(fraction - 0.5) > 1e-6 ){
+                unsigned long long digitsValue = (unsigned long long)whole;
+                if( fraction > 0.5 ){
+                    digitsValue++;
+                }
+                char digits[32];
+                char* pos = digits + sizeof(digits);
+                for(int i = 0; i < precision; i++){
+                    *--pos = (char)('0' + digitsValue % 10);
+                    digitsValue /= 10;
+                }
+                if( precision > 0 ){
+                    *--pos = '.';
+                }
+                do {
+                    *--pos = (char)('0' + digitsValue % 10);
+                    digitsValue /= 10;
+                } while( digitsValue > 0 );
+                out.append(pos, digits + sizeof(digits) - pos);
+                return;
+            }
+        }
+        // room for the largest double in fixed notation
+        vector<char> number(320 + (precision > 0 ? precision : 6));
+        sprintf(&number[0], "%.*f", precision, value);
+        out += &number[0];
+    };
+
+    /** Append the bytes of value as they are in memory. */
+    template<typename T> static void appendRaw(string& out, const T& value){
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    };
+
+ private:
+    ofstream file_;
+    string filename_;
+    string buffer_;     // formatted spectra not yet written
+
+    void flush(){
+        file_.write(buffer_.data(), buffer_.size());
+        buffer_.clear();
+    };
+};
+
+} // namespace BiblioSpec
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -201,6 +201,11 @@ void Spectrum::setRawPeaks(const vector<PEAK_T>& newpeaks) {
     rawPeaks_.assign(newpeaks.begin(), newpeaks.end()); 
 }
 
+// takes the new peaks without copying, leaves the old ones in newpeaks
+void Spectrum::swapRawPeaks(vector<PEAK_T>& newpeaks) {
+    rawPeaks_.swap(newpeaks);
+}
+
 void Spectrum::setProcessedPeaks(const vector<PEAK_T>& newpeaks) {
     processedPeaks_.assign(newpeaks.begin(), newpeaks.end()); 
 }
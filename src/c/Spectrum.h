@@ -143,6 +143,7 @@ class Spectrum
     void setScanNumber(int newNum);
     void setRetentionTime(double rt);
     void setRawPeaks(const vector<PEAK_T>& newpeaks);
+    void swapRawPeaks(vector<PEAK_T>& newpeaks);
     void setProcessedPeaks(const vector<PEAK_T>& newpeaks);
     virtual void addCharge(int newz);
     void setMz(double mz);
@@ -51,9 +51,7 @@ namespace BiblioSpec {
 
   SslReader::~SslReader()
   {
-    if( sslFile_.is_open() ){
-      sslFile_.close();
-    }
+    sslFile_.close();
   };
 
   bool SslReader::parseFile(){
@@ -98,16 +96,15 @@ namespace BiblioSpec {
   bool SslReader::openSsl(){
 
     Verbosity::debug("Opening ssl File.");
-    sslFile_.open(sslName_.c_str());
-    if( !sslFile_.is_open() ){
+    if( !sslFile_.open(sslName_.c_str()) ){
       throw BlibException(true, "Could not open ssl file '%s'.", 
                           sslName_.c_str());
     }
     // confirm that header looks correct
-    string line;
-    getline(sslFile_, line);
+    TextSlice line;
+    sslFile_.nextLine(line);
     const char* header = "file\tscan\tcharge\tsequence\tmodifications";
-    if( line.compare(0, strlen(header), header) ){
+    if( !line.startsWith(header) ){
       throw BlibException(false,
                           "SSL header is not correct.  Should be '%s'.", 
                           header);
@@ -118,35 +115,37 @@ namespace BiblioSpec {
   /**
    * Read the ssl file and parse all psms.  Store them by ms2 file
    * name.  Assumes .ssl file has been opened and is pointing to first
-   * record.
+   * record.  Fields are tab-separated.
    */
   void SslReader::collectPsms(){
     // for each line, get ms2 name, scan, charge, seq, mods
-
-    int lineNum = 1;
-    string ms2;
-    string scanStr;
-    string chargeStr;
-    string modSeq;
-    string line;
-    map<string, vector<PSM*> >::iterator mapAccess;
-
-
-    while( !sslFile_.eof() ){
-
-      lineNum++;
+    const int NUM_FIELDS = 5;
+    TextSlice fields[NUM_FIELDS];
+    TextSlice line;
+    TextSlice& ms2 = fields[0];
+    TextSlice& scanStr = fields[1];
+    TextSlice& chargeStr = fields[2];
+    TextSlice& modSeq = fields[4];
+
+    // records are usually grouped by file, so remember the last one
+    // to avoid a map lookup for each line
+    string lastMs2;
+    map<string, vector<PSM*> >::iterator mapAccess = fileMap_.end();
+
+    while( sslFile_.nextLine(line) ){
+
+      FieldTokenizer tokenizer(line, "\t");
+      int numFields = tokenizer.nextFields(fields, NUM_FIELDS);
+      if( numFields < 2 ){
+        continue; // blank line
+      }
 
       curPSM_ = new PSM();
-      // read all values into temp strings
-      sslFile_ >> ms2 >> scanStr >> chargeStr >> curPSM_->unmodSeq >> modSeq;
-      // discard rest of line
-      getline(sslFile_, line);
 
       // parse the scan id, either as an int or as a string
-      try{
-        curPSM_->specKey = boost::lexical_cast<int>(scanStr);
-      } catch(bad_lexical_cast) {
-        curPSM_->specName = scanStr;
+      if( !parseInt(scanStr, curPSM_->specKey) ){
+        curPSM_->specKey = -1;
+        curPSM_->specName = scanStr.str();
       }
 
       // skip this if we didn't get a valid id
@@ -155,51 +154,56 @@ namespace BiblioSpec {
         continue;
       }
 
-      try{
-        curPSM_->charge = boost::lexical_cast<int>(chargeStr);
-      } catch(bad_lexical_cast) {
+      if( numFields < NUM_FIELDS ){
+        Verbosity::error("Line %d has %d fields but should have %d.",
+                         sslFile_.lineNumber(), numFields, NUM_FIELDS);
+      }
+
+      if( !parseInt(chargeStr, curPSM_->charge) ){
         Verbosity::error("The charge '%s' on line %d is not numeric.",
-                         chargeStr.c_str(), lineNum);
+                         chargeStr.str().c_str(), sslFile_.lineNumber());
       }
 
+      curPSM_->unmodSeq.assign(fields[3].start, fields[3].length);
+
       // parse the mod seq into a vector of mods
       parseModSeq(curPSM_->mods, modSeq);
 
       // add the psm to the map
-      mapAccess = fileMap_.find(ms2);
-      if( mapAccess == fileMap_.end() ){ // add this file
-        vector<PSM*> tmpPsms(1, curPSM_);
-        fileMap_[ms2] = tmpPsms;
-      } else { // add curPSM to this file
-        (mapAccess->second).push_back(curPSM_);
+      if( mapAccess == fileMap_.end() || !ms2.equals(lastMs2.c_str()) ){
+        lastMs2 = ms2.str();
+        mapAccess = fileMap_.find(lastMs2);
+        if( mapAccess == fileMap_.end() ){ // add this file
+          mapAccess = fileMap_.insert(
+                        make_pair(lastMs2, vector<PSM*>())).first;
+        }
       }
-
-      ms2.clear();
-      scanStr.clear();
-      chargeStr.clear();
-      modSeq.clear();
+      (mapAccess->second).push_back(curPSM_);
     } // next psm
   }
 
   void SslReader::parseModSeq(vector<SeqMod>& mods, 
-                              string& modSeq){
+                              const TextSlice& modSeq){
     // find next [
     size_t nonAaChars = 0;// for finding aa position
-    size_t openBracket = modSeq.find_first_of("[");
-    while( openBracket != string::npos ){
+    int openBracket = modSeq.find('[');
+    while( openBracket != -1 ){
       SeqMod mod;
       // get mass diff
-      size_t closeBracket = modSeq.find_first_of("]", openBracket);
-      string mass = modSeq.substr(openBracket + 1, 
-                                  closeBracket - openBracket -1);
-      mod.deltaMass = atof( mass.c_str() );
+      int closeBracket = modSeq.find(']', openBracket);
+      if( closeBracket == -1 ){
+        closeBracket = (int)modSeq.length;
+      }
+      parseDouble(modSeq.substr(openBracket + 1, 
+                                closeBracket - openBracket -1),
+                  mod.deltaMass);
       // get position
       mod.position = openBracket - nonAaChars;
       nonAaChars += (closeBracket - openBracket + 1);
       // add to mods
       mods.push_back(mod);
       // find next
-      openBracket = modSeq.find_first_of("[", openBracket + 1);
+      openBracket = modSeq.find('[', openBracket + 1);
     }
   }
 
@@ -32,6 +32,7 @@
 #pragma once
 
 #include "BuildParser.h"
+#include "MappedTextFile.h"
 
 using namespace std;
 
@@ -48,12 +49,12 @@ namespace BiblioSpec {
 
   private:
     string sslName_;
-    ifstream sslFile_;
+    MappedTextFile sslFile_;
     map<string, vector<PSM*> > fileMap_; // vector of PSMs for each spec file
 
     bool openSsl();
     void collectPsms();
-    void parseModSeq(vector<SeqMod>& mods, string& modSeq);
+    void parseModSeq(vector<SeqMod>& mods, const TextSlice& modSeq);
 
   };
 
@@ -48,7 +48,8 @@ TandemNativeParser::TandemNativeParser(BlibBuilder& maker,
     curState_(ROOT_STATE),
     mass_(0),
     numMzs_(0),
-    numIntensities_(0)
+    numIntensities_(0),
+    spectra_(string(maker.getLibName()) + ".spectra.tmp")
 {
    this->setFileName(xmlfilename); // this is for the saxhandler
    setSpecFileName(xmlfilename, // this is for the BuildParser
@@ -63,12 +64,6 @@ TandemNativeParser::TandemNativeParser(BlibBuilder& maker,
 
 TandemNativeParser::~TandemNativeParser() {
     specReader_ = NULL; // so the parent class doesn't try to delete itself
-    // free spectra
-    map<int,SpecData*>::iterator it;
-    for(it = spectra_.begin(); it != spectra_.end(); ++it){
-        delete it->second;
-        it->second = NULL;
-    }
 }
 
 /**
@@ -413,7 +408,7 @@ void TandemNativeParser::clearCurPeaks(){
 }
 
 /**
- * Saves the current data as a new spectrum in the spectra map.
+ * Saves the current data as a new spectrum in the spectra store.
  * Computes precursor mz from mass and charge.  Clears the current
  * data in preparation for the next PSM to parse.
  */
@@ -432,19 +427,19 @@ void TandemNativeParser::saveSpectrum(){
     // compute the mz
     double mz = mass_ / curPSM_->charge; // TODO extra H+??
 
-    // create a new SpecData
-    SpecData* curSpec = new SpecData();
-    curSpec->mz = mz;
-    curSpec->retentionTime = retentionTime_;
-    curSpec->numPeaks = numMzs_;
-    curSpec->mzs = mzs_;
-    curSpec->intensities = intensities_;
+    // store the spectrum, its peaks may be moved out of memory
+    SpecData curSpec;
+    curSpec.id = curPSM_->specKey;
+    curSpec.mz = mz;
+    curSpec.retentionTime = retentionTime_;
+    curSpec.numPeaks = numMzs_;
+    curSpec.mzs = mzs_;
+    curSpec.intensities = intensities_;
     mzs_ = NULL;
     intensities_ = NULL;
 
-    // add to map
     // check to see if it is already there?
-    spectra_[curPSM_->specKey] = curSpec;    
+    spectrumHandles_[curPSM_->specKey] = spectra_.add(curSpec);
 
 }
 
@@ -461,19 +456,18 @@ void TandemNativeParser::setIdType(SPEC_ID_TYPE type){}
 
 /**
  * Return a spectrum via the returnData argument.  If not found in the
- * spectra map, return false and leave returnData unchanged.
+ * spectra store, return false and leave returnData unchanged.
  */
 bool TandemNativeParser::getSpectrum(int identifier, 
                                      SpecData& returnData,
                                      SPEC_ID_TYPE findBy,
                                      bool getPeaks){
-    map<int,SpecData*>::iterator found = spectra_.find(identifier);
-    if( found == spectra_.end() ){
+    map<int,size_t>::iterator found = spectrumHandles_.find(identifier);
+    if( found == spectrumHandles_.end() ){
         return false;
     }
 
-    SpecData* foundData = found->second;
-    returnData = *foundData;
+    spectra_.get(found->second, returnData, getPeaks);
     return true;
 }
 
@@ -43,6 +43,7 @@
 
 #include "BuildParser.h"
 #include "AminoAcidMasses.h"
+#include "SpecDataStore.h"
 #include <assert.h>
 
 using namespace std;
@@ -120,7 +121,8 @@ class TandemNativeParser : public BuildParser, public SpecFileReader
   int numIntensities_; // in the GAML:values element, size of intensities_
   string mzStr_;       // collect char representation of peaks here for parsing
   string intensityStr_;
-  map<int,SpecData*> spectra_;  // key = specKey
+  SpecDataStore spectra_;       // peaks, bounded in memory
+  map<int,size_t> spectrumHandles_; // key = specKey, value = spectra_ handle
 };
 
 } // namespace
@@ -0,0 +1,376 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * Implementation of the TargetDecoyQvalues class.  The best match of
+ * each query is counted as a target or a decoy.  The q-value of a
+ * score is the lowest estimated false discovery rate, the number of
+ * decoys over the number of targets, of any score threshold at or
+ * below it.  PEPs are the ratio of decoys to targets in bins of
+ * score, forced to not increase with score.  With more than one decoy
+ * per target only the best decoy of each query is counted, so the
+ * estimates are conservative.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include "TargetDecoyQvalues.h"
+#include "ExternalSorter.h"
+#include "MappedTextFile.h"
+#include "Verbosity.h"
+
+namespace BiblioSpec {
+
+const static int NUM_PEP_BINS = 100; // across dot products of 0 to 1
+
+enum MATCH_KIND { BEST_TARGET, OTHER_TARGET, BEST_DECOY };
+
+/**
+ * The score of one match and the report line it came from.
+ */
+struct ScoreRecord {
+    double score;
+    long long lineNumber; // in the target report, -1 for decoys
+    int kind;             // a MATCH_KIND
+};
+
+struct ScoreLess {
+    bool operator()(const ScoreRecord& left, const ScoreRecord& right) const {
+        return left.score < right.score;
+    }
+};
+
+/**
+ * The estimates for one line of the target report.
+ */
+struct LineRecord {
+    long long lineNumber;
+    double qValue;
+    double pep;
+};
+
+struct LineLess {
+    bool operator()(const LineRecord& left, const LineRecord& right) const {
+        return left.lineNumber < right.lineNumber;
+    }
+};
+
+TargetDecoyQvalues::TargetDecoyQvalues(const string& targetReportName,
+                                       const string& decoyReportName,
+                                       size_t maxRecordsInMemory) :
+    targetReportName_(targetReportName),
+    decoyReportName_(decoyReportName),
+    maxRecords_(maxRecordsInMemory),
+    numTargets_(0),
+    numDecoys_(0),
+    targetHistogram_(NUM_PEP_BINS, 0),
+    decoyHistogram_(NUM_PEP_BINS, 0)
+{
+}
+
+/**
+ * Add q-value and PEP columns to every match in the target report,
+ * replacing the file.
+ */
+void TargetDecoyQvalues::annotateReport(){
+    Verbosity::status("Computing q-values for '%s'.", 
+                      targetReportName_.c_str());
+
+    ExternalSorter<ScoreRecord, ScoreLess> 
+        scoreSorter(targetReportName_ + ".scores", maxRecords_);
+    readReport(targetReportName_, false, scoreSorter);
+    readReport(decoyReportName_, true, scoreSorter);
+    if( numDecoys_ == 0 ){
+        Verbosity::warn("No decoy matches in '%s'.  All q-values will "
+                        "be 0.", decoyReportName_.c_str());
+    }
+    estimateBinPeps();
+
+    ExternalSorter<LineRecord, LineLess> 
+        lineSorter(targetReportName_ + ".lines", maxRecords_);
+    computeQvalues(scoreSorter, lineSorter);
+    writeReport(lineSorter);
+
+    Verbosity::debug("Estimated q-values from %lld targets and %lld decoys.",
+                     numTargets_, numDecoys_);
+}
+
+/**
+ * Add the score of each match in the report to the sorter and count
+ * the first, best, match of each query in the histograms.
+ */
+template<class SORTER> 
+void TargetDecoyQvalues::readReport(const string& reportName,
+                                    bool isDecoy,
+                                    SORTER& scoreSorter){
+    MappedTextFile report;
+    if( ! report.open(reportName.c_str()) ){
+        Verbosity::error("Could not open report '%s' to compute q-values.",
+                         reportName.c_str());
+    }
+
+    TextSlice line;
+    TextSlice lastQuery;
+    bool inMatches = false; // past the column header
+    long long lineNumber = 0;
+    while( report.nextLine(line) ){
+        lineNumber++;
+        if( ! inMatches ){
+            inMatches = line.startsWith("Query\t");
+            continue;
+        }
+        if( line.empty() ){
+            continue;
+        }
+
+        // query, lib id, lib spec id, rank, dotp
+        TextSlice fields[5];
+        ScoreRecord record;
+        FieldTokenizer tokenizer(line, "\t");
+        if( tokenizer.nextFields(fields, 5) < 5 || 
+            ! parseDouble(fields[4], record.score) ){
+            Verbosity::error("Could not read the score on line %lld of '%s'.",
+                             lineNumber, reportName.c_str());
+        }
+
+        // matches are written together for each query, best first
+        bool best = (lastQuery.start == NULL || 
+                     fields[0].length != lastQuery.length ||
+                     strncmp(fields[0].start, lastQuery.start, 
+                             lastQuery.length) != 0);
+        lastQuery = fields[0];
+
+        int bin = getBin(record.score);
+        if( isDecoy ){
+            if( ! best ){
+                continue;
+            }
+            record.kind = BEST_DECOY;
+            record.lineNumber = -1;
+            numDecoys_++;
+            decoyHistogram_[bin]++;
+        } else {
+            record.lineNumber = lineNumber;
+            if( best ){
+                record.kind = BEST_TARGET;
+                numTargets_++;
+                targetHistogram_[bin]++;
+            } else {
+                record.kind = OTHER_TARGET;
+            }
+        }
+        scoreSorter.add(record);
+    }
+
+    if( ! inMatches ){
+        Verbosity::error("Could not find the column header in report '%s'.",
+                         reportName.c_str());
+    }
+}
+
+/**
+ * Read the scores from lowest to highest and add the q-value and PEP
+ * of each target match to the line sorter.  Decoy and target counts
+ * at or above a score are the totals less those below it, so each
+ * group of equal scores gets its FDR before any of it is read.
+ */
+template<class SCORE_SORTER, class LINE_SORTER> 
+void TargetDecoyQvalues::computeQvalues(SCORE_SORTER& scoreSorter,
+                                        LINE_SORTER& lineSorter){
+    scoreSorter.sort();
+
+    long long targetsBelow = 0;
+    long long decoysBelow = 0;
+    long long groupTargets = 0;
+    long long groupDecoys = 0;
+    double groupScore = 0;
+    double qValue = 1;
+    bool firstRecord = true;
+
+    ScoreRecord record;
+    while( scoreSorter.next(record) ){
+        if( firstRecord || record.score != groupScore ){
+            targetsBelow += groupTargets;
+            decoysBelow += groupDecoys;
+            groupTargets = groupDecoys = 0;
+            groupScore = record.score;
+            firstRecord = false;
+
+            long long targets = numTargets_ - targetsBelow;
+            long long decoys = numDecoys_ - decoysBelow;
+            double fdr = 1;
+            if( targets > 0 && decoys < targets ){
+                fdr = (double)decoys / targets;
+            }
+            if( fdr < qValue ){
+                qValue = fdr;
+            }
+        }
+
+        if( record.kind == BEST_DECOY ){
+            groupDecoys++;
+            continue;
+        } else if( record.kind == BEST_TARGET ){
+            groupTargets++;
+        }
+        LineRecord estimates;
+        estimates.lineNumber = record.lineNumber;
+        estimates.qValue = qValue;
+        estimates.pep = binPeps_[getBin(record.score)];
+        lineSorter.add(estimates);
+    }
+}
+
+/**
+ * Copy the target report to a temporary file with the q-value and
+ * PEP appended to each match and replace the report with it.
+ */
+template<class SORTER> 
+void TargetDecoyQvalues::writeReport(SORTER& lineSorter){
+    lineSorter.sort();
+
+    string tmpName = targetReportName_ + ".tmp";
+    {
+        MappedTextFile report;
+        if( ! report.open(targetReportName_.c_str()) ){
+            Verbosity::error("Could not open report '%s' to add q-values.",
+                             targetReportName_.c_str());
+        }
+        ofstream file(tmpName.c_str(), ios::binary);
+        if( ! file.is_open() ){
+            Verbosity::error("Could not write q-values to '%s'.", 
+                             tmpName.c_str());
+        }
+        file.precision(6);
+
+        LineRecord estimates;
+        bool haveEstimates = lineSorter.next(estimates);
+        TextSlice line;
+        long long lineNumber = 0;
+        while( report.nextLine(line) ){
+            lineNumber++;
+            file.write(line.start, line.length);
+            if( line.startsWith("Query\t") ){
+                file << "q-value\tPEP\t";
+            } else if( haveEstimates && estimates.lineNumber == lineNumber ){
+                file << "\t" << estimates.qValue << "\t" << estimates.pep;
+                haveEstimates = lineSorter.next(estimates);
+            }
+            file << "\n";
+        }
+        if( ! file ){
+            Verbosity::error("Could not write q-values to '%s'.", 
+                             tmpName.c_str());
+        }
+    } // close both files before replacing the report
+
+    ::remove(targetReportName_.c_str()); // rename won't replace it
+    if( ::rename(tmpName.c_str(), targetReportName_.c_str()) != 0 ){
+        Verbosity::error("Could not replace report '%s' with '%s'.",
+                         targetReportName_.c_str(), tmpName.c_str());
+    }
+}
+
+/**
+ * Set the PEP of each score bin to its ratio of decoys to targets,
+ * pooling neighboring bins where needed so that PEP does not increase
+ * with score.  Bins without matches take the PEP of the next higher
+ * bin that has them, or of the highest if there is none.
+ */
+void TargetDecoyQvalues::estimateBinPeps(){
+    // pool adjacent violators, each block a weighted mean over bins
+    vector<double> blockPeps;
+    vector<double> blockWeights;
+    vector<int> blockEnds; // one past the last bin of the block
+    for(int bin = 0; bin < NUM_PEP_BINS; bin++){
+        double weight = targetHistogram_[bin] + decoyHistogram_[bin];
+        if( weight == 0 ){
+            continue;
+        }
+        double pep = 1;
+        if( decoyHistogram_[bin] < targetHistogram_[bin] ){
+            pep = decoyHistogram_[bin] / targetHistogram_[bin];
+        }
+        blockPeps.push_back(pep);
+        blockWeights.push_back(weight);
+        blockEnds.push_back(bin + 1);
+
+        while( blockPeps.size() > 1 && 
+               blockPeps.back() > blockPeps[blockPeps.size() - 2] ){
+            size_t last = blockPeps.size() - 1;
+            double total = blockWeights[last - 1] + blockWeights[last];
+            blockPeps[last - 1] = (blockPeps[last - 1] * blockWeights[last - 1]
+                                   + blockPeps[last] * blockWeights[last])
+                / total;
+            blockWeights[last - 1] = total;
+            blockEnds[last - 1] = blockEnds[last];
+            blockPeps.pop_back();
+            blockWeights.pop_back();
+            blockEnds.pop_back();
+        }
+    }
+
+    binPeps_.assign(NUM_PEP_BINS, 1);
+    int bin = 0;
+    for(size_t block = 0; block < blockPeps.size(); block++){
+        for(; bin < blockEnds[block]; bin++){
+            binPeps_[bin] = blockPeps[block];
+        }
+    }
+    for(; bin < NUM_PEP_BINS && ! blockPeps.empty(); bin++){
+        binPeps_[bin] = blockPeps.back();
+    }
+}
+
+/**
+ * \returns The PEP histogram bin for the score, limited to the range
+ * of the histogram.
+ */
+int TargetDecoyQvalues::getBin(double score) const {
+    int bin = (int)(score * NUM_PEP_BINS);
+    if( bin < 0 ){
+        return 0;
+    }
+    if( bin >= NUM_PEP_BINS ){
+        return NUM_PEP_BINS - 1;
+    }
+    return bin;
+}
+
+} // namespace BiblioSpec
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,85 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+/**
+ * TargetDecoyQvalues adds q-values and posterior error probabilities
+ * (PEPs) to a BlibSearch report, estimated from the matches in the
+ * decoy report written by the same search.  Both reports are read
+ * back from disk and the matches sorted with an ExternalSorter so
+ * that reports of any size can be annotated in bounded memory.
+ */
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace BiblioSpec {
+
+class TargetDecoyQvalues {
+ public:
+    TargetDecoyQvalues(const string& targetReportName,
+                       const string& decoyReportName,
+                       size_t maxRecordsInMemory = 1000000);
+
+    void annotateReport();
+
+ private:
+    string targetReportName_;
+    string decoyReportName_;
+    size_t maxRecords_;        // of each sort held in memory
+    long long numTargets_;     // best target match of each query
+    long long numDecoys_;      // best decoy match of each query
+    vector<double> targetHistogram_; // best matches by score bin
+    vector<double> decoyHistogram_;
+    vector<double> binPeps_;
+
+    template<class SORTER> void readReport(const string& reportName,
+                                           bool isDecoy,
+                                           SORTER& scoreSorter);
+    template<class SCORE_SORTER, class LINE_SORTER> 
+        void computeQvalues(SCORE_SORTER& scoreSorter,
+                            LINE_SORTER& lineSorter);
+    template<class SORTER> void writeReport(SORTER& lineSorter);
+    void estimateBinPeps();
+    int getBin(double score) const;
+};
+
+} // namespace BiblioSpec
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
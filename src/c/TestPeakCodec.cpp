@@ -0,0 +1,170 @@
+/*
+  Copyright (c) 2011, University of Washington
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+    * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer. 
+    * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials provided
+    with the distribution. 
+    * Neither the name of the <ORGANIZATION> nor the names of its
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+*/
+/*
+ * A tester for the peak codecs.  Encodes random spectra with each
+ * codec, decodes them again and checks that zlib and delta-lossless
+ * give back the same values and that delta is within its precision:
+ * half of 1/MZ_FIXED_POINT_SCALE for m/z and half a log step,
+ * 2^(1/2^(INTENSITY_LOG_BITS+1)) - 1 or about 0.14%, for intensity.
+ * Also prints the size and decoding time of each codec.  Exits with 1
+ * if any spectrum does not round-trip.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+#include <vector>
+#include "PeakCodec.h"
+
+using namespace std;
+using namespace BiblioSpec;
+
+struct TestSpectrum {
+    vector<double> mzs;
+    vector<float> intensities;
+};
+
+/**
+ * Fill spec with numPeaks peaks of increasing m/z and intensities
+ * spread over several orders of magnitude, as in real spectra.
+ */
+void makeSpectrum(int numPeaks, TestSpectrum& spec){
+    spec.mzs.resize(numPeaks);
+    spec.intensities.resize(numPeaks);
+    double mz = 100 + rand() % 100;
+    for(int i = 0; i < numPeaks; i++){
+        mz += (rand() % 1000000) / 100000.0 * 4;
+        spec.mzs[i] = mz;
+        spec.intensities[i] = 
+            (float)(pow(10.0, (rand() % 5000) / 1000.0) * (rand() % 97 + 3));
+    }
+}
+
+/**
+ * Encode and decode every spectrum with the given codec and level.
+ * \returns The number of spectra that did not round-trip.
+ */
+int testCodec(const char* codecName, int levelCompress,
+              const vector<TestSpectrum>& spectra){
+    PEAK_CODEC codec;
+    stringToPeakCodec(codecName, codec);
+    bool exact = (codec != DELTA_PEAK_CODEC);
+    double maxMzError = 0.5 / MZ_FIXED_POINT_SCALE + 1e-9;
+    double maxIntensityError = 
+        pow(2.0, 1.0 / (2 << INTENSITY_LOG_BITS)) - 1 + 1e-6;
+
+    vector< vector<unsigned char> > mzBlobs(spectra.size());
+    vector< vector<unsigned char> > intensityBlobs(spectra.size());
+    double rawBytes = 0;
+    double blobBytes = 0;
+    for(size_t i = 0; i < spectra.size(); i++){
+        int numPeaks = (int)spectra[i].mzs.size();
+        encodePeakMzs(codec, levelCompress, numPeaks, &spectra[i].mzs[0],
+                      mzBlobs[i]);
+        encodePeakIntensities(codec, levelCompress, numPeaks, 
+                              &spectra[i].intensities[0], 
+                              intensityBlobs[i]);
+        rawBytes += numPeaks * (sizeof(double) + sizeof(float));
+        blobBytes += mzBlobs[i].size() + intensityBlobs[i].size();
+    }
+
+    int numFailed = 0;
+    vector<double> mzs;
+    vector<float> intensities;
+    clock_t decodeTime = 0;
+    for(size_t i = 0; i < spectra.size(); i++){
+        int numPeaks = (int)spectra[i].mzs.size();
+        mzs.assign(numPeaks, 0);
+        intensities.assign(numPeaks, 0);
+        clock_t start = clock();
+        bool decoded = 
+            decodePeakMzs(numPeaks, &mzBlobs[i][0], 
+                          (int)mzBlobs[i].size(), &mzs[0]) &&
+            decodePeakIntensities(numPeaks, &intensityBlobs[i][0], 
+                                  (int)intensityBlobs[i].size(), 
+                                  &intensities[0]);
+        decodeTime += clock() - start;
+
+        bool same = decoded;
+        for(int j = 0; j < numPeaks && same; j++){
+            double expectedMz = spectra[i].mzs[j];
+            double expectedIntensity = spectra[i].intensities[j];
+            if( exact ){
+                same = (mzs[j] == expectedMz && 
+                        intensities[j] == expectedIntensity);
+            } else {
+                same = (fabs(mzs[j] - expectedMz) <= maxMzError &&
+                        fabs(intensities[j] - expectedIntensity) <=
+                        maxIntensityError * expectedIntensity);
+            }
+        }
+        if( !same ){
+            numFailed++;
+        }
+    }
+
+    printf("%-15s level %d: %5.1f%% of raw size, decoded in %6.1f ms, "
+           "%d failed\n", codecName, levelCompress, 
+           100 * blobBytes / rawBytes, 
+           1000.0 * decodeTime / CLOCKS_PER_SEC, numFailed);
+    return numFailed;
+}
+
+int main(int argc, char** argv){
+    int numSpectra = 2000;
+    if( argc > 2 || (argc == 2 && (numSpectra = atoi(argv[1])) <= 0) ){
+        fprintf(stderr, "Usage: TestPeakCodec [number of spectra]\n");
+        exit(1);
+    }
+
+    srand(1);
+    vector<TestSpectrum> spectra(numSpectra);
+    for(int i = 0; i < numSpectra; i++){
+        makeSpectrum(50 + rand() % 450, spectra[i]);
+    }
+
+    const char* codecs[] = { "zlib", "delta", "delta-lossless" };
+    int numFailed = 0;
+    for(int i = 0; i < 3; i++){
+        numFailed += testCodec(codecs[i], 0, spectra);
+        numFailed += testCodec(codecs[i], 3, spectra);
+    }
+    return numFailed == 0 ? 0 : 1;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * End:
+ */
@@ -39,16 +39,21 @@
  */
 
 #include "Verbosity.h"
+#include "BlibException.h"
+#include <boost/thread/mutex.hpp>
 
 namespace BiblioSpec {
 
 V_LEVEL Verbosity::Global_Verbosity = V_STATUS;
 FILE* Verbosity::log_file = NULL;
-char Verbosity::msg_buffer[1024];
+bool Verbosity::throw_errors = false;
+
+// messages from several threads are printed one at a time; never
+// destroyed so that it can be used while the program exits
+static boost::mutex& output_lock = *new boost::mutex();
 
 void Verbosity::set_verbosity(V_LEVEL level) {
     Verbosity::Global_Verbosity = level;
-    Verbosity::msg_buffer[0] = '\0';
 }
 
 void Verbosity::open_logfile(){
@@ -64,6 +69,15 @@ void Verbosity::close_logfile(){
     }
 }
 
+/**
+ * If throwErrors is true, error() throws a BlibException with the
+ * message instead of exiting, so that a program serving several
+ * requests can fail one without stopping.
+ */
+void Verbosity::throw_on_error(bool throwErrors){
+    Verbosity::throw_errors = throwErrors;
+}
+
 V_LEVEL Verbosity::string_to_level(const char* level_str) {
     if( strcmp(level_str, "silent")==0) {
         return V_SILENT;
@@ -94,7 +108,8 @@ V_LEVEL Verbosity::string_to_level(const char* level_str) {
 }
 
 /**
- * Print a message to stderr and exit.
+ * Print a message to stderr and exit, or throw it if throw_on_error()
+ * was set.
  * Equivalent to comment(V_ERROR,,)
  */
 void Verbosity::error(const char* format, ...){
@@ -152,18 +167,22 @@ void Verbosity::debug(const char* format, ...){
 /**
  * Print message to stderr if requested verbosity level is at or above
  * the global verbosity level.  Prepend errors, warnings, and debug
- * statements with ERROR, WARNING, DEBUG.  Exit on V_ERROR.
+ * statements with ERROR, WARNING, DEBUG.  Exit on V_ERROR, or throw
+ * the message if throw_on_error() was set.
  * 
  */
 void Verbosity::comment(V_LEVEL print_level, 
                         const char* format, ...) {
 
-    if(Verbosity::Global_Verbosity < print_level ) {
+    // errors still stop the program when they are not printed
+    bool print = (Verbosity::Global_Verbosity >= print_level);
+    if( ! print && print_level != V_ERROR ) {
         return;
     }
   
     // for appending to the message buffer
-    char* cur_buffer_position = Verbosity::msg_buffer;
+    char msg_buffer[2048];
+    char* cur_buffer_position = msg_buffer;
     int added = 0;
 
     switch(print_level) {
@@ -191,22 +210,31 @@ void Verbosity::comment(V_LEVEL print_level,
     va_list args;
     va_start(args, format);
 
+    const char* message = cur_buffer_position; // without prefix
     added = vsprintf(cur_buffer_position, format, args);
     cur_buffer_position += added;
     sprintf(cur_buffer_position, "\n");
     va_end(args);
 
-    // if no log file, print all levels to stderr
-    if( Verbosity::log_file == NULL ) {
-        cerr << Verbosity::msg_buffer << flush;
-    } else {  // print all levels to file
-        fprintf(log_file, "%s", Verbosity::msg_buffer);
-        if( print_level <= V_STATUS ) {
-            cerr << Verbosity::msg_buffer << flush;
+    if( print ) {
+        boost::mutex::scoped_lock guard(output_lock);
+
+        // if no log file, print all levels to stderr
+        if( Verbosity::log_file == NULL ) {
+            cerr << msg_buffer << flush;
+        } else {  // print all levels to file
+            fprintf(log_file, "%s", msg_buffer);
+            if( print_level <= V_STATUS ) {
+                cerr << msg_buffer << flush;
+            }
         }
     }
     
     if( print_level == V_ERROR ){
+        if( Verbosity::throw_errors ){
+            throw BlibException(false, "%s", 
+                                string(message, added).c_str());
+        }
 	
 	if( Verbosity::log_file != NULL ) {
 	    fclose(log_file);
@@ -214,7 +242,6 @@ void Verbosity::comment(V_LEVEL print_level,
 	exit(1);
     }
 
-    Verbosity::msg_buffer[0] = '\0';
     return;
 }
 
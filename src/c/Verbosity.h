@@ -64,13 +64,14 @@ class Verbosity{
  private:
   static V_LEVEL Global_Verbosity;
   static FILE* log_file;
-  static char msg_buffer[1024];
+  static bool throw_errors; // instead of exiting
 
  public:
   static V_LEVEL string_to_level(const char*);
   static void set_verbosity(V_LEVEL level);
   static void open_logfile();
   static void close_logfile();
+  static void throw_on_error(bool throwErrors);
   static void error(const char*, ...);
   static void warn(const char*, ...);
   static void status(const char*, ...);
@@ -158,9 +158,7 @@ WatersMseReader::WatersMseReader(BlibBuilder& maker,
 WatersMseReader::~WatersMseReader()
 {
     specReader_ = NULL; // so parent class doesn't try to delete itself
-    if( csvFile_.is_open() ){
-        csvFile_.close();
-    }
+    csvFile_.close();
 }
 
 /**
@@ -205,8 +203,8 @@ bool WatersMseReader::parseFile(){
         return false;
     }
     // read header in first line
-    string line;
-    getline(csvFile_, line);
+    TextSlice line;
+    csvFile_.nextLine(line);
     parseHeader(line);
     
     Verbosity::debug("Collecting Psms.");
@@ -227,8 +225,7 @@ bool WatersMseReader::parseFile(){
 bool WatersMseReader::openFile(){
 
     Verbosity::debug("Opening csv File.");
-    csvFile_.open(csvName_.c_str());
-    if( !csvFile_.is_open() ){
+    if( !csvFile_.open(csvName_.c_str()) ){
         throw BlibException(true, "Could not open csv file '%s'.", 
                             csvName_.c_str());
     }
@@ -241,23 +238,23 @@ bool WatersMseReader::openFile(){
  * position of each of the targeted columns.  Sort the target columns
  * by position.
  */
-void WatersMseReader::parseHeader(string& line){
-    CsvTokenizer lineParser(line);
-    CsvTokenIterator token = lineParser.begin();
+void WatersMseReader::parseHeader(const TextSlice& line){
+    CsvFieldTokenizer lineParser(line);
+    TextSlice token;
     int colNumber = 0;
     size_t numColumns = targetColumns_.size();
     
     // for each token in the line
-    for(; token != lineParser.end(); ++token){
+    while( lineParser.next(token) ){
         // check each column for a match
         for(size_t i = 0; i < numColumns; i++){
-            if( *token == targetColumns_[i].name_ ){
+            if( token.equals(targetColumns_[i].name_.c_str()) ){
                 targetColumns_[i].position_ = colNumber;
             }
         }
         // check each optional column
         for(size_t i = 0; i < optionalColumns_.size(); i++){
-            if( *token == optionalColumns_[i].name_ ){
+            if( token.equals(optionalColumns_[i].name_.c_str()) ){
                 optionalColumns_[i].position_ = colNumber;
             }
         }
@@ -289,28 +286,30 @@ void WatersMseReader::parseHeader(string& line){
  */
 void WatersMseReader::collectPsms(){
     
-    // read first non-header line
-    string line;
-    getline(csvFile_, line);
-    lineNum_++;
+    TextSlice line;
     bool parseSuccess = true;
     string errorMsg;
+    LineEntry entry; // reused for each line
 
     // read remainder of file
-    while( ! csvFile_.eof() ){
+    while( csvFile_.nextLine(line) ){
+        lineNum_ = csvFile_.lineNumber();
+        if( line.empty() ){
+            continue;
+        }
 
         size_t colListIdx = 0;  // go through all target columns
         int lineColNumber = 0;  // compare to all file columns
         
-        LineEntry entry; // store each line
+        entry.clear();
         try{
-            CsvTokenizer lineParser(line); // create object for parsing line
-            CsvTokenIterator token = lineParser.begin();// iterator for parser
-            for(; token != lineParser.end(); ++token){
+            CsvFieldTokenizer lineParser(line); // create object for parsing line
+            TextSlice token;
+            while( lineParser.next(token) ){
                 if( lineColNumber == targetColumns_[colListIdx].position_ ){
                     
                     // insert the value in the proper field
-                    targetColumns_[colListIdx].inserter(entry, (*token));
+                    targetColumns_[colListIdx].inserter(entry, token);
                     colListIdx++; // next target column
                     if( colListIdx == targetColumns_.size() )
                         break;
@@ -337,13 +336,12 @@ void WatersMseReader::collectPsms(){
         }
         // store this line's information in the curPSM
         storeLine(entry);
-        
-        getline(csvFile_, line);
-        lineNum_++;
     } // next line
 
     // store the last one
-    insertCurPSM();
+    if( curMsePSM_ != NULL ){
+        insertCurPSM();
+    }
 }
  
 /**
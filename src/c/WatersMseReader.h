@@ -32,14 +32,11 @@
 #pragma once
 
 #include "BuildParser.h"
+#include "MappedTextFile.h"
 #include <set>
-#include "boost/tokenizer.hpp"
 
 namespace BiblioSpec {
 
-typedef boost::tokenizer< boost::escaped_list_separator<char> > CsvTokenizer;
-typedef boost::tokenizer< boost::escaped_list_separator<char> >::iterator 
-                                                           CsvTokenIterator;
 /**
  * Extends the standard PSM with additional fields for the spectrum.
  */
@@ -108,73 +105,79 @@ public:
   double minMass;
   string pass;
 
-  LineEntry() : precursorMz(0), precursorZ(0), retentionTime(0),
+  LineEntry() : precursorMz(0), precursorZ(0), score(0), retentionTime(0),
       fragmentMz(0), fragmentIntensity(0), precursorMass(0), minMass(0){};
 
-  static void insertPrecursorMz(LineEntry& le, const string& value){
-      if( value.empty() ){
-          le.precursorMz = 0;
-      } else {
-          le.precursorMz = boost::lexical_cast<double>(value);
-      }
+  /**
+   * Reset all values, keeping the string buffers so that one entry
+   * can be reused for every line.
+   */
+  void clear(){
+      precursorMz = 0;
+      precursorZ = 0;
+      score = 0;
+      retentionTime = 0;
+      sequence.clear();
+      modification.clear();
+      fragmentMz = 0;
+      fragmentIntensity = 0;
+      precursorMass = 0;
+      minMass = 0;
+      pass.clear();
   }
-  static void insertPrecursorZ(LineEntry& le, const string& value){
-      if( value.empty() ){
-          le.precursorZ = 0;
-      } else {
-          le.precursorZ = boost::lexical_cast<int>(value);
+
+  /**
+   * Convert a numeric column value.  Empty values are zero.
+   */
+  static double toDouble(const TextSlice& value){
+      double number = 0;
+      if( !value.empty() && !parseDouble(value, number) ){
+          throw BlibException(false, "'%s' is not a number", 
+                              value.str().c_str());
       }
+      return number;
   }
-  static void insertScore(LineEntry& le, const string& value){
-      if( value.empty() ){
-          le.score = 0;
-      } else {
-          le.score = boost::lexical_cast<double>(value);
+  static int toInt(const TextSlice& value){
+      int number = 0;
+      if( !value.empty() && !parseInt(value, number) ){
+          throw BlibException(false, "'%s' is not an integer", 
+                              value.str().c_str());
       }
+      return number;
   }
-  static void insertRetentionTime(LineEntry& le, const string& value){
-      if( value.empty() ){
-          le.retentionTime = 0;
-      } else {
-          le.retentionTime = boost::lexical_cast<double>(value);
-      }
+
+  static void insertPrecursorMz(LineEntry& le, const TextSlice& value){
+      le.precursorMz = toDouble(value);
   }
-  static void insertSequence(LineEntry& le, const string& value){
-    le.sequence = value;
+  static void insertPrecursorZ(LineEntry& le, const TextSlice& value){
+      le.precursorZ = toInt(value);
   }
-  static void insertModification(LineEntry& le, const string& value){
-    le.modification = value;
+  static void insertScore(LineEntry& le, const TextSlice& value){
+      le.score = toDouble(value);
   }
-  static void insertFragmentMz(LineEntry& le, const string& value){
-      if( value.empty() ){
-          le.fragmentMz = 0;
-      } else {
-          le.fragmentMz = boost::lexical_cast<double>(value);
-      }
+  static void insertRetentionTime(LineEntry& le, const TextSlice& value){
+      le.retentionTime = toDouble(value);
   }
-  static void insertFragmentIntensity(LineEntry& le, const string& value){
-      if( value.empty() ){
-          le.fragmentIntensity = 0;
-      } else {
-          le.fragmentIntensity = boost::lexical_cast<double>(value);
-      }
+  static void insertSequence(LineEntry& le, const TextSlice& value){
+    le.sequence.assign(value.start, value.length);
   }
-  static void insertPrecursorMass(LineEntry& le, const string& value){
-      if( value.empty() ){
-          le.precursorMass = 0;
-      } else {
-          le.precursorMass = boost::lexical_cast<double>(value);
-      }
+  static void insertModification(LineEntry& le, const TextSlice& value){
+    le.modification.assign(value.start, value.length);
   }
-  static void insertMinMass(LineEntry& le, const string& value){
-      if( value.empty() ){
-          le.minMass = 0;
-      } else {
-          le.minMass = boost::lexical_cast<double>(value);
-      }
+  static void insertFragmentMz(LineEntry& le, const TextSlice& value){
+      le.fragmentMz = toDouble(value);
+  }
+  static void insertFragmentIntensity(LineEntry& le, const TextSlice& value){
+      le.fragmentIntensity = toDouble(value);
+  }
+  static void insertPrecursorMass(LineEntry& le, const TextSlice& value){
+      le.precursorMass = toDouble(value);
+  }
+  static void insertMinMass(LineEntry& le, const TextSlice& value){
+      le.minMass = toDouble(value);
   }
-  static void insertPass(LineEntry& le, const string& value){
-    le.pass = value;
+  static void insertPass(LineEntry& le, const TextSlice& value){
+    le.pass.assign(value.start, value.length);
   }
 };
 /**
@@ -190,11 +193,11 @@ class ColumnTranslator{
 public:
   string name_;
   int position_;
-  void (*inserter)(LineEntry& le, const string& value); 
+  void (*inserter)(LineEntry& le, const TextSlice& value); 
 
   ColumnTranslator(const char* name, 
                    int pos, 
-                   void (*fun)(LineEntry&, const string&))
+                   void (*fun)(LineEntry&, const TextSlice&))
     : name_(name), position_(pos), inserter(fun) { };
 
   friend bool operator< (const ColumnTranslator& left, 
@@ -227,7 +230,7 @@ class WatersMseReader : public BuildParser, public SpecFileReader {
         
     private:
         std::string csvName_;
-        ifstream csvFile_;
+        MappedTextFile csvFile_;
         double scoreThreshold_;
         int lineNum_;
         MsePSM* curMsePSM_; // use this instead of curPSM_
@@ -238,7 +241,7 @@ class WatersMseReader : public BuildParser, public SpecFileReader {
 
         void initTargetColumns();
         bool openFile();
-        void parseHeader(std::string& line);
+        void parseHeader(const TextSlice& line);
         void collectPsms();
         void storeLine(LineEntry& entry);
         void parseModString(LineEntry& entry, MsePSM* psm);
@@ -85,10 +85,48 @@ WeibullPvalue::WeibullPvalue(const ops::variables_map& options_table) :
     data_ = NULL;
 }
 
+WeibullPvalue::WeibullPvalue(const WeibullPvalue& other) :
+    data_(NULL)
+{
+    *this = other;
+}
+
 WeibullPvalue::~WeibullPvalue(){
     delete [] data_;
 }
 
+/**
+ * Copy the settings, the estimated parameters and the data they were
+ * estimated from.
+ */
+WeibullPvalue& WeibullPvalue::operator=(const WeibullPvalue& other){
+    if( this == &other ){
+        return *this;
+    }
+    eta_ = other.eta_;
+    beta_ = other.beta_;
+    shift_ = other.shift_;
+    correlation_ = other.correlation_;
+    numDataPoints_ = other.numDataPoints_;
+    numDataPointsToFit_ = other.numDataPointsToFit_;
+    fractionToFit_ = other.fractionToFit_;
+    min_shift_ = other.min_shift_;
+    max_shift_ = other.max_shift_;
+    step_ = other.step_;
+    correlation_tolerance_ = other.correlation_tolerance_;
+    BONFERRONI_CUT_OFF_P_ = other.BONFERRONI_CUT_OFF_P_;
+    BONFERRONI_CUT_OFF_NP_ = other.BONFERRONI_CUT_OFF_NP_;
+    printAll_ = other.printAll_;
+
+    delete [] data_;
+    data_ = NULL;
+    if( other.data_ != NULL ){
+        data_ = new double[numDataPoints_];
+        copy(other.data_, other.data_ + numDataPoints_, data_);
+    }
+    return *this;
+}
+
 /**
  * Given the data, estimate the eta, beta, and shift parameters of a
  * Weibull distribution and compute the correlation between the given
@@ -278,18 +316,27 @@ double WeibullPvalue::computePvalue(double score) const{
 }
 
 double WeibullPvalue::bonferroniCorrectPvalue(double pvalue) const{
+    // numDataPoints_ has actually been the number of non-decoy
+    // matches; find out what it should be...
+    return bonferroniCorrectPvalue(pvalue, numDataPoints_);
+}
+
+/**
+ * Correct the p-value for the given number of tests rather than for
+ * the number of scores the parameters were estimated from.
+ */
+double WeibullPvalue::bonferroniCorrectPvalue(double pvalue, 
+                                              int numTests) const{
     
     double corrected_pvalue = 0;
     
-    // numDataPoints_ has actually been the number of non-decoy
-    // matches; find out what it should be...
     if( (pvalue > BONFERRONI_CUT_OFF_P_) || 
-        (pvalue * numDataPoints_) > BONFERRONI_CUT_OFF_NP_) {
-        corrected_pvalue = -log(1-pow((1-pvalue), numDataPoints_));
+        (pvalue * numTests) > BONFERRONI_CUT_OFF_NP_) {
+        corrected_pvalue = -log(1-pow((1-pvalue), numTests));
     }
     // else, use the approximation
     else {
-        corrected_pvalue = -log(pvalue * numDataPoints_);
+        corrected_pvalue = -log(pvalue * numTests);
     }
     //cout << "raw pval: " << pvalue << " corrected: " << corrected_pvalue 
     //     << " unlogged raw " << exp(-1 * pvalue) 
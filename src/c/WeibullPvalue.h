@@ -81,7 +81,9 @@ class WeibullPvalue{
  public:
   WeibullPvalue();
   WeibullPvalue(const ops::variables_map& options_table);
+  WeibullPvalue(const WeibullPvalue& other);
   ~WeibullPvalue();
+  WeibullPvalue& operator=(const WeibullPvalue& other);
   bool estimateParams(const vector<double>& scores);
   double getEta() const; 
   double getBeta() const;
@@ -92,6 +94,7 @@ class WeibullPvalue{
 
   double computePvalue(double score) const;
   double bonferroniCorrectPvalue(double pvalue) const;
+  double bonferroniCorrectPvalue(double pvalue, int numTests) const;
 };
 
 } // namespace
@@ -82,11 +82,24 @@ void SAXHandler::characters(const XML_Char *s, int len)
 
 bool SAXHandler::parse()
 {
-    FILE* pfIn = fopen(m_strFileName_.data(), "r");
+    return parseRange(0, -1);
+}
+
+bool SAXHandler::parseRange(long long start, long long end, 
+                            const char* prefix, const char* suffix)
+{
+    // binary, so that offsets match those found by scanning the file
+    // and CRLF is left for expat to handle
+    FILE* pfIn = fopen(m_strFileName_.data(), "rb");
     if (pfIn == NULL) {
         throw BlibException(true, "Failed to open input file '%s'.", 
                             m_strFileName_.c_str());
     }
+    if (start > 0 && fseeko(pfIn, start, SEEK_SET) != 0) {
+        fclose(pfIn);
+        throw BlibException(true, "Failed to read input file '%s' at "
+                            "byte %lld.", m_strFileName_.c_str(), start);
+    }
     
     bool success = true;
     string message;
@@ -98,11 +111,29 @@ bool SAXHandler::parse()
         string temp;
         
         char buffer[8192];
+        if (prefix != NULL) {
+            success = (XML_Parse(m_parser_, prefix, 
+                                 (int)strlen(prefix), false) != 0);
+        }
+
+        long long remaining = (end < 0) ? -1 : end - start;
         int readBytes = 0;
-        
-        while (success && (readBytes = (int) fread(buffer, 1, sizeof(buffer), pfIn)) != 0) {
+        while (success && remaining != 0) {
+            size_t toRead = sizeof(buffer);
+            if (remaining > 0 && remaining < (long long)toRead)
+                toRead = (size_t)remaining;
+            readBytes = (int) fread(buffer, 1, toRead, pfIn);
+            if (readBytes == 0)
+                break;
+            if (remaining > 0)
+                remaining -= readBytes;
             success = (XML_Parse(m_parser_, buffer, readBytes, false) != 0);
         }
+
+        if (success && suffix != NULL) {
+            success = (XML_Parse(m_parser_, suffix, 
+                                 (int)strlen(suffix), false) != 0);
+        }
         success = success && (XML_Parse(m_parser_, buffer, 0, true) != 0);
     }
     catch(string thrown_msg) { // from parsers
@@ -111,6 +142,7 @@ bool SAXHandler::parse()
     }
     catch(BlibException e) { // probably from BuildParser
         if( e.hasFilename() ){
+            fclose(pfIn);
             throw e;
         } else {
             message = e.what();
@@ -130,8 +162,11 @@ bool SAXHandler::parse()
         ostringstream stringBuilder(ostringstream::out);
         
         stringBuilder << m_strFileName_
-                      << "(line " << lineNum
-                      << "): " << message << flush;
+                      << "(line " << lineNum;
+        if (start > 0) {
+            stringBuilder << " of section starting at byte " << start;
+        }
+        stringBuilder << "): " << message << flush;
         
         if (message.length() == 0) {
             switch (error) {
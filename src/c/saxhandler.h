@@ -88,6 +88,16 @@ public:
     */
     bool parse();
 
+    /**
+    * Stream only the bytes from start up to (not including) end to
+    * the SAX parser.  The optional prefix and suffix are parsed
+    * before and after those bytes so that one section of a document
+    * can be read as a whole document.  An end of -1 reads to the end
+    * of the file.
+    */
+    bool parseRange(long long start, long long end, 
+                    const char* prefix = NULL, const char* suffix = NULL);
+
     inline void setFileName(const char* fileName)
     {
         m_strFileName_ = fileName;
@@ -43,6 +43,9 @@
 #ifndef strcasecmp
 #define strcasecmp _stricmp
 #endif
+#ifndef fseeko
+#define fseeko _fseeki64
+#endif
 #endif
 
 #ifndef XML_STATIC